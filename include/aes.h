@@ -0,0 +1,78 @@
+#ifndef AES_H_
+#define AES_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* part of the libencro API, see encro.h */
+#pragma GCC visibility push(default)
+
+#define ENCRO_AES_KEYLEN     16            /* key size in bytes */
+#define ENCRO_AES_KEYEXPSIZE (16*11)       /* expanded key size */
+#define ENCRO_AES_BLOCKLEN   16            /* block size in bytes */
+
+#define ENCRO_AES_COLUMNS    4             /* number of columns in state matrix */
+#define ENCRO_AES_KEY_WORD   4             /* number of 32-bit words in key */
+#define ENCRO_AES_ROUNDS     10            /* number of cipher rounds */
+
+#define ENCRO_AES_BATCH      8             /* blocks per bitsliced call */
+
+struct encro_aes_ctx;
+
+/* a block cipher backend, both functions work on n blocks in place */
+struct encro_aes_engine {
+    const char *name;
+    void (*init)(struct encro_aes_ctx *ctx, const uint8_t *key);
+    void (*encrypt)(const struct encro_aes_ctx *ctx, uint8_t *buf, size_t n);
+    void (*decrypt)(const struct encro_aes_ctx *ctx, uint8_t *buf, size_t n);
+};
+
+struct encro_aes_ctx {
+    uint8_t round_key[ENCRO_AES_KEYEXPSIZE];
+    uint8_t iv[ENCRO_AES_BLOCKLEN];
+    /* round keys as bit planes, see aes_bitslice.c */
+    uint64_t bs_round_key[(ENCRO_AES_ROUNDS+1)*8];
+    const struct encro_aes_engine *engine;
+    /* unused CTR keystream */
+    uint8_t ks[ENCRO_AES_BATCH*ENCRO_AES_BLOCKLEN];
+    size_t ks_pos;
+};
+
+extern const struct encro_aes_engine encro_aes_engine_ref;
+extern const struct encro_aes_engine encro_aes_engine_bitslice;
+
+/* the engine named by $ENCRO_AES, bitslice by default */
+const struct encro_aes_engine *encro_aes_default_engine(void);
+const struct encro_aes_engine *encro_aes_find_engine(const char *name);
+
+void encro_aes_init(struct encro_aes_ctx *ctx, const uint8_t *key, const uint8_t *iv);
+void encro_aes_init_engine(struct encro_aes_ctx *ctx, const struct encro_aes_engine *engine,
+                           const uint8_t *key, const uint8_t *iv);
+
+/* a new iv or initial counter block under the same key schedule */
+void encro_aes_set_iv(struct encro_aes_ctx *ctx, const uint8_t *iv);
+
+/* buf is used as the output so its size must be a multiple of ENCRO_AES_BLOCKLEN */
+void encro_aes_cbc_encrypt_buf(struct encro_aes_ctx *ctx, uint8_t *buf, size_t sz);
+void encro_aes_cbc_decrypt_buf(struct encro_aes_ctx *ctx, uint8_t *buf, size_t sz);
+
+/* iv is the initial counter block, any sz works and calls can be chained */
+void encro_aes_ctr_xcrypt_buf(struct encro_aes_ctx *ctx, uint8_t *buf, size_t sz);
+
+/* moves off bytes into the keystream from the next counter block, on a fresh
+ * context that is byte off of the message */
+void encro_aes_ctr_seek(struct encro_aes_ctx *ctx, uint64_t off);
+
+size_t encro_pad_pkcs7(uint8_t *buf, size_t blocksz, size_t sz);
+size_t encro_unpad_pkcs7(uint8_t *buf, size_t sz);
+
+/* a whole message in CBC mode with PKCS #7 padding, buf needs room for
+ * sz + ENCRO_AES_BLOCKLEN bytes when encrypting
+ * return the new size, decryption returns (size_t)-1 if sz is not a nonzero
+ * multiple of ENCRO_AES_BLOCKLEN or the padding is bad */
+size_t encro_aes_cbc_encrypt_padded(struct encro_aes_ctx *ctx, uint8_t *buf, size_t sz);
+size_t encro_aes_cbc_decrypt_padded(struct encro_aes_ctx *ctx, uint8_t *buf, size_t sz);
+
+#pragma GCC visibility pop
+
+#endif // AES_H_
@@ -1,7 +1,51 @@
 #ifndef ALGO_UTILS_H_
 #define ALGO_UTILS_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #define IS_UPPERCASE(c) ((c) >= 'A' && (c) <= 'Z')
 #define IS_LOWERCASE(c) ((c) >= 'a' && (c) <= 'z')
 
+/* default payload size for --verify */
+#define VERIFY_SIZE (16<<20)
+
+/* monotonic clock in seconds */
+double time_now(void);
+
+/* parses up to sz bytes of hex, stops at the first non-hex character
+ * returns the number of bytes written */
+size_t parse_hex(uint8_t *out, size_t sz, const char *hex);
+
+/* random key material, see rng.h */
+void keygen(uint8_t *key, size_t sz);
+
+/* prints buf as uppercase hex followed by a newline */
+void print_hex(const uint8_t *buf, size_t sz);
+
+/* how the one message modes print ciphertext, set with --encoding */
+enum encoding { ENCODING_HEX, ENCODING_BASE64, ENCODING_RAW };
+extern enum encoding ciphertext_encoding;
+
+/* hex, base64 or raw, -1 for anything else */
+int parse_encoding(const char *name);
+
+/* prints buf in ciphertext_encoding followed by a newline */
+void print_ciphertext(const uint8_t *buf, size_t sz);
+
+/* decodes a line of hex or base64 ciphertext into out, which needs len
+ * bytes. a line that is both is read as ciphertext_encoding says.
+ * returns the number of bytes or (size_t)-1 if it is neither */
+size_t parse_ciphertext(uint8_t *out, const char *line, size_t len);
+
+/* fills buf with random printable ascii, for round-trip tests */
+void random_text(char *buf, size_t sz);
+
+/* a positive number with an optional k, M or G suffix
+ * returns 0 if s is anything else or doesn't fit */
+size_t parse_size(const char *s);
+
+/* prints the result of a --verify round trip, returns ok */
+int verify_report(const char *name, size_t sz, double enc_secs, double dec_secs, int ok);
+
 #endif // ALGO_UTILS_H_
@@ -1,11 +1,66 @@
 #ifndef ALGORITHMS_H_
 #define ALGORITHMS_H_
 
+#include <stddef.h>
+
+struct algorithm {
+    const char *name;
+    void (*encrypt)(void);
+    void (*decrypt)(void);          /* NULL if -d is not supported */
+    int (*verify)(size_t sz);       /* NULL if --verify is not supported */
+    /* tools with options of their own get the command line from their name
+     * on and return the exit status, the rest are NULL */
+    int (*command)(int argc, char *argv[]);
+};
+
+/* every algorithm, sorted by name with strcmp for bsearch
+ * generated into src/algo_table.c by make */
+extern const struct algorithm algo_table[];
+extern const size_t algo_count;
+
+/* adds an algorithm or command to algo_table, make picks these up from the sources so
+ * each one has to sit on a line of its own. the expansion only redeclares
+ * algo_table, which swallows the semicolon */
+#define REGISTER_ALGORITHM(name, encrypt, decrypt, verify) \
+    extern const struct algorithm algo_table[]
+#define REGISTER_COMMAND(name, command) \
+    extern const struct algorithm algo_table[]
+
 void algo_caesar(void);
 void algo_vigenere(void);
+void algo_vigenere_crack(void);
 void algo_fake_rsa(void);
 void algo_rsa(void);
 void algo_aes(void);
+void algo_aes_ctr(void);
+void algo_chacha20(void);
 void algo_atbash(void);
+void algo_hashstats(void);
+int cmd_bench(int argc, char *argv[]);
+int cmd_serve(int argc, char *argv[]);
+int cmd_client(int argc, char *argv[]);
+int cmd_loadgen(int argc, char *argv[]);
+int cmd_batch(int argc, char *argv[]);
+int cmd_files(int argc, char *argv[]);
+int cmd_pipe(int argc, char *argv[]);
+
+void algo_caesar_decrypt(void);
+void algo_vigenere_decrypt(void);
+void algo_fake_rsa_decrypt(void);
+void algo_rsa_decrypt(void);
+void algo_aes_decrypt(void);
+void algo_aes_ctr_decrypt(void);
+void algo_chacha20_decrypt(void);
+void algo_atbash_decrypt(void);
+
+/* round-trip sz bytes in memory, print throughput, return 1 if it matched */
+int verify_caesar(size_t sz);
+int verify_vigenere(size_t sz);
+int verify_fake_rsa(size_t sz);
+int verify_rsa(size_t sz);
+int verify_aes(size_t sz);
+int verify_aes_ctr(size_t sz);
+int verify_chacha20(size_t sz);
+int verify_atbash(size_t sz);
 
 #endif // ALGORITHMS_H_
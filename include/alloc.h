@@ -0,0 +1,13 @@
+#ifndef ALLOC_H_
+#define ALLOC_H_
+
+#include <stddef.h>
+
+/* size class allocator with per-thread free lists, see alloc.c
+ * same contract as malloc/realloc/free, so the three can be handed to
+ * hashmap_new_with_allocator, but memory must go back through slab_free */
+void *slab_alloc(size_t sz);
+void *slab_realloc(void *p, size_t sz);
+void slab_free(void *p);
+
+#endif // ALLOC_H_
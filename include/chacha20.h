@@ -0,0 +1,53 @@
+#ifndef CHACHA20_H_
+#define CHACHA20_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* part of the libencro API, see encro.h */
+#pragma GCC visibility push(default)
+
+#define ENCRO_CHACHA20_KEYLEN   32         /* key size in bytes */
+#define ENCRO_CHACHA20_NONCELEN 12         /* nonce size in bytes (RFC 8439) */
+#define ENCRO_CHACHA20_BLOCKLEN 64         /* keystream block size in bytes */
+#define ENCRO_CHACHA20_BATCH    8          /* most blocks any kernel does per call */
+
+/* xors n blocks of keystream into buf, starting at the counter in state[12] */
+struct encro_chacha20_kernel {
+    const char *name;
+    size_t blocks;                   /* blocks per call */
+    int (*supported)(void);
+    void (*xor_blocks)(const uint32_t *state, uint8_t *buf, size_t n);
+};
+
+struct encro_chacha20_ctx {
+    uint32_t state[16];
+    const struct encro_chacha20_kernel *kernel;
+    /* unused keystream */
+    uint8_t ks[ENCRO_CHACHA20_BATCH*ENCRO_CHACHA20_BLOCKLEN];
+    size_t ks_pos;
+};
+
+/* the fastest kernel the cpu supports, or the one named by $ENCRO_CHACHA */
+const struct encro_chacha20_kernel *encro_chacha20_default_kernel(void);
+const struct encro_chacha20_kernel *encro_chacha20_find_kernel(const char *name);
+
+void encro_chacha20_init(struct encro_chacha20_ctx *ctx, const uint8_t *key,
+                         const uint8_t *nonce, uint32_t counter);
+void encro_chacha20_init_kernel(struct encro_chacha20_ctx *ctx,
+                                const struct encro_chacha20_kernel *kernel,
+                                const uint8_t *key, const uint8_t *nonce, uint32_t counter);
+
+/* a new nonce and counter under the same key */
+void encro_chacha20_set_nonce(struct encro_chacha20_ctx *ctx, const uint8_t *nonce,
+                              uint32_t counter);
+
+/* same contract as encro_aes_ctr_xcrypt_buf, any sz works and calls can be chained */
+void encro_chacha20_xcrypt_buf(struct encro_chacha20_ctx *ctx, uint8_t *buf, size_t sz);
+
+/* same as encro_aes_ctr_seek, the 32 bit counter wraps after 256G */
+void encro_chacha20_seek(struct encro_chacha20_ctx *ctx, uint64_t off);
+
+#pragma GCC visibility pop
+
+#endif // CHACHA20_H_
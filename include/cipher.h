@@ -0,0 +1,76 @@
+#ifndef CIPHER_H_
+#define CIPHER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <encro.h>
+
+/* the ciphers that take a key once and then any number of messages, as used
+ * by encro serve, encro batch and encro files. the iv, counter or nonce in
+ * the key is only a starting point: a stream cipher run twice from the same
+ * one gives the same keystream, and CBC from the same iv shows which
+ * messages begin alike, so every message under one key gets a fresh one from
+ * cipher_set_nonce and is sent along with it */
+
+/* the key material each algorithm wants */
+enum cipher_algo {
+    CIPHER_CAESAR = 1,      /* one byte shift */
+    CIPHER_ATBASH,          /* none */
+    CIPHER_VIGENERE,        /* the key text */
+    CIPHER_AES,             /* key then iv, CBC with PKCS #7 padding */
+    CIPHER_AES_CTR,         /* key then initial counter block */
+    CIPHER_CHACHA20,        /* key then nonce */
+};
+
+/* most key material any algorithm takes */
+#define CIPHER_KEYSZ ENCRO_VIGENERE_KEYSZ
+
+/* biggest iv or nonce any algorithm takes */
+#define CIPHER_NONCESZ ENCRO_AES_BLOCKLEN
+
+struct cipher_key {
+    unsigned algo;
+    union {
+        unsigned shift;
+        struct encro_vigenere vigenere[2];    /* encrypt and decrypt */
+        struct encro_aes_ctx aes;
+        struct encro_chacha20_ctx chacha20;
+    } u;
+};
+
+/* enum cipher_algo of a name as on the encro command line, 0 if unknown */
+int cipher_algo(const char *name);
+
+/* ciphertext of these is binary, the others keep text as text */
+int cipher_is_binary(unsigned algo);
+
+/* key material from the form the algorithm asks for when run on its own: the
+ * shift for caesar, the key for vigenere and hex for the rest. the iv or
+ * nonce may be left out of the hex and is zero then, for callers that set
+ * their own per message
+ * returns the size or -1 */
+ssize_t cipher_parse_key(unsigned algo, const char *s, uint8_t *key, size_t cap);
+
+/* expands the key schedule, returns 0 or -1 on bad key material */
+int cipher_key_init(struct cipher_key *k, unsigned algo, const uint8_t *key, size_t sz);
+
+/* size of the iv or nonce the algorithm takes, 0 if it has none */
+size_t cipher_nonce_size(unsigned algo);
+
+/* starts k over from nonce, cipher_nonce_size bytes of it, with the key
+ * schedule kept. does nothing for the algorithms without one */
+void cipher_set_nonce(struct cipher_key *k, const uint8_t *nonce);
+
+/* one message in place, buf needs room for sz + ENCRO_AES_BLOCKLEN bytes. k is
+ * used up, run each message on a copy of the key
+ * returns the new size or (size_t)-1 if aes can't decrypt it */
+size_t cipher_message(struct cipher_key *k, int decrypt, uint8_t *buf, size_t sz);
+
+/* moves a fresh copy of the key off bytes into a message, so the pieces of
+ * one message can be worked on in any order. only aes-ctr and chacha20 can
+ * returns 0 or -1 */
+int cipher_seek(struct cipher_key *k, uint64_t off);
+
+#endif // CIPHER_H_
@@ -0,0 +1,49 @@
+#ifndef CODEC_H_
+#define CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* part of the libencro API, see encro.h */
+#pragma GCC visibility push(default)
+
+/* hex and base64 on whole buffers, with SSSE3 and AVX2 kernels picked at
+ * run time like the ChaCha20 ones */
+
+#define ENCRO_HEX_LEN(sz)    (2*(size_t)(sz))
+#define ENCRO_BASE64_LEN(sz) (((size_t)(sz) + 2) / 3 * 4)
+
+/* an encoder and decoder pair */
+struct encro_codec_kernel {
+    const char *name;
+    int (*supported)(void);
+    /* each does what it can in whole vectors and returns how much of in it
+     * used, the decoders stop before a vector with a character they don't
+     * take so the portable code can find it */
+    size_t (*hex_encode)(char *out, const uint8_t *in, size_t sz);
+    size_t (*hex_decode)(uint8_t *out, const char *in, size_t len);
+    size_t (*base64_encode)(char *out, const uint8_t *in, size_t sz);
+    size_t (*base64_decode)(uint8_t *out, const char *in, size_t len);
+};
+
+/* the fastest kernel the cpu supports, or the one named by $ENCRO_CODEC */
+const struct encro_codec_kernel *encro_codec_default_kernel(void);
+const struct encro_codec_kernel *encro_codec_find_kernel(const char *name);
+
+/* uppercase, writes ENCRO_HEX_LEN(sz) bytes and returns that */
+size_t encro_hex_encode(char *out, const uint8_t *in, size_t sz);
+
+/* decodes pairs of digits in either case until len runs out or a pair isn't
+ * hex, writes at most len/2 bytes and returns how many */
+size_t encro_hex_decode(uint8_t *out, const char *in, size_t len);
+
+/* RFC 4648 with padding, writes ENCRO_BASE64_LEN(sz) bytes and returns that */
+size_t encro_base64_encode(char *out, const uint8_t *in, size_t sz);
+
+/* padding is optional, writes at most len/4*3 + 2 bytes
+ * returns how many or (size_t)-1 if in isn't base64 */
+size_t encro_base64_decode(uint8_t *out, const char *in, size_t len);
+
+#pragma GCC visibility pop
+
+#endif // CODEC_H_
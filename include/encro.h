@@ -0,0 +1,69 @@
+#ifndef ENCRO_H_
+#define ENCRO_H_
+
+/* public header of libencro
+ * every cipher works in place on a caller owned buffer, keeps its state in a
+ * caller owned context and never reads stdin or prints, so any number of
+ * threads can use it at once with a context each. every name starts with
+ * encro_ or ENCRO_, the library is built with -fvisibility=hidden and only
+ * exports what this header and the ones it includes declare */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <aes.h>
+#include <chacha20.h>
+#include <codec.h>
+#include <rng.h>
+
+#pragma GCC visibility push(default)
+
+#define ENCRO_VIGENERE_KEYSZ 256
+
+/* shifts letters by shift (mod 26) and leaves everything else alone,
+ * decrypt with 26 - shift */
+void encro_caesar_buf(char *buf, size_t sz, unsigned shift);
+
+/* its own inverse */
+void encro_atbash_buf(char *buf, size_t sz);
+
+struct encro_vigenere {
+    unsigned char shift[ENCRO_VIGENERE_KEYSZ];
+    size_t len, pos;                  /* pos carries over between calls */
+};
+
+/* letters of key are the shifts, anything else in it shifts by 0
+ * returns -1 if key is ENCRO_VIGENERE_KEYSZ bytes or longer */
+int encro_vigenere_init(struct encro_vigenere *v, const char *key, int decrypt);
+void encro_vigenere_buf(struct encro_vigenere *v, char *buf, size_t sz);
+
+#define ENCRO_CRACK_MAX_PERIOD 32
+
+/* strips everything but letters and maps them to 0-25 in place
+ * returns the number of letters kept */
+size_t encro_compact_letters(uint8_t *buf, size_t sz);
+
+/* estimates the key length of a vigenere ciphertext of len letters (0-25)
+ * and recovers the key, writes period+1 bytes (nul-terminated) to key
+ * returns the key length or 0 on error */
+unsigned encro_vigenere_crack(const uint8_t *text, size_t len, unsigned max_period, char *key);
+
+/* textbook RSA with 16 bit primes, messages must be below n */
+struct encro_rsa_key {
+    uint32_t e, d, n;
+};
+
+/* draws from encro_rng_bytes, any number of threads can make keys at once */
+void encro_rsa_keygen(struct encro_rsa_key *key);
+uint32_t encro_rsa_encrypt(const struct encro_rsa_key *key, uint32_t m);
+uint32_t encro_rsa_decrypt(const struct encro_rsa_key *key, uint32_t c);
+
+/* every byte encrypted on its own into a 32 bit word */
+void encro_fake_rsa_encrypt(uint32_t *out, const uint8_t *in, size_t sz,
+                      const struct encro_rsa_key *key);
+void encro_fake_rsa_decrypt(uint8_t *out, const uint32_t *in, size_t sz,
+                      const struct encro_rsa_key *key);
+
+#pragma GCC visibility pop
+
+#endif // ENCRO_H_
@@ -31,6 +31,15 @@ struct hashmap *hashmap_new_with_allocator(
                                            void *udata),
                             void (*elfree)(void *item),
                             void *udata);
+struct hashmap *hashmap_new_swiss(size_t elsize, size_t cap,
+                            uint64_t seed0, uint64_t seed1,
+                            uint64_t (*hash)(const void *item,
+                                             uint64_t seed0, uint64_t seed1),
+                            int (*compare)(const void *a, const void *b,
+                                           void *udata),
+                            void (*elfree)(void *item),
+                            void *udata);
+bool hashmap_set_incremental(struct hashmap *map, bool incremental);
 void hashmap_free(struct hashmap *map);
 void hashmap_clear(struct hashmap *map, bool update_cap);
 size_t hashmap_count(struct hashmap *map);
@@ -38,15 +47,78 @@ bool hashmap_oom(struct hashmap *map);
 void *hashmap_get(struct hashmap *map, const void *item);
 void *hashmap_set(struct hashmap *map, const void *item);
 void *hashmap_delete(struct hashmap *map, void *item);
+void *hashmap_get_with_hash(struct hashmap *map, const void *key,
+                            uint64_t hash);
+void *hashmap_set_with_hash(struct hashmap *map, const void *item,
+                            uint64_t hash);
+void *hashmap_delete_with_hash(struct hashmap *map, const void *key,
+                               uint64_t hash);
+void hashmap_get_many(struct hashmap *map, const void *keys, size_t n,
+                      void **out);
+bool hashmap_reserve(struct hashmap *map, size_t n);
+bool hashmap_bulk_load(struct hashmap *map, const void *items, size_t n);
 void *hashmap_probe(struct hashmap *map, uint64_t position);
 bool hashmap_scan(struct hashmap *map,
                   bool (*iter)(const void *item, void *udata), void *udata);
 bool hashmap_iter(struct hashmap *map, size_t *i, void **item);
 
+bool hashmap_snapshot(struct hashmap *map, const char *path);
+struct hashmap *hashmap_open_snapshot(const char *path, size_t elsize,
+                            uint64_t (*hash)(const void *item,
+                                             uint64_t seed0, uint64_t seed1),
+                            int (*compare)(const void *a, const void *b,
+                                           void *udata),
+                            void *udata);
+
+#define HASHMAP_STATS_DIBS 16
+
+struct hashmap_stats {
+    size_t count;
+    size_t nbuckets;
+    double load;                        // count/nbuckets
+    size_t dibs[HASHMAP_STATS_DIBS];    // items by dib-1, the last is dib>=16
+    double avg_dib;
+    size_t max_dib;
+    bool counted;                       // built with HASHMAP_STATS
+    uint64_t resizes;
+    uint64_t resize_ns;
+    uint64_t hits;                      // hashmap_get calls that found the key
+    uint64_t misses;
+};
+
+void hashmap_stats(struct hashmap *map, struct hashmap_stats *stats);
+
+struct hashmap_sharded;
+
+struct hashmap_sharded *hashmap_sharded_new(size_t elsize, size_t cap,
+                            size_t nshards,
+                            uint64_t seed0, uint64_t seed1,
+                            uint64_t (*hash)(const void *item,
+                                             uint64_t seed0, uint64_t seed1),
+                            int (*compare)(const void *a, const void *b,
+                                           void *udata),
+                            void (*elfree)(void *item),
+                            void *udata);
+void hashmap_sharded_free(struct hashmap_sharded *map);
+size_t hashmap_sharded_count(struct hashmap_sharded *map);
+bool hashmap_sharded_get(struct hashmap_sharded *map, const void *key,
+                         void *out);
+int hashmap_sharded_set(struct hashmap_sharded *map, const void *item,
+                        void *old);
+bool hashmap_sharded_delete(struct hashmap_sharded *map, const void *key,
+                            void *out);
+bool hashmap_sharded_scan(struct hashmap_sharded *map,
+                          bool (*iter)(const void *item, void *udata),
+                          void *udata);
+
 uint64_t hashmap_sip(const void *data, size_t len, 
                      uint64_t seed0, uint64_t seed1);
 uint64_t hashmap_murmur(const void *data, size_t len, 
                         uint64_t seed0, uint64_t seed1);
+uint64_t hashmap_wy(const void *data, size_t len,
+                    uint64_t seed0, uint64_t seed1);
+uint64_t hashmap_aes(const void *data, size_t len,
+                     uint64_t seed0, uint64_t seed1);
 
 
 // DEPRECATED: use `hashmap_new_with_allocator`
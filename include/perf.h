@@ -0,0 +1,61 @@
+#ifndef PERF_H_
+#define PERF_H_
+
+/* hardware counters around the hot paths, built in with make PERF=1.
+ *
+ *     PERF_BEGIN(PERF_BLOCK);
+ *     ...
+ *     PERF_END(PERF_BLOCK);
+ *
+ * adds the calls, nanoseconds, cycles, instructions, cache misses and
+ * branch misses between the two to the region. each thread opens its own
+ * perf_event_open group the first time it enters a region, counters the
+ * kernel or the cpu doesn't have are left out of the report, which goes to
+ * stderr at exit and after every cipher in encro bench. regions that nest
+ * are counted in both, and every begin and end costs a read(2), so they go
+ * around buffers, not single blocks.
+ * without PERF=1 the macros are empty and nothing here is compiled */
+
+#include <stdio.h>
+
+enum perf_region {
+    PERF_KEY_EXPANSION,
+    PERF_BLOCK,                         /* the block and stream ciphers */
+    PERF_PADDING,
+    PERF_CLASSICAL,                     /* caesar, vigenere and atbash */
+    PERF_POWMOD,
+    PERF_IO,
+    PERF_FORMAT,                        /* hex and base64 */
+    PERF_REGIONS
+};
+
+#ifdef ENCRO_PERF
+
+#include <stdint.h>
+
+#define PERF_COUNTERS 4
+
+struct perf_sample {
+    uint64_t ns;
+    uint64_t counters[PERF_COUNTERS];
+};
+
+void perf_begin(struct perf_sample *s);
+void perf_end(enum perf_region region, const struct perf_sample *s);
+
+/* prints the totals so far under title and clears them */
+void perf_report(FILE *f, const char *title);
+
+#define PERF_BEGIN(region)    struct perf_sample perf_sample_##region; perf_begin(&perf_sample_##region)
+#define PERF_END(region)      perf_end(region, &perf_sample_##region)
+#define PERF_REPORT(f, title) perf_report(f, title)
+
+#else
+
+#define PERF_BEGIN(region)    ((void)0)
+#define PERF_END(region)      ((void)0)
+#define PERF_REPORT(f, title) ((void)0)
+
+#endif
+
+#endif // PERF_H_
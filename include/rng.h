@@ -0,0 +1,24 @@
+#ifndef RNG_H_
+#define RNG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* part of the libencro API, see encro.h */
+#pragma GCC visibility push(default)
+
+/* cryptographic random numbers, ChaCha20 keystream under a key that is
+ * replaced every time the buffer is refilled. each thread has its own state,
+ * seeded from getrandom() on first use and again in the child after fork, so
+ * threads never wait on each other */
+
+void encro_rng_bytes(void *buf, size_t sz);
+uint32_t encro_rng_u32(void);
+uint64_t encro_rng_u64(void);
+
+/* uniform in [0, bound), bound must not be 0 */
+uint32_t encro_rng_uniform(uint32_t bound);
+
+#pragma GCC visibility pop
+
+#endif // RNG_H_
@@ -0,0 +1,61 @@
+#ifndef SERVE_H_
+#define SERVE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include <cipher.h>
+
+/* protocol of encro serve, a unix socket on the same machine so integers are
+ * in host byte order. a client sends a request header followed by len bytes
+ * of payload and gets a reply header followed by len bytes back, requests on
+ * one connection are answered in order */
+
+#define SERVE_SOCKET      "/tmp/encro.sock"
+#define SERVE_MAX_PAYLOAD (64<<20)
+
+/* aes, aes-ctr and chacha20 never run twice from the same iv or nonce: the
+ * server picks a random one, cipher_nonce_size bytes, for every SERVE_ENCRYPT
+ * and sends it in front of the ciphertext, and SERVE_DECRYPT takes the
+ * ciphertext with it in front the same way. the iv or nonce in the key
+ * material of SERVE_ADD_KEY isn't used */
+enum serve_op {
+    SERVE_ADD_KEY = 1,      /* payload is key material, reply is an 8 byte handle */
+    SERVE_DEL_KEY,
+    SERVE_ENCRYPT,          /* reply is the iv or nonce and the ciphertext */
+    SERVE_DECRYPT,          /* payload is the iv or nonce and the ciphertext */
+};
+
+enum serve_status {
+    SERVE_OK,
+    SERVE_EBADREQ,          /* unknown op or algorithm, bad key material */
+    SERVE_ENOKEY,           /* no such handle, or it is for another algorithm */
+    SERVE_ETOOBIG,          /* payload over SERVE_MAX_PAYLOAD, closes the connection */
+    SERVE_EDECRYPT,         /* bad length or padding, or no iv or nonce */
+    SERVE_ENOMEM,
+};
+
+struct serve_request {
+    uint32_t len;
+    uint8_t op, algo;       /* enum cipher_algo, atbash takes key handle 0 */
+    uint16_t reserved;
+    uint64_t key;           /* handle from SERVE_ADD_KEY */
+};
+
+struct serve_reply {
+    uint32_t len;
+    uint32_t status;
+};
+
+const char *serve_strerror(uint32_t status);
+
+/* a connected socket or -1 with errno set */
+int serve_connect(const char *path);
+
+/* serve_read returns 1 once sz bytes are in, 0 on end of file before the
+ * first byte and -1 on errors and short reads, serve_write returns 0 or -1 */
+int serve_read(int fd, void *buf, size_t sz);
+int serve_write(int fd, struct iovec *iov, int n);
+
+#endif // SERVE_H_
@@ -0,0 +1,34 @@
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define STREAM_CHUNK (1<<20)          /* size of each read buffer */
+
+/* double buffered input, the next chunk is read while the previous one is
+ * transformed and written */
+struct stream {
+    int fd_in, fd_out;
+    char *buf[2];
+    size_t len;                       /* bytes left over in buf[0] */
+};
+
+typedef void (*stream_fn)(char *buf, size_t sz, void *udata);
+
+int stream_init(struct stream *s, int fd_in, int fd_out);
+void stream_free(struct stream *s);
+
+/* reads one line without the newline, truncated to sz-1 bytes
+ * returns the line length or -1 on EOF/error */
+ssize_t stream_getline(struct stream *s, char *line, size_t sz);
+
+/* transforms the rest of the input in place with fn and writes it out,
+ * prefix is written before the first chunk if not NULL
+ * returns 0 on success or -1 on error */
+int stream_transform(struct stream *s, const char *prefix, stream_fn fn, void *udata);
+
+/* write(2) until everything is written */
+int stream_write(int fd, const void *buf, size_t sz);
+
+#endif // STREAM_H_
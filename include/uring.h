@@ -0,0 +1,44 @@
+#ifndef URING_H_
+#define URING_H_
+
+#include <stddef.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/* just enough of io_uring for encro files, on the raw system calls so there
+ * is nothing to install. one thread owns a ring, it fills submission entries
+ * with uring_sqe, hands them to the kernel with uring_enter and reaps
+ * completions with uring_cqe and uring_cqe_seen */
+
+struct uring {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_sz, cq_ring_sz, sqes_sz;
+    unsigned sq_local_tail;             /* filled but not yet submitted up to here */
+};
+
+/* returns 0 or -1 with errno set, ENOSYS or EPERM when the kernel has no
+ * io_uring or it is turned off */
+int uring_init(struct uring *r, unsigned entries);
+void uring_free(struct uring *r);
+
+/* pins n buffers for IORING_OP_READ_FIXED and IORING_OP_WRITE_FIXED
+ * returns 0 or -1 with errno set */
+int uring_register_buffers(struct uring *r, const struct iovec *iov, unsigned n);
+
+/* a zeroed submission entry, NULL when the ring is full */
+struct io_uring_sqe *uring_sqe(struct uring *r);
+
+/* submits everything filled since the last call and waits for at least
+ * wait completions, returns 0 or -1 with errno set */
+int uring_enter(struct uring *r, unsigned wait);
+
+/* the oldest completion or NULL, uring_cqe_seen gives its slot back */
+struct io_uring_cqe *uring_cqe(struct uring *r);
+void uring_cqe_seen(struct uring *r);
+
+#endif // URING_H_
@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <algorithms.h>
 
 #include <stdlib.h>
@@ -5,32 +7,15 @@
 #include <stdint.h>
 #include <string.h>
 
-#define AES_KEYLEN     16            /* key size in bytes */
-#define AES_KEYEXPSIZE (16*11)       /* expanded key size */
-#define AES_BLOCKLEN   16            /* block size in bytes */
-
-#define AES_COLUMNS    4             /* number of columns in state matrix */
-#define AES_KEY_WORD   4             /* number of 32-bit words in key */
-#define AES_ROUNDS     10            /* number of cipher rounds */
-
-struct ctx {
-    uint8_t round_key[AES_KEYEXPSIZE];
-    uint8_t iv[AES_BLOCKLEN];
-};
+#include <aes.h>
+#include <algo_utils.h>
+#include <alloc.h>
+#include <perf.h>
 
 /* state matrix */
 typedef uint8_t state_t[4][4];
 
 /* forward declarations */
-void ctx_init(struct ctx *ctx, const uint8_t *key, const uint8_t *iv);
-
-/* buf is used as the output so its size must be a multiple of AES_BLOCKLEN */
-void cbc_encrypt_buf(struct ctx *ctx, uint8_t *buf, size_t sz);
-void cbc_decrypt_buf(struct ctx *ctx, uint8_t *buf, size_t sz);
-
-size_t pad_pkcs7(uint8_t *buf, size_t blocksz, size_t sz);
-size_t unpad_pkcs7(uint8_t *buf, size_t sz);
-
 static void xor_block(uint8_t *a, const uint8_t *b);
 static void add_round_key(state_t *state, const uint8_t *round_key, uint8_t round);
 static void sub_bytes(state_t *state);
@@ -44,8 +29,6 @@ static void mix_columns_inv(state_t *state);
 static void key_expansion(uint8_t *round_key, const uint8_t *key);
 static void cipher(state_t *state, uint8_t *round_key);
 static void cipher_inv(state_t *state, uint8_t *round_key);
-static void keygen(uint8_t *key, size_t sz);
-static void print_hex(uint8_t *buf, size_t sz);
 
 static const uint8_t sbox[0x100] = {
   0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
@@ -90,7 +73,7 @@ static const uint8_t rcon[11] = {
 };
 
 static void xor_block(uint8_t *a, const uint8_t *b) {
-    for(uint8_t i = 0; i < AES_BLOCKLEN; i++)
+    for(uint8_t i = 0; i < ENCRO_AES_BLOCKLEN; i++)
         a[i] ^= b[i];
 }
 
@@ -197,7 +180,7 @@ static uint8_t gmul(uint8_t a, uint8_t b) {
 static void mix_columns(state_t *state) {
     uint8_t i, a, b, c, d;
 
-    for(i = 0; i < AES_COLUMNS; i++) {
+    for(i = 0; i < ENCRO_AES_COLUMNS; i++) {
         a = (*state)[i][0];
         b = (*state)[i][1];
         c = (*state)[i][2];
@@ -214,7 +197,7 @@ static void mix_columns(state_t *state) {
 static void mix_columns_inv(state_t *state) {
     uint8_t i, a, b, c, d;
 
-    for(i = 0; i < AES_COLUMNS; i++) {
+    for(i = 0; i < ENCRO_AES_COLUMNS; i++) {
         a = (*state)[i][0];
         b = (*state)[i][1];
         c = (*state)[i][2];
@@ -232,14 +215,14 @@ static void key_expansion(uint8_t *round_key, const uint8_t *key) {
     unsigned i, j, k;
     uint8_t prev_word[4];
 
-    for(i = 0; i < AES_KEY_WORD; i++) {
+    for(i = 0; i < ENCRO_AES_KEY_WORD; i++) {
         round_key[i*4 + 0] = key[i*4 + 0];
         round_key[i*4 + 1] = key[i*4 + 1];
         round_key[i*4 + 2] = key[i*4 + 2];
         round_key[i*4 + 3] = key[i*4 + 3];
     }
 
-    for(i = AES_KEY_WORD; i < AES_COLUMNS*(AES_ROUNDS + 1); i++) {
+    for(i = ENCRO_AES_KEY_WORD; i < ENCRO_AES_COLUMNS*(ENCRO_AES_ROUNDS + 1); i++) {
         k = (i - 1)*4;
         prev_word[0] = round_key[k + 0];
         prev_word[1] = round_key[k + 1];
@@ -247,7 +230,7 @@ static void key_expansion(uint8_t *round_key, const uint8_t *key) {
         prev_word[3] = round_key[k + 3];
 
         /* if the first word in key then do stuff with the previous key */
-        if(i % AES_KEY_WORD == 0) {
+        if(i % ENCRO_AES_KEY_WORD == 0) {
             /* rot word */
             {
                 const uint8_t tmp = prev_word[0];
@@ -263,12 +246,12 @@ static void key_expansion(uint8_t *round_key, const uint8_t *key) {
             prev_word[2] = sbox[prev_word[2]];
             prev_word[3] = sbox[prev_word[3]];
 
-            prev_word[0] ^= rcon[i/AES_KEY_WORD];
+            prev_word[0] ^= rcon[i/ENCRO_AES_KEY_WORD];
         }
 
         /* current word = previous key's word ^ previous word */
         j = i*4;
-        k = (i - AES_KEY_WORD)*4;
+        k = (i - ENCRO_AES_KEY_WORD)*4;
         round_key[j + 0] = round_key[k + 0] ^ prev_word[0];
         round_key[j + 1] = round_key[k + 1] ^ prev_word[1];
         round_key[j + 2] = round_key[k + 2] ^ prev_word[2];
@@ -282,10 +265,10 @@ static void cipher(state_t *state, uint8_t *round_key) {
 
     add_round_key(state, round_key, round);
 
-    for(round = 1; round < AES_ROUNDS+1; round++) {
+    for(round = 1; round < ENCRO_AES_ROUNDS+1; round++) {
         sub_bytes(state);
         shift_rows(state);
-        if(round != AES_ROUNDS) mix_columns(state);
+        if(round != ENCRO_AES_ROUNDS) mix_columns(state);
         add_round_key(state, round_key, round);
     }
 }
@@ -294,10 +277,10 @@ static void cipher(state_t *state, uint8_t *round_key) {
 static void cipher_inv(state_t *state, uint8_t *round_key) {
     uint8_t round;
 
-    add_round_key(state, round_key, AES_ROUNDS);
+    add_round_key(state, round_key, ENCRO_AES_ROUNDS);
 
     /* each round here corresponds to two half-rounds in the normal cipher */
-    for(round = AES_ROUNDS-1;; round--) {
+    for(round = ENCRO_AES_ROUNDS-1;; round--) {
         shift_rows_inv(state);
         sub_bytes_inv(state);
         add_round_key(state, round_key, round);
@@ -306,94 +289,338 @@ static void cipher_inv(state_t *state, uint8_t *round_key) {
     }
 }
 
-static void keygen(uint8_t *key, size_t sz) {
-    for(uint8_t i = 0; i < sz; i++)
-        key[i] = rand() % 0x100;
+static void ref_init(struct encro_aes_ctx *ctx, const uint8_t *key) {
+    key_expansion(ctx->round_key, key);
 }
 
-void ctx_init(struct ctx *ctx, const uint8_t *key, const uint8_t *iv) {
-    key_expansion(ctx->round_key, key);
+static void ref_encrypt(const struct encro_aes_ctx *ctx, uint8_t *buf, size_t n) {
+    for(; n > 0; n--, buf += ENCRO_AES_BLOCKLEN)
+        cipher((state_t *)buf, (uint8_t *)ctx->round_key);
+}
+
+static void ref_decrypt(const struct encro_aes_ctx *ctx, uint8_t *buf, size_t n) {
+    for(; n > 0; n--, buf += ENCRO_AES_BLOCKLEN)
+        cipher_inv((state_t *)buf, (uint8_t *)ctx->round_key);
+}
+
+/* table based, indexes memory with secret data */
+const struct encro_aes_engine encro_aes_engine_ref = {
+    .name = "ref",
+    .init = ref_init,
+    .encrypt = ref_encrypt,
+    .decrypt = ref_decrypt,
+};
+
+static const struct encro_aes_engine *engines[] = {
+    &encro_aes_engine_bitslice,
+    &encro_aes_engine_ref,
+};
+
+const struct encro_aes_engine *encro_aes_find_engine(const char *name) {
+    for(size_t i = 0; i < sizeof engines / sizeof engines[0]; i++)
+        if(strcmp(engines[i]->name, name) == 0)
+            return engines[i];
+    return NULL;
+}
+
+const struct encro_aes_engine *encro_aes_default_engine(void) {
+    const char *name = getenv("ENCRO_AES");
+    const struct encro_aes_engine *engine = name ? encro_aes_find_engine(name) : NULL;
+    return engine ? engine : engines[0];
+}
+
+void encro_aes_init_engine(struct encro_aes_ctx *ctx, const struct encro_aes_engine *engine,
+                           const uint8_t *key, const uint8_t *iv) {
+    PERF_BEGIN(PERF_KEY_EXPANSION);
+    ctx->engine = engine;
+    engine->init(ctx, key);
+    PERF_END(PERF_KEY_EXPANSION);
+    encro_aes_set_iv(ctx, iv);
+}
+
+void encro_aes_set_iv(struct encro_aes_ctx *ctx, const uint8_t *iv) {
     memcpy(ctx->iv, iv, sizeof ctx->iv);
+    ctx->ks_pos = sizeof ctx->ks;
 }
 
-void cbc_encrypt_buf(struct ctx *ctx, uint8_t *buf, size_t sz) {
+void encro_aes_init(struct encro_aes_ctx *ctx, const uint8_t *key, const uint8_t *iv) {
+    encro_aes_init_engine(ctx, encro_aes_default_engine(), key, iv);
+}
+
+/* every block depends on the previous one, no batching possible */
+void encro_aes_cbc_encrypt_buf(struct encro_aes_ctx *ctx, uint8_t *buf, size_t sz) {
     size_t i;
     uint8_t *iv = ctx->iv;
 
-    for(i = 0; i < sz; i += AES_BLOCKLEN) {
+    PERF_BEGIN(PERF_BLOCK);
+    for(i = 0; i < sz; i += ENCRO_AES_BLOCKLEN) {
         xor_block(buf, iv);
-        cipher((state_t *)buf, ctx->round_key);
+        ctx->engine->encrypt(ctx, buf, 1);
         iv = buf;
-        buf += AES_BLOCKLEN;
+        buf += ENCRO_AES_BLOCKLEN;
     }
 
-    memcpy(ctx->iv, iv, AES_BLOCKLEN);
+    memcpy(ctx->iv, iv, ENCRO_AES_BLOCKLEN);
+    PERF_END(PERF_BLOCK);
 }
 
-void cbc_decrypt_buf(struct ctx *ctx, uint8_t *buf, size_t sz) {
-    size_t i;
-    uint8_t iv[AES_BLOCKLEN];
+/* decryption only needs the ciphertext, so whole batches go at once */
+void encro_aes_cbc_decrypt_buf(struct encro_aes_ctx *ctx, uint8_t *buf, size_t sz) {
+    uint8_t prev[ENCRO_AES_BATCH*ENCRO_AES_BLOCKLEN];
+    size_t n = sz / ENCRO_AES_BLOCKLEN;
+
+    PERF_BEGIN(PERF_BLOCK);
+    while(n > 0) {
+        size_t batch = n < ENCRO_AES_BATCH ? n : ENCRO_AES_BATCH;
+        size_t len = batch*ENCRO_AES_BLOCKLEN;
 
-    for(i = 0; i < sz; i += AES_BLOCKLEN) {
-        memcpy(iv, buf, AES_BLOCKLEN);
-        cipher_inv((state_t *)buf, ctx->round_key);
+        memcpy(prev, buf, len);
+        ctx->engine->decrypt(ctx, buf, batch);
         xor_block(buf, ctx->iv);
-        memcpy(ctx->iv, iv, AES_BLOCKLEN);
-        buf += AES_BLOCKLEN;
+        for(size_t i = ENCRO_AES_BLOCKLEN; i < len; i += ENCRO_AES_BLOCKLEN)
+            xor_block(buf + i, prev + i - ENCRO_AES_BLOCKLEN);
+        memcpy(ctx->iv, prev + len - ENCRO_AES_BLOCKLEN, ENCRO_AES_BLOCKLEN);
+
+        buf += len;
+        n -= batch;
+    }
+    PERF_END(PERF_BLOCK);
+}
+
+/* big-endian increment of the counter block */
+static void ctr_increment(uint8_t *ctr) {
+    for(int i = ENCRO_AES_BLOCKLEN-1; i >= 0; i--)
+        if(++ctr[i] != 0) break;
+}
+
+static void ctr_refill(struct encro_aes_ctx *ctx) {
+    for(size_t i = 0; i < sizeof ctx->ks; i += ENCRO_AES_BLOCKLEN) {
+        memcpy(ctx->ks + i, ctx->iv, ENCRO_AES_BLOCKLEN);
+        ctr_increment(ctx->iv);
+    }
+    ctx->engine->encrypt(ctx, ctx->ks, ENCRO_AES_BATCH);
+    ctx->ks_pos = 0;
+}
+
+void encro_aes_ctr_xcrypt_buf(struct encro_aes_ctx *ctx, uint8_t *buf, size_t sz) {
+    PERF_BEGIN(PERF_BLOCK);
+    while(sz > 0) {
+        size_t n;
+
+        if(ctx->ks_pos == sizeof ctx->ks) ctr_refill(ctx);
+        n = sizeof ctx->ks - ctx->ks_pos;
+        if(n > sz) n = sz;
+        for(size_t i = 0; i < n; i++)
+            buf[i] ^= ctx->ks[ctx->ks_pos + i];
+        ctx->ks_pos += n;
+        buf += n;
+        sz -= n;
     }
+    PERF_END(PERF_BLOCK);
+}
+
+void encro_aes_ctr_seek(struct encro_aes_ctx *ctx, uint64_t off) {
+    uint64_t blocks = off / ENCRO_AES_BLOCKLEN;
+    uint8_t skip[ENCRO_AES_BLOCKLEN] = { 0 };
+    unsigned carry = 0;
+
+    /* the counter block is one 128 bit big endian number */
+    for(int i = ENCRO_AES_BLOCKLEN-1; i >= 0; i--) {
+        carry += ctx->iv[i] + (blocks & 0xff);
+        ctx->iv[i] = carry;
+        carry >>= 8;
+        blocks >>= 8;
+    }
+    ctx->ks_pos = sizeof ctx->ks;
+    encro_aes_ctr_xcrypt_buf(ctx, skip, off % ENCRO_AES_BLOCKLEN);
 }
 
 /* adds PKCS #7 padding to buf
  * sz is size excluding padding
  * returns padded size */
-size_t pad_pkcs7(uint8_t *buf, size_t blocksz, size_t sz) {
-    size_t padsz = blocksz - (sz + 1) % blocksz + 1;
+size_t encro_pad_pkcs7(uint8_t *buf, size_t blocksz, size_t sz) {
+    size_t padsz = blocksz - sz % blocksz;
     memset(buf + sz, padsz, padsz);
-    return (sz+1 + 0xf) & ~0xf;
+    return sz + padsz;
 }
 
 /* removes PKCS #7 from buf
  * sz is size including padding
  * returns unpadded size */
-size_t unpad_pkcs7(uint8_t *buf, size_t sz) {
+size_t encro_unpad_pkcs7(uint8_t *buf, size_t sz) {
     uint8_t padsz = buf[sz-1];
     /* TODO: error */
-    if(padsz > AES_BLOCKLEN) return (size_t)-1;
+    if(padsz == 0 || padsz > ENCRO_AES_BLOCKLEN) return (size_t)-1;
     memset(buf + sz - padsz, 0, padsz);
     return sz - padsz;
 }
 
-static void print_hex(uint8_t *buf, size_t sz) {
-    size_t i;
-    for(i = 0; i < sz; i++)
-        printf("%02X", buf[i]);
-    printf("\n");
+size_t encro_aes_cbc_encrypt_padded(struct encro_aes_ctx *ctx, uint8_t *buf, size_t sz) {
+    PERF_BEGIN(PERF_PADDING);
+    sz = encro_pad_pkcs7(buf, ENCRO_AES_BLOCKLEN, sz);
+    PERF_END(PERF_PADDING);
+    encro_aes_cbc_encrypt_buf(ctx, buf, sz);
+    return sz;
 }
 
-void algo_aes(void) {
-    char buf[256] = { 0 };
-    size_t len;
-    struct ctx ctx;
-    uint8_t key[AES_KEYLEN], iv[AES_BLOCKLEN];
+size_t encro_aes_cbc_decrypt_padded(struct encro_aes_ctx *ctx, uint8_t *buf, size_t sz) {
+    if(sz == 0 || sz % ENCRO_AES_BLOCKLEN != 0) return (size_t)-1;
+    encro_aes_cbc_decrypt_buf(ctx, buf, sz);
+    PERF_BEGIN(PERF_PADDING);
+    sz = encro_unpad_pkcs7(buf, sz);
+    PERF_END(PERF_PADDING);
+    return sz;
+}
+
+/* CBC with PKCS #7 padding, or CTR which needs neither */
+static void aes_encrypt(int ctr) {
+    char *line = NULL;
+    uint8_t *buf;
+    size_t cap = 0;
+    ssize_t len;
+    struct encro_aes_ctx ctx;
+    uint8_t key[ENCRO_AES_KEYLEN], iv[ENCRO_AES_BLOCKLEN];
 
     keygen(key, sizeof key);
-    keygen(iv, sizeof key);
-    ctx_init(&ctx, key, iv);
+    keygen(iv, sizeof iv);
+    encro_aes_init(&ctx, key, iv);
 
     printf("plaintext: ");
-    fgets(buf, sizeof buf - 1, stdin);
-    buf[len = strcspn(buf, "\n")] = '\0';
-    len = pad_pkcs7((uint8_t *)buf, AES_BLOCKLEN, len);
+    if((len = getline(&line, &cap, stdin)) < 0) len = 0;
+    len = strcspn(line ? line : "", "\n");
+    if(!(buf = slab_alloc(len + ENCRO_AES_BLOCKLEN + 1))) {
+        fprintf(stderr, "out of memory\n");
+        free(line);
+        return;
+    }
+    memcpy(buf, line, len);
 
     /* encryption */
-    cbc_encrypt_buf(&ctx, (uint8_t *)buf, len);
-    printf("ciphertext: "); print_hex((uint8_t *)buf, len);
+    if(ctr)
+        encro_aes_ctr_xcrypt_buf(&ctx, buf, len);
+    else
+        len = encro_aes_cbc_encrypt_padded(&ctx, buf, len);
+    printf("ciphertext: "); print_ciphertext(buf, len);
     printf("key: "); print_hex((uint8_t *)key, sizeof key);
     printf("iv: "); print_hex((uint8_t *)iv, sizeof iv);
 
     /* decryption */
-    memcpy(ctx.iv, iv, AES_BLOCKLEN);
-    cbc_decrypt_buf(&ctx, (uint8_t *)buf, len);
-    unpad_pkcs7((uint8_t *)buf, len);
+    encro_aes_init(&ctx, key, iv);
+    if(ctr)
+        encro_aes_ctr_xcrypt_buf(&ctx, buf, len);
+    else
+        len = encro_aes_cbc_decrypt_padded(&ctx, buf, len);
+    buf[len] = '\0';
     printf("decrypted: %s\n", buf);
+
+    slab_free(buf);
+    free(line);
+}
+
+static void aes_decrypt(int ctr) {
+    char *line = NULL;
+    uint8_t *buf = NULL;
+    size_t cap = 0, len;
+    ssize_t n;
+    struct encro_aes_ctx ctx;
+    uint8_t key[ENCRO_AES_KEYLEN], iv[ENCRO_AES_BLOCKLEN];
+
+    printf("ciphertext: ");
+    if((n = getline(&line, &cap, stdin)) < 0) goto out;
+    if(!(buf = slab_alloc(n + 1))) {
+        fprintf(stderr, "out of memory\n");
+        goto out;
+    }
+    if((len = parse_ciphertext(buf, line, n)) == (size_t)-1) {
+        fprintf(stderr, "ciphertext must be hex or base64\n");
+        goto out;
+    }
+    printf("key: ");
+    if(getline(&line, &cap, stdin) < 0) goto out;
+    if(parse_hex(key, sizeof key, line) != sizeof key) {
+        fprintf(stderr, "key must be %d hex bytes\n", ENCRO_AES_KEYLEN);
+        goto out;
+    }
+    printf("iv: ");
+    if(getline(&line, &cap, stdin) < 0) goto out;
+    if(parse_hex(iv, sizeof iv, line) != sizeof iv) {
+        fprintf(stderr, "iv must be %d hex bytes\n", ENCRO_AES_BLOCKLEN);
+        goto out;
+    }
+
+    encro_aes_init(&ctx, key, iv);
+    if(ctr) {
+        encro_aes_ctr_xcrypt_buf(&ctx, buf, len);
+    } else if((len = encro_aes_cbc_decrypt_padded(&ctx, buf, len)) == (size_t)-1) {
+        fprintf(stderr, "ciphertext must be a multiple of %d bytes and padded\n", ENCRO_AES_BLOCKLEN);
+        goto out;
+    }
+    buf[len] = '\0';
+    printf("plaintext: %s\n", buf);
+
+out:
+    slab_free(buf);
+    free(line);
 }
+
+static int aes_verify(size_t sz, int ctr) {
+    uint8_t *orig = malloc(sz + ENCRO_AES_BLOCKLEN), *buf = malloc(sz + ENCRO_AES_BLOCKLEN);
+    uint8_t key[ENCRO_AES_KEYLEN], iv[ENCRO_AES_BLOCKLEN];
+    struct encro_aes_ctx ctx;
+    size_t len = sz;
+    double t0, t1, t2;
+    int ok = 0;
+
+    if(!orig || !buf) goto out;
+    keygen(key, sizeof key);
+    keygen(iv, sizeof iv);
+    random_text((char *)orig, sz);
+    memcpy(buf, orig, sz);
+
+    t0 = time_now();
+    encro_aes_init(&ctx, key, iv);
+    if(ctr)
+        encro_aes_ctr_xcrypt_buf(&ctx, buf, len);
+    else
+        len = encro_aes_cbc_encrypt_padded(&ctx, buf, sz);
+    t1 = time_now();
+    encro_aes_init(&ctx, key, iv);
+    if(ctr)
+        encro_aes_ctr_xcrypt_buf(&ctx, buf, len);
+    else
+        len = encro_aes_cbc_decrypt_padded(&ctx, buf, len);
+    t2 = time_now();
+
+    ok = verify_report(ctr ? "aes-ctr" : "aes", sz, t1 - t0, t2 - t1,
+                       len == sz && memcmp(orig, buf, sz) == 0);
+out:
+    free(orig); free(buf);
+    return ok;
+}
+
+void algo_aes(void) {
+    aes_encrypt(0);
+}
+
+void algo_aes_decrypt(void) {
+    aes_decrypt(0);
+}
+
+int verify_aes(size_t sz) {
+    return aes_verify(sz, 0);
+}
+
+void algo_aes_ctr(void) {
+    aes_encrypt(1);
+}
+
+void algo_aes_ctr_decrypt(void) {
+    aes_decrypt(1);
+}
+
+int verify_aes_ctr(size_t sz) {
+    return aes_verify(sz, 1);
+}
+
+REGISTER_ALGORITHM("aes", algo_aes, algo_aes_decrypt, verify_aes);
+REGISTER_ALGORITHM("aes-ctr", algo_aes_ctr, algo_aes_ctr_decrypt, verify_aes_ctr);
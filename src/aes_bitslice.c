@@ -0,0 +1,405 @@
+#include <aes.h>
+
+#include <string.h>
+
+/* Constant-time AES: 8 blocks are transposed into 8 bit planes (one plane per
+ * bit of every byte) and all of SubBytes is done with boolean gates instead of
+ * table lookups, so nothing secret ever ends up in an address or a branch.
+ *
+ * A plane is a vector of two 64-bit words, each holding 4 blocks of 16 bits.
+ * Bit p of a block's 16 bits is byte p of the state, which is column-major
+ * (p = column*4 + row) like state_t in aes.c. */
+
+typedef uint64_t bs_t __attribute__((vector_size(16)));
+
+#define BS(c) ((bs_t){ (c), (c) })
+
+/* replicates a 16-bit mask to all 4 blocks in a word */
+#define M16(c) (0x0001000100010001ULL * (c))
+
+/* 8x8 bit matrix transpose, byte i bit j <-> byte j bit i */
+static uint64_t transpose8(uint64_t x) {
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x ^= t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x ^= t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x ^= t ^ (t << 28);
+    return x;
+}
+
+static uint64_t load64_le(const uint8_t *p) {
+    uint64_t v = 0;
+    for(int i = 7; i >= 0; i--) v = v<<8 | p[i];
+    return v;
+}
+
+static void store64_le(uint8_t *p, uint64_t v) {
+    for(int i = 0; i < 8; i++, v >>= 8) p[i] = v;
+}
+
+/* 8 blocks in, bit planes out */
+static void pack(bs_t *q, const uint8_t *buf) {
+    for(int b = 0; b < 8; b++) q[b] = BS(0);
+    for(int l = 0; l < 2; l++)
+        for(int g = 0; g < 8; g++) {
+            uint64_t t = transpose8(load64_le(buf + l*64 + g*8));
+            for(int b = 0; b < 8; b++)
+                q[b][l] |= (t >> 8*b & 0xff) << 8*g;
+        }
+}
+
+static void unpack(uint8_t *buf, const bs_t *q) {
+    for(int l = 0; l < 2; l++)
+        for(int g = 0; g < 8; g++) {
+            uint64_t t = 0;
+            for(int b = 0; b < 8; b++)
+                t |= (q[b][l] >> 8*g & 0xff) << 8*b;
+            store64_le(buf + l*64 + g*8, transpose8(t));
+        }
+}
+
+/* Boyar-Peralta S-box circuit ("A new combinational logic minimization
+ * technique with applications to cryptology"), 113 gates
+ * x0 is the most significant bit */
+static void sub_bytes(bs_t *q) {
+    bs_t x0, x1, x2, x3, x4, x5, x6, x7;
+    bs_t y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11, y12, y13, y14, y15;
+    bs_t y16, y17, y18, y19, y20, y21;
+    bs_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13, z14;
+    bs_t z15, z16, z17;
+    bs_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13, t14;
+    bs_t t15, t16, t17, t18, t19, t20, t21, t22, t23, t24, t25, t26, t27;
+    bs_t t28, t29, t30, t31, t32, t33, t34, t35, t36, t37, t38, t39, t40;
+    bs_t t41, t42, t43, t44, t45, t46, t47, t48, t49, t50, t51, t52, t53;
+    bs_t t54, t55, t56, t57, t58, t59, t60, t61, t62, t63, t64, t65, t66;
+    bs_t t67;
+
+    x0 = q[7]; x1 = q[6]; x2 = q[5]; x3 = q[4];
+    x4 = q[3]; x5 = q[2]; x6 = q[1]; x7 = q[0];
+
+    /* top linear transformation */
+    y14 = x3 ^ x5;
+    y13 = x0 ^ x6;
+    y9 = x0 ^ x3;
+    y8 = x0 ^ x5;
+    t0 = x1 ^ x2;
+    y1 = t0 ^ x7;
+    y4 = y1 ^ x3;
+    y12 = y13 ^ y14;
+    y2 = y1 ^ x0;
+    y5 = y1 ^ x6;
+    y3 = y5 ^ y8;
+    t1 = x4 ^ y12;
+    y15 = t1 ^ x5;
+    y20 = t1 ^ x1;
+    y6 = y15 ^ x7;
+    y10 = y15 ^ t0;
+    y11 = y20 ^ y9;
+    y7 = x7 ^ y11;
+    y17 = y10 ^ y11;
+    y19 = y10 ^ y8;
+    y16 = t0 ^ y11;
+    y21 = y13 ^ y16;
+    y18 = x0 ^ y16;
+
+    /* non-linear section */
+    t2 = y12 & y15;
+    t3 = y3 & y6;
+    t4 = t3 ^ t2;
+    t5 = y4 & x7;
+    t6 = t5 ^ t2;
+    t7 = y13 & y16;
+    t8 = y5 & y1;
+    t9 = t8 ^ t7;
+    t10 = y2 & y7;
+    t11 = t10 ^ t7;
+    t12 = y9 & y11;
+    t13 = y14 & y17;
+    t14 = t13 ^ t12;
+    t15 = y8 & y10;
+    t16 = t15 ^ t12;
+    t17 = t4 ^ t14;
+    t18 = t6 ^ t16;
+    t19 = t9 ^ t14;
+    t20 = t11 ^ t16;
+    t21 = t17 ^ y20;
+    t22 = t18 ^ y19;
+    t23 = t19 ^ y21;
+    t24 = t20 ^ y18;
+
+    t25 = t21 ^ t22;
+    t26 = t21 & t23;
+    t27 = t24 ^ t26;
+    t28 = t25 & t27;
+    t29 = t28 ^ t22;
+    t30 = t23 ^ t24;
+    t31 = t22 ^ t26;
+    t32 = t31 & t30;
+    t33 = t32 ^ t24;
+    t34 = t23 ^ t33;
+    t35 = t27 ^ t33;
+    t36 = t24 & t35;
+    t37 = t36 ^ t34;
+    t38 = t27 ^ t36;
+    t39 = t29 & t38;
+    t40 = t25 ^ t39;
+
+    t41 = t40 ^ t37;
+    t42 = t29 ^ t33;
+    t43 = t29 ^ t40;
+    t44 = t33 ^ t37;
+    t45 = t42 ^ t41;
+    z0 = t44 & y15;
+    z1 = t37 & y6;
+    z2 = t33 & x7;
+    z3 = t43 & y16;
+    z4 = t40 & y1;
+    z5 = t29 & y7;
+    z6 = t42 & y11;
+    z7 = t45 & y17;
+    z8 = t41 & y10;
+    z9 = t44 & y12;
+    z10 = t37 & y3;
+    z11 = t33 & y4;
+    z12 = t43 & y13;
+    z13 = t40 & y5;
+    z14 = t29 & y2;
+    z15 = t42 & y9;
+    z16 = t45 & y14;
+    z17 = t41 & y8;
+
+    /* bottom linear transformation */
+    t46 = z15 ^ z16;
+    t47 = z10 ^ z11;
+    t48 = z5 ^ z13;
+    t49 = z9 ^ z10;
+    t50 = z2 ^ z12;
+    t51 = z2 ^ z5;
+    t52 = z7 ^ z8;
+    t53 = z0 ^ z3;
+    t54 = z6 ^ z7;
+    t55 = z16 ^ z17;
+    t56 = z12 ^ t48;
+    t57 = t50 ^ t53;
+    t58 = z4 ^ t46;
+    t59 = z3 ^ t54;
+    t60 = t46 ^ t57;
+    t61 = z14 ^ t57;
+    t62 = t52 ^ t58;
+    t63 = t49 ^ t58;
+    t64 = z4 ^ t59;
+    t65 = t61 ^ t62;
+    t66 = z1 ^ t63;
+    q[7] = t59 ^ t63;
+    q[1] = t56 ^ ~t62;
+    q[0] = t48 ^ ~t60;
+    t67 = t64 ^ t65;
+    q[4] = t53 ^ t66;
+    q[3] = t51 ^ t66;
+    q[2] = t47 ^ t65;
+    q[6] = t64 ^ ~q[4];
+    q[5] = t55 ^ ~t67;
+}
+
+/* x -> A^-1(x ^ 0x63), the S-box affine step undone */
+static void affine_inv(bs_t *q) {
+    bs_t a[8];
+    memcpy(a, q, sizeof a);
+    for(int i = 0; i < 8; i++)
+        q[i] = a[(i+2) & 7] ^ a[(i+5) & 7] ^ a[(i+7) & 7];
+    q[0] = ~q[0];
+    q[2] = ~q[2];
+}
+
+/* inversion in GF(2^8) is its own inverse, so wrapping the forward S-box in
+ * the inverse affine map gives the inverse S-box */
+static void sub_bytes_inv(bs_t *q) {
+    affine_inv(q);
+    sub_bytes(q);
+    affine_inv(q);
+}
+
+static void shift_rows(bs_t *q) {
+    for(int b = 0; b < 8; b++) {
+        bs_t x = q[b];
+        q[b] = (x & BS(M16(0x1111)))
+            | ((x >> 4) & BS(M16(0x0222))) | ((x << 12) & BS(M16(0x2000)))
+            | ((x >> 8) & BS(M16(0x0044))) | ((x << 8) & BS(M16(0x4400)))
+            | ((x << 4) & BS(M16(0x8880))) | ((x >> 12) & BS(M16(0x0008)));
+    }
+}
+
+static void shift_rows_inv(bs_t *q) {
+    for(int b = 0; b < 8; b++) {
+        bs_t x = q[b];
+        q[b] = (x & BS(M16(0x1111)))
+            | ((x << 4) & BS(M16(0x2220))) | ((x >> 12) & BS(M16(0x0002)))
+            | ((x >> 8) & BS(M16(0x0044))) | ((x << 8) & BS(M16(0x4400)))
+            | ((x >> 4) & BS(M16(0x0888))) | ((x << 12) & BS(M16(0x8000)));
+    }
+}
+
+/* row r+1 moved to row r within each column */
+static bs_t rot1(bs_t x) {
+    return ((x >> 1) & BS(M16(0x7777))) | ((x << 3) & BS(M16(0x8888)));
+}
+
+static bs_t rot2(bs_t x) {
+    return ((x >> 2) & BS(M16(0x3333))) | ((x << 2) & BS(M16(0xcccc)));
+}
+
+/* multiply every byte by x, 0x1b sets bits 0, 1, 3 and 4 */
+static void xtime(bs_t *q) {
+    bs_t hi = q[7];
+    q[7] = q[6];
+    q[6] = q[5];
+    q[5] = q[4];
+    q[4] = q[3] ^ hi;
+    q[3] = q[2] ^ hi;
+    q[2] = q[1];
+    q[1] = q[0] ^ hi;
+    q[0] = hi;
+}
+
+/* out_r = 2*(a_r ^ a_r+1) ^ a_r+1 ^ a_r+2 ^ a_r+3 */
+static void mix_columns(bs_t *q) {
+    bs_t r1[8], t[8];
+    for(int b = 0; b < 8; b++) {
+        r1[b] = rot1(q[b]);
+        t[b] = q[b] ^ r1[b];
+    }
+    memcpy(q, t, sizeof t);
+    xtime(q);
+    for(int b = 0; b < 8; b++)
+        q[b] ^= r1[b] ^ rot2(t[b]);
+}
+
+/* the inverse matrix factors into the forward one times a cheap
+ * pre-multiplication: a_r ^= 4*(a_r ^ a_r+2) */
+static void mix_columns_inv(bs_t *q) {
+    bs_t w[8];
+    for(int b = 0; b < 8; b++) w[b] = q[b] ^ rot2(q[b]);
+    xtime(w);
+    xtime(w);
+    for(int b = 0; b < 8; b++) q[b] ^= w[b];
+    mix_columns(q);
+}
+
+static void add_round_key(bs_t *q, const uint64_t *rk) {
+    for(int b = 0; b < 8; b++) q[b] ^= BS(rk[b]);
+}
+
+static void encrypt_batch(const struct encro_aes_ctx *ctx, uint8_t *buf) {
+    bs_t q[8];
+    unsigned round;
+
+    pack(q, buf);
+    add_round_key(q, ctx->bs_round_key);
+    for(round = 1; round < ENCRO_AES_ROUNDS; round++) {
+        sub_bytes(q);
+        shift_rows(q);
+        mix_columns(q);
+        add_round_key(q, ctx->bs_round_key + round*8);
+    }
+    sub_bytes(q);
+    shift_rows(q);
+    add_round_key(q, ctx->bs_round_key + ENCRO_AES_ROUNDS*8);
+    unpack(buf, q);
+}
+
+static void decrypt_batch(const struct encro_aes_ctx *ctx, uint8_t *buf) {
+    bs_t q[8];
+    unsigned round;
+
+    pack(q, buf);
+    add_round_key(q, ctx->bs_round_key + ENCRO_AES_ROUNDS*8);
+    for(round = ENCRO_AES_ROUNDS-1;; round--) {
+        shift_rows_inv(q);
+        sub_bytes_inv(q);
+        add_round_key(q, ctx->bs_round_key + round*8);
+        if(round == 0) break;
+        mix_columns_inv(q);
+    }
+    unpack(buf, q);
+}
+
+/* partial batches go through a scratch buffer, the work done is the same no
+ * matter how many blocks are real */
+static void bs_crypt(const struct encro_aes_ctx *ctx, uint8_t *buf, size_t n,
+                     void (*batch)(const struct encro_aes_ctx *, uint8_t *)) {
+    uint8_t tmp[ENCRO_AES_BATCH*ENCRO_AES_BLOCKLEN];
+
+    for(; n >= ENCRO_AES_BATCH; n -= ENCRO_AES_BATCH, buf += sizeof tmp)
+        batch(ctx, buf);
+    if(n > 0) {
+        memset(tmp, 0, sizeof tmp);
+        memcpy(tmp, buf, n*ENCRO_AES_BLOCKLEN);
+        batch(ctx, tmp);
+        memcpy(buf, tmp, n*ENCRO_AES_BLOCKLEN);
+    }
+}
+
+static void bs_encrypt(const struct encro_aes_ctx *ctx, uint8_t *buf, size_t n) {
+    bs_crypt(ctx, buf, n, encrypt_batch);
+}
+
+static void bs_decrypt(const struct encro_aes_ctx *ctx, uint8_t *buf, size_t n) {
+    bs_crypt(ctx, buf, n, decrypt_batch);
+}
+
+/* SubWord without the table */
+static void sub_word(uint8_t *w) {
+    bs_t q[8];
+    for(int b = 0; b < 8; b++) {
+        q[b] = BS(0);
+        for(int i = 0; i < 4; i++)
+            q[b][0] |= (uint64_t)(w[i] >> b & 1) << i;
+    }
+    sub_bytes(q);
+    for(int i = 0; i < 4; i++) {
+        w[i] = 0;
+        for(int b = 0; b < 8; b++)
+            w[i] |= (q[b][0] >> i & 1) << b;
+    }
+}
+
+/* same schedule as key_expansion in aes.c, the round keys are then spread
+ * out to bit planes and repeated for all 4 blocks of a word */
+static void bs_init(struct encro_aes_ctx *ctx, const uint8_t *key) {
+    static const uint8_t rcon[11] = {
+      0x8d, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36,
+    };
+    uint8_t *rk = ctx->round_key;
+    unsigned i, round;
+
+    memcpy(rk, key, ENCRO_AES_KEYLEN);
+    for(i = ENCRO_AES_KEY_WORD; i < ENCRO_AES_COLUMNS*(ENCRO_AES_ROUNDS + 1); i++) {
+        uint8_t w[4];
+        memcpy(w, rk + (i-1)*4, 4);
+        if(i % ENCRO_AES_KEY_WORD == 0) {
+            uint8_t tmp = w[0];
+            w[0] = w[1]; w[1] = w[2]; w[2] = w[3]; w[3] = tmp;
+            sub_word(w);
+            w[0] ^= rcon[i/ENCRO_AES_KEY_WORD];
+        }
+        for(int j = 0; j < 4; j++)
+            rk[i*4 + j] = rk[(i - ENCRO_AES_KEY_WORD)*4 + j] ^ w[j];
+    }
+
+    for(round = 0; round <= ENCRO_AES_ROUNDS; round++)
+        for(int b = 0; b < 8; b++) {
+            uint64_t plane = 0;
+            for(int p = 0; p < ENCRO_AES_BLOCKLEN; p++)
+                plane |= (uint64_t)(rk[round*16 + p] >> b & 1) << p;
+            ctx->bs_round_key[round*8 + b] = M16(plane);
+        }
+}
+
+const struct encro_aes_engine encro_aes_engine_bitslice = {
+    .name = "bitslice",
+    .init = bs_init,
+    .encrypt = bs_encrypt,
+    .decrypt = bs_decrypt,
+};
@@ -1 +1,108 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "algo_utils.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <codec.h>
+#include <rng.h>
+
+enum encoding ciphertext_encoding = ENCODING_HEX;
+
+double time_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+size_t parse_hex(uint8_t *out, size_t sz, const char *hex) {
+    /* the decoder reads whole vectors, so never past the terminator */
+    return encro_hex_decode(out, hex, strnlen(hex, 2*sz));
+}
+
+void keygen(uint8_t *key, size_t sz) {
+    encro_rng_bytes(key, sz);
+}
+
+static void print_encoded(const uint8_t *buf, size_t sz, enum encoding e) {
+    char *out;
+    size_t len;
+
+    if(e == ENCODING_RAW) {
+        fwrite(buf, 1, sz, stdout);
+        putchar('\n');
+        return;
+    }
+    len = ENCRO_BASE64_LEN(sz) > ENCRO_HEX_LEN(sz) ? ENCRO_BASE64_LEN(sz) : ENCRO_HEX_LEN(sz);
+    if(!(out = malloc(len))) {
+        fprintf(stderr, "out of memory\n");
+        return;
+    }
+    len = e == ENCODING_BASE64 ? encro_base64_encode(out, buf, sz) : encro_hex_encode(out, buf, sz);
+    fwrite(out, 1, len, stdout);
+    putchar('\n');
+    free(out);
+}
+
+void print_hex(const uint8_t *buf, size_t sz) {
+    print_encoded(buf, sz, ENCODING_HEX);
+}
+
+int parse_encoding(const char *name) {
+    if(strcmp(name, "hex") == 0) return ENCODING_HEX;
+    if(strcmp(name, "base64") == 0) return ENCODING_BASE64;
+    if(strcmp(name, "raw") == 0) return ENCODING_RAW;
+    return -1;
+}
+
+void print_ciphertext(const uint8_t *buf, size_t sz) {
+    print_encoded(buf, sz, ciphertext_encoding);
+}
+
+size_t parse_ciphertext(uint8_t *out, const char *line, size_t len) {
+    while(len > 0 && (line[len-1] == '\n' || line[len-1] == '\r' || line[len-1] == ' '))
+        len--;
+    if(ciphertext_encoding != ENCODING_BASE64 && len % 2 == 0 &&
+       encro_hex_decode(out, line, len) == len / 2)
+        return len / 2;
+    return encro_base64_decode(out, line, len);
+}
+
+void random_text(char *buf, size_t sz) {
+    encro_rng_bytes(buf, sz);
+    /* 95 printable characters, the bias of the multiply doesn't matter here */
+    for(size_t i = 0; i < sz; i++)
+        buf[i] = ' ' + ((unsigned char)buf[i] * ('~' - ' ' + 1) >> 8);
+}
+
+size_t parse_size(const char *s) {
+    unsigned long long sz;
+    unsigned shift = 0;
+    char *end;
+
+    /* strtoull would take leading space and a minus sign */
+    if(*s < '0' || *s > '9') return 0;
+    errno = 0;
+    sz = strtoull(s, &end, 0);
+    switch(*end) {
+    case 'G': case 'g': shift = 30; end++; break;
+    case 'M': case 'm': shift = 20; end++; break;
+    case 'K': case 'k': shift = 10; end++; break;
+    }
+    if(errno || *end != '\0' || sz > SIZE_MAX >> shift) return 0;
+    return (size_t)sz << shift;
+}
+
+int verify_report(const char *name, size_t sz, double enc_secs, double dec_secs, int ok) {
+    printf("%s: %zu bytes, encrypt %.1f MB/s, decrypt %.1f MB/s, %s\n",
+           name, sz,
+           sz / enc_secs / 1024 / 1024,
+           sz / dec_secs / 1024 / 1024,
+           ok ? "OK" : "MISMATCH");
+    return ok;
+}
@@ -0,0 +1,178 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <alloc.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+/* Sizes up to 8k are rounded up to a power of two and carved out of 64k
+ * slabs, anything bigger gets a block of its own. Slabs and large blocks
+ * both start on a 64k boundary with a header, so slab_free finds the size
+ * class by masking the pointer. Freed blocks go on the freeing thread's list
+ * for their class and come back out without any locking. Large blocks are
+ * cached the same way, up to LARGE_CACHE bytes per thread, which is what
+ * makes the free and alloc pair of a hashmap resize or a stream buffer cheap
+ * the second time around. Slabs are never given back to the system. */
+
+#define SLAB_SIZE    (64<<10)
+#define SLAB_HEADER  64                 /* keeps blocks 64 byte aligned */
+#define MIN_SHIFT    4                  /* smallest class, 16 bytes */
+#define SMALL_SHIFT  13                 /* largest class carved from slabs */
+#define NCLASSES     64
+#define LARGE_CACHE  (64<<20)
+
+struct header {
+    unsigned class;
+    size_t size;                        /* usable bytes */
+};
+
+struct block {
+    struct block *next;
+};
+
+struct cache {
+    struct block *free[NCLASSES];
+    size_t large_bytes;
+    int registered;
+};
+
+static __thread struct cache cache;
+
+/* small blocks left over by threads that exited */
+static struct block *orphans[SMALL_SHIFT+1];
+static pthread_mutex_t orphans_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+static unsigned size_class(size_t sz) {
+    if(sz <= (1u << MIN_SHIFT)) return MIN_SHIFT;
+    return 64 - __builtin_clzll((unsigned long long)sz - 1);
+}
+
+static struct header *header_of(void *p) {
+    return (struct header *)((uintptr_t)p & ~(uintptr_t)(SLAB_SIZE-1));
+}
+
+static void cache_exit(void *arg) {
+    struct cache *c = arg;
+    struct block *b;
+
+    pthread_mutex_lock(&orphans_lock);
+    for(unsigned i = MIN_SHIFT; i <= SMALL_SHIFT; i++)
+        while((b = c->free[i])) {
+            c->free[i] = b->next;
+            b->next = orphans[i];
+            orphans[i] = b;
+        }
+    pthread_mutex_unlock(&orphans_lock);
+
+    for(unsigned i = SMALL_SHIFT+1; i < NCLASSES; i++)
+        while((b = c->free[i])) {
+            c->free[i] = b->next;
+            free(header_of(b));
+        }
+    c->large_bytes = 0;
+}
+
+static void cache_key_init(void) {
+    pthread_key_create(&cache_key, cache_exit);
+}
+
+/* so cache_exit runs when the thread does */
+static void cache_register(void) {
+    pthread_once(&cache_once, cache_key_init);
+    pthread_setspecific(cache_key, &cache);
+    cache.registered = 1;
+}
+
+/* a list of free blocks of class c, from exited threads or a new slab */
+static struct block *refill(unsigned c) {
+    struct block *list;
+    struct header *h;
+    size_t bsz = (size_t)1 << c;
+    void *mem;
+    char *p;
+
+    pthread_mutex_lock(&orphans_lock);
+    list = orphans[c];
+    orphans[c] = NULL;
+    pthread_mutex_unlock(&orphans_lock);
+    if(list) return list;
+
+    if(posix_memalign(&mem, SLAB_SIZE, SLAB_SIZE) != 0) return NULL;
+    h = mem;
+    h->class = c;
+    h->size = bsz;
+    for(p = (char *)mem + SLAB_SIZE - bsz; p >= (char *)mem + SLAB_HEADER; p -= bsz) {
+        struct block *b = (struct block *)p;
+        b->next = list;
+        list = b;
+    }
+    return list;
+}
+
+static void *large_alloc(size_t sz, unsigned c) {
+    struct header *h;
+    void *mem;
+
+    if(posix_memalign(&mem, SLAB_SIZE, SLAB_HEADER + sz) != 0) return NULL;
+    h = mem;
+    h->class = c;
+    h->size = sz;
+    return (char *)mem + SLAB_HEADER;
+}
+
+void *slab_alloc(size_t sz) {
+    struct block *b;
+    unsigned c;
+
+    if(sz > SIZE_MAX/2) return NULL;
+    c = size_class(sz);
+    if(!cache.registered) cache_register();
+
+    /* a cached large block may be too small for this request, only the
+     * head of the list is tried */
+    if((b = cache.free[c]) && header_of(b)->size >= sz) {
+        cache.free[c] = b->next;
+        if(c > SMALL_SHIFT) cache.large_bytes -= header_of(b)->size;
+        return b;
+    }
+    if(c > SMALL_SHIFT) return large_alloc(sz, c);
+
+    if(!(b = refill(c))) return NULL;
+    cache.free[c] = b->next;
+    return b;
+}
+
+void slab_free(void *p) {
+    struct header *h;
+    struct block *b = p;
+
+    if(!p) return;
+    h = header_of(p);
+    if(!cache.registered) cache_register();
+    if(h->class > SMALL_SHIFT) {
+        if(cache.large_bytes + h->size > LARGE_CACHE) {
+            free(h);
+            return;
+        }
+        cache.large_bytes += h->size;
+    }
+    b->next = cache.free[h->class];
+    cache.free[h->class] = b;
+}
+
+void *slab_realloc(void *p, size_t sz) {
+    size_t old;
+    void *q;
+
+    if(!p) return slab_alloc(sz);
+    old = header_of(p)->size;
+    if(sz <= old) return p;
+    if(!(q = slab_alloc(sz))) return NULL;
+    memcpy(q, p, old);
+    slab_free(p);
+    return q;
+}
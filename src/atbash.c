@@ -1,20 +1,73 @@
 #include <algorithms.h>
 
+#include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <algo_utils.h>
+#include <encro.h>
+#include <perf.h>
+#include <stream.h>
+
+/* 'Z' - (c - 'A') == c + 25 - 2*(c - 'A'), same for lowercase */
+void encro_atbash_buf(char *buf, size_t sz) {
+    PERF_BEGIN(PERF_CLASSICAL);
+    for(size_t i = 0; i < sz; i++) {
+        unsigned char c = buf[i], idx = (c | 0x20) - 'a';
+        buf[i] = idx < 26 ? c + 25 - 2*idx : c;
+    }
+    PERF_END(PERF_CLASSICAL);
+}
+
+static void atbash_stream(char *buf, size_t sz, void *udata __attribute__((unused))) {
+    encro_atbash_buf(buf, sz);
+}
+
+/* atbash is its own inverse, only the labels differ */
+static void atbash(int decrypt) {
+    struct stream s;
+
+    if(stream_init(&s, STDIN_FILENO, STDOUT_FILENO) < 0) {
+        fprintf(stderr, "out of memory\n");
+        return;
+    }
+
+    printf(decrypt ? "ciphertext: " : "plaintext: ");
+    stream_transform(&s, decrypt ? "plaintext: " : "ciphertext: ", atbash_stream, NULL);
+
+    stream_free(&s);
+}
 
 void algo_atbash(void) {
-    char buf[256];
+    atbash(0);
+}
+
+void algo_atbash_decrypt(void) {
+    atbash(1);
+}
 
-    printf("plaintext: ");
-    fgets(buf, sizeof buf, stdin);
+int verify_atbash(size_t sz) {
+    char *orig = malloc(sz), *buf = malloc(sz);
+    double t0, t1, t2;
+    int ok;
 
-    for(char *c = buf; *c; c++) {
-        if(IS_UPPERCASE(*c))
-            *c = 'Z' - (*c - 'A');
-        else if(IS_LOWERCASE(*c))
-            *c = 'z' - (*c - 'a');
+    if(!orig || !buf) {
+        free(orig); free(buf);
+        return 0;
     }
-    printf("ciphertext: %s", buf);
+    random_text(orig, sz);
+    memcpy(buf, orig, sz);
+
+    t0 = time_now();
+    encro_atbash_buf(buf, sz);
+    t1 = time_now();
+    encro_atbash_buf(buf, sz);
+    t2 = time_now();
+
+    ok = verify_report("atbash", sz, t1 - t0, t2 - t1, memcmp(orig, buf, sz) == 0);
+    free(orig); free(buf);
+    return ok;
 }
+
+REGISTER_ALGORITHM("atbash", algo_atbash, algo_atbash_decrypt, verify_atbash);
@@ -0,0 +1,320 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <algorithms.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <algo_utils.h>
+#include <alloc.h>
+#include <cipher.h>
+#include <codec.h>
+#include <rng.h>
+#include <stream.h>
+
+/* encro batch runs one cipher with one key over every record on stdin and
+ * writes the results to stdout in the same order, each record a message of
+ * its own as in cipher.h. aes, aes-ctr and chacha20 records get a random iv
+ * or nonce that goes out in front of the ciphertext and is read back from
+ * there by -d. records are lines, or with --length a 4 byte big
+ * endian length and that many bytes. lines of aes, aes-ctr and chacha20
+ * ciphertext are hex like the one message modes print them, or base64 with
+ * --encoding, length-prefixed records are always raw. the input is read a chunk at a time and the whole
+ * records in it are split between threads, each thread writes its results to
+ * a buffer of its own and the buffers go out in order. a record that doesn't
+ * decrypt comes out empty so the records still line up. */
+
+#define BATCH_CHUNK          (4<<20)
+#define BATCH_MIN_PER_THREAD (64<<10)
+#define BATCH_LENSZ          4
+
+struct batch {
+    const struct cipher_key *key;
+    int decrypt, length;
+    enum encoding encoding;             /* raw unless lines of binary ciphertext */
+};
+
+struct batch_part {
+    pthread_t tid;
+    const struct batch *b;
+    const uint8_t *in;                  /* whole records */
+    size_t sz;
+    uint8_t *out;
+    size_t len, cap;
+    size_t records, failed;
+    int oom;
+};
+
+/* size of the record at p with its framing, 0 if it isn't all there */
+static size_t record_size(const struct batch *b, const uint8_t *p, size_t sz, int eof) {
+    const uint8_t *nl;
+    size_t n;
+
+    if(b->length) {
+        if(sz < BATCH_LENSZ) return 0;
+        n = (size_t)p[0] << 24 | (size_t)p[1] << 16 | (size_t)p[2] << 8 | p[3];
+        return n <= sz - BATCH_LENSZ ? BATCH_LENSZ + n : 0;
+    }
+    if((nl = memchr(p, '\n', sz))) return nl - p + 1;
+    return eof ? sz : 0;
+}
+
+static void batch_record(struct batch_part *p, const uint8_t *rec, size_t sz) {
+    const struct batch *b = p->b;
+    size_t hdr = b->length ? BATCH_LENSZ : 0, ns = cipher_nonce_size(b->key->algo);
+    size_t n, max, need;
+    const uint8_t *data = rec + hdr;
+    struct cipher_key k;
+    uint8_t *dst, *raw;
+
+    n = b->length ? sz - hdr : sz - (rec[sz-1] == '\n');
+    /* the result is at most the input, the nonce and a padding block, twice
+     * that as hex and a newline, and when it is to be encoded the raw result
+     * goes after that */
+    max = n + ns + ENCRO_AES_BLOCKLEN;
+    need = hdr + 2 * max + 1;
+    if(b->encoding != ENCODING_RAW && !b->decrypt) need += max;
+    if(p->cap - p->len < need) {
+        size_t cap = p->cap ? p->cap : need;
+        uint8_t *out;
+        while(cap - p->len < need) cap *= 2;
+        if(!(out = slab_realloc(p->out, cap))) {
+            p->oom = 1;
+            return;
+        }
+        p->out = out;
+        p->cap = cap;
+    }
+    dst = p->out + p->len + hdr;
+    raw = b->encoding != ENCODING_RAW && !b->decrypt ? dst + 2 * max + 1 : dst;
+
+    if(b->encoding == ENCODING_HEX && b->decrypt) {
+        n = n % 2 == 0 && encro_hex_decode(dst, (const char *)data, n) == n / 2 ? n / 2 : (size_t)-1;
+    } else if(b->encoding == ENCODING_BASE64 && b->decrypt) {
+        n = encro_base64_decode(dst, (const char *)data, n);
+    } else {
+        memcpy(raw + (b->decrypt ? 0 : ns), data, n);
+    }
+    k = *b->key;
+    if(!b->decrypt) {
+        encro_rng_bytes(raw, ns);
+        cipher_set_nonce(&k, raw);
+        n = ns + cipher_message(&k, 0, raw + ns, n);
+    } else if(n != (size_t)-1 && n >= ns) {
+        cipher_set_nonce(&k, raw);
+        n = cipher_message(&k, 1, raw + ns, n - ns);
+        if(n != (size_t)-1) memmove(raw, raw + ns, n);
+    } else {
+        n = (size_t)-1;
+    }
+    if(n == (size_t)-1) {
+        n = 0;
+        p->failed++;
+    } else if(b->encoding == ENCODING_HEX && !b->decrypt) {
+        n = encro_hex_encode((char *)dst, raw, n);
+    } else if(b->encoding == ENCODING_BASE64 && !b->decrypt) {
+        n = encro_base64_encode((char *)dst, raw, n);
+    }
+
+    if(b->length) {
+        dst[-4] = n >> 24;
+        dst[-3] = n >> 16;
+        dst[-2] = n >> 8;
+        dst[-1] = n;
+    } else {
+        dst[n++] = '\n';
+    }
+    p->len += hdr + n;
+    p->records++;
+}
+
+static void *batch_part(void *arg) {
+    struct batch_part *p = arg;
+    const uint8_t *in = p->in, *end = p->in + p->sz;
+
+    p->len = 0;
+    while(in < end && !p->oom) {
+        size_t sz = record_size(p->b, in, end - in, 1);
+        batch_record(p, in, sz);
+        in += sz;
+    }
+    return NULL;
+}
+
+/* where the whole records in buf end, 0 if not even the first is there */
+static size_t records_end(const struct batch *b, const uint8_t *buf, size_t sz, int eof) {
+    size_t pos = 0, n;
+
+    if(!b->length) {
+        if(eof) return sz;
+        while(sz > 0 && buf[sz-1] != '\n') sz--;
+        return sz;
+    }
+    while((n = record_size(b, buf + pos, sz - pos, eof))) pos += n;
+    return pos;
+}
+
+/* the first record boundary at or after target */
+static size_t records_split(const struct batch *b, const uint8_t *buf, size_t from,
+                            size_t target, size_t end) {
+    const uint8_t *nl;
+
+    if(!b->length) {
+        if(target <= from) return from;
+        if(buf[target-1] == '\n') return target;
+        nl = memchr(buf + target, '\n', end - target);
+        return nl ? (size_t)(nl - buf) + 1 : end;
+    }
+    while(from < target) from += record_size(b, buf + from, end - from, 1);
+    return from;
+}
+
+static int batch_usage(void) {
+    fprintf(stderr,
+        "Usage: encro batch [options] algorithm [-d] < records > results\n"
+        "\n"
+        "  --key=key        the shift for caesar, the key for vigenere and the key in\n"
+        "                   hex for aes, aes-ctr and chacha20. every record of those\n"
+        "                   gets a random iv or nonce written in front of it\n"
+        "  --length         records are a 4 byte big endian length and the bytes,\n"
+        "                   otherwise lines\n"
+        "  --encoding=enc   lines of aes, aes-ctr and chacha20 ciphertext are hex\n"
+        "                   (default) or base64\n"
+        "  --threads=n      threads (default all cpus)\n"
+        "  -d               decrypt instead of encrypt\n"
+        "\n"
+        "Algorithms: caesar, vigenere, atbash, aes, aes-ctr, chacha20\n");
+    return EXIT_FAILURE;
+}
+
+int cmd_batch(int argc, char *argv[]) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned nthreads = ncpu > 0 ? ncpu : 1, algo = 0;
+    const char *keystr = NULL;
+    struct batch b = { 0 };
+    struct batch_part *parts;
+    struct cipher_key key;
+    uint8_t material[CIPHER_KEYSZ], *buf;
+    size_t cap = BATCH_CHUNK, have = 0, records = 0, failed = 0;
+    ssize_t n;
+    int eof = 0, ret = EXIT_FAILURE, encoding = ENCODING_HEX;
+
+    for(int i = 1; i < argc; i++) {
+        if(strncmp(argv[i], "--key=", 6) == 0)
+            keystr = argv[i] + 6;
+        else if(strcmp(argv[i], "--length") == 0)
+            b.length = 1;
+        else if(strncmp(argv[i], "--encoding=", 11) == 0)
+            encoding = parse_encoding(argv[i] + 11);
+        else if(strncmp(argv[i], "--threads=", 10) == 0)
+            nthreads = strtoul(argv[i] + 10, NULL, 10);
+        else if(strcmp(argv[i], "-d") == 0)
+            b.decrypt = 1;
+        else if(!algo)
+            algo = cipher_algo(argv[i]);
+        else
+            return batch_usage();
+    }
+    if(!algo || !nthreads || (!keystr && algo != CIPHER_ATBASH) ||
+       (encoding != ENCODING_HEX && encoding != ENCODING_BASE64))
+        return batch_usage();
+    if((n = cipher_parse_key(algo, keystr ? keystr : "", material, sizeof material)) < 0 ||
+       cipher_key_init(&key, algo, material, n) < 0) {
+        fprintf(stderr, "batch: bad key\n");
+        return batch_usage();
+    }
+    b.key = &key;
+    b.encoding = !b.length && cipher_is_binary(algo) ? encoding : ENCODING_RAW;
+
+    parts = calloc(nthreads, sizeof *parts);
+    buf = malloc(cap);
+    if(!parts || !buf) {
+        fprintf(stderr, "batch: out of memory\n");
+        goto out;
+    }
+
+    while(!eof || have) {
+        size_t end, from = 0;
+        unsigned nparts;
+
+        while(have < cap && !eof) {
+            if((n = read(STDIN_FILENO, buf + have, cap - have)) < 0) {
+                if(errno == EINTR) continue;
+                perror("batch: read");
+                goto out;
+            }
+            if(n == 0) eof = 1;
+            have += n;
+        }
+        if(!have) break;
+        if(!(end = records_end(&b, buf, have, eof))) {
+            uint8_t *p;
+            if(eof) {
+                fprintf(stderr, "batch: input ends inside a record\n");
+                goto out;
+            }
+            /* a record bigger than the buffer */
+            if(!(p = realloc(buf, cap * 2))) {
+                fprintf(stderr, "batch: out of memory\n");
+                goto out;
+            }
+            buf = p;
+            cap *= 2;
+            continue;
+        }
+
+        nparts = end / BATCH_MIN_PER_THREAD < nthreads ? end / BATCH_MIN_PER_THREAD : nthreads;
+        if(nparts == 0) nparts = 1;
+        for(unsigned i = 0; i < nparts; i++) {
+            size_t to = i == nparts - 1 ? end :
+                        records_split(&b, buf, from, end / nparts * (i + 1), end);
+            parts[i].b = &b;
+            parts[i].in = buf + from;
+            parts[i].sz = to - from;
+            from = to;
+        }
+        if(nparts == 1) {
+            batch_part(&parts[0]);
+        } else {
+            unsigned started = 0;
+            for(; started < nparts; started++)
+                if(pthread_create(&parts[started].tid, NULL, batch_part, &parts[started]) != 0)
+                    break;
+            /* whatever didn't get a thread runs here */
+            for(unsigned i = started; i < nparts; i++) batch_part(&parts[i]);
+            for(unsigned i = 0; i < started; i++) pthread_join(parts[i].tid, NULL);
+        }
+        for(unsigned i = 0; i < nparts; i++) {
+            if(parts[i].oom) {
+                fprintf(stderr, "batch: out of memory\n");
+                goto out;
+            }
+            if(stream_write(STDOUT_FILENO, parts[i].out, parts[i].len) < 0) {
+                perror("batch: write");
+                goto out;
+            }
+            records += parts[i].records;
+            failed += parts[i].failed;
+            parts[i].records = parts[i].failed = 0;
+        }
+
+        memmove(buf, buf + end, have - end);
+        have -= end;
+    }
+
+    if(failed) fprintf(stderr, "batch: %zu of %zu records did not decrypt\n", failed, records);
+    else ret = EXIT_SUCCESS;
+
+out:
+    for(unsigned i = 0; parts && i < nthreads; i++) slab_free(parts[i].out);
+    free(parts);
+    free(buf);
+    return ret;
+}
+
+REGISTER_COMMAND("batch", cmd_batch);
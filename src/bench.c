@@ -0,0 +1,404 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <algorithms.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef __x86_64__
+#include <x86intrin.h>
+#endif
+
+#include <algo_utils.h>
+#include <encro.h>
+#include <perf.h>
+
+/* every cipher runs in place on a buffer of each size for --time seconds,
+ * on one thread and then on --threads threads with a buffer and context
+ * each. every op is timed on its own, cycles are tsc ticks so they only
+ * match core cycles while the clock is steady */
+
+#define BENCH_MIN_SIZE   16
+#define BENCH_MAX_SIZE   ((size_t)1<<30)
+#define BENCH_TIME       0.25
+#define BENCH_SAMPLES    (1<<16)        /* latencies kept per thread */
+#define BENCH_SKIP       10             /* skip sizes whose first op takes this many --time */
+#define BENCH_FILL       (64<<10)
+
+union bench_ctx {
+    struct encro_aes_ctx aes;
+    struct encro_chacha20_ctx chacha20;
+    struct encro_vigenere vigenere;
+    struct {
+        struct encro_rsa_key key;
+        uint32_t *out;                  /* fakersa writes 4 bytes per byte */
+    } rsa;
+};
+
+struct bench_cipher {
+    const char *name;
+    int (*init)(union bench_ctx *ctx, size_t sz);     /* -1 if out of memory */
+    void (*run)(union bench_ctx *ctx, uint8_t *buf, size_t sz);
+    void (*free)(union bench_ctx *ctx);
+};
+
+static int init_aes(union bench_ctx *ctx, size_t sz) {
+    uint8_t key[ENCRO_AES_KEYLEN], iv[ENCRO_AES_BLOCKLEN];
+    (void)sz;
+    keygen(key, sizeof key);
+    keygen(iv, sizeof iv);
+    encro_aes_init(&ctx->aes, key, iv);
+    return 0;
+}
+
+static int init_chacha20(union bench_ctx *ctx, size_t sz) {
+    uint8_t key[ENCRO_CHACHA20_KEYLEN], nonce[ENCRO_CHACHA20_NONCELEN];
+    (void)sz;
+    keygen(key, sizeof key);
+    keygen(nonce, sizeof nonce);
+    encro_chacha20_init(&ctx->chacha20, key, nonce, 0);
+    return 0;
+}
+
+static int init_vigenere(union bench_ctx *ctx, size_t sz) {
+    (void)sz;
+    encro_vigenere_init(&ctx->vigenere, "LEMONADE", 0);
+    return 0;
+}
+
+static int init_rsa(union bench_ctx *ctx, size_t sz) {
+    (void)sz;
+    encro_rsa_keygen(&ctx->rsa.key);
+    ctx->rsa.out = NULL;
+    return 0;
+}
+
+/* the output is allocated here so a timed op never mallocs or skips its work */
+static int init_fake_rsa(union bench_ctx *ctx, size_t sz) {
+    init_rsa(ctx, sz);
+    if(sz > SIZE_MAX / sizeof *ctx->rsa.out) return -1;
+    return (ctx->rsa.out = malloc(sz * sizeof *ctx->rsa.out)) ? 0 : -1;
+}
+
+static void free_rsa(union bench_ctx *ctx) {
+    free(ctx->rsa.out);
+}
+
+static void run_caesar(union bench_ctx *ctx, uint8_t *buf, size_t sz) {
+    (void)ctx;
+    encro_caesar_buf((char *)buf, sz, 3);
+}
+
+static void run_atbash(union bench_ctx *ctx, uint8_t *buf, size_t sz) {
+    (void)ctx;
+    encro_atbash_buf((char *)buf, sz);
+}
+
+static void run_vigenere(union bench_ctx *ctx, uint8_t *buf, size_t sz) {
+    encro_vigenere_buf(&ctx->vigenere, (char *)buf, sz);
+}
+
+/* sizes are powers of 4 from 16, always whole blocks */
+static void run_aes(union bench_ctx *ctx, uint8_t *buf, size_t sz) {
+    encro_aes_cbc_encrypt_buf(&ctx->aes, buf, sz);
+}
+
+static void run_aes_decrypt(union bench_ctx *ctx, uint8_t *buf, size_t sz) {
+    encro_aes_cbc_decrypt_buf(&ctx->aes, buf, sz);
+}
+
+static void run_aes_ctr(union bench_ctx *ctx, uint8_t *buf, size_t sz) {
+    encro_aes_ctr_xcrypt_buf(&ctx->aes, buf, sz);
+}
+
+static void run_chacha20(union bench_ctx *ctx, uint8_t *buf, size_t sz) {
+    encro_chacha20_xcrypt_buf(&ctx->chacha20, buf, sz);
+}
+
+static void run_fake_rsa(union bench_ctx *ctx, uint8_t *buf, size_t sz) {
+    encro_fake_rsa_encrypt(ctx->rsa.out, buf, sz, &ctx->rsa.key);
+}
+
+/* the buffer as 32-bit messages, reduced below n first */
+static void run_rsa(union bench_ctx *ctx, uint8_t *buf, size_t sz) {
+    uint32_t *m = (uint32_t *)buf;
+    for(size_t i = 0; i < sz / sizeof *m; i++)
+        m[i] = encro_rsa_encrypt(&ctx->rsa.key, m[i] % ctx->rsa.key.n);
+}
+
+static const struct bench_cipher ciphers[] = {
+    { "caesar", NULL, run_caesar, NULL },
+    { "atbash", NULL, run_atbash, NULL },
+    { "vigenere", init_vigenere, run_vigenere, NULL },
+    { "aes", init_aes, run_aes, NULL },
+    { "aes-decrypt", init_aes, run_aes_decrypt, NULL },
+    { "aes-ctr", init_aes, run_aes_ctr, NULL },
+    { "chacha20", init_chacha20, run_chacha20, NULL },
+    { "fakersa", init_fake_rsa, run_fake_rsa, free_rsa },
+    { "rsa", init_rsa, run_rsa, free_rsa },
+};
+
+struct bench_thread {
+    const struct bench_cipher *cipher;
+    size_t sz;
+    double secs;
+    pthread_barrier_t *barrier;
+    uint8_t *buf;
+    union bench_ctx ctx;
+    int ready;                          /* ctx needs freeing */
+    uint64_t ops;
+    uint64_t ticks;                     /* rdtsc over the whole run */
+    double elapsed;
+    uint64_t *samples;                  /* per op latency in ns */
+    size_t nsamples;
+    uint64_t rng;
+};
+
+static uint64_t ticks_now(void) {
+#ifdef __x86_64__
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static uint64_t ns_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* keeps a uniform sample of every latency once the array is full */
+static void add_sample(struct bench_thread *t, uint64_t ns) {
+    uint64_t j;
+
+    if(t->nsamples < BENCH_SAMPLES) {
+        t->samples[t->nsamples++] = ns;
+        return;
+    }
+    t->rng ^= t->rng << 13;
+    t->rng ^= t->rng >> 7;
+    t->rng ^= t->rng << 17;
+    if((j = t->rng % t->ops) < BENCH_SAMPLES) t->samples[j] = ns;
+}
+
+static void *bench_thread(void *arg) {
+    struct bench_thread *t = arg;
+    uint64_t start, deadline, tick0, prev, now;
+
+    t->cipher->run(&t->ctx, t->buf, t->sz);    /* warm up */
+
+    pthread_barrier_wait(t->barrier);
+    start = prev = ns_now();
+    tick0 = ticks_now();
+    deadline = start + (uint64_t)(t->secs * 1e9);
+    do {
+        t->cipher->run(&t->ctx, t->buf, t->sz);
+        now = ns_now();
+        t->ops++;
+        add_sample(t, now - prev);
+        prev = now;
+    } while(now < deadline);
+    t->ticks = ticks_now() - tick0;
+    t->elapsed = (now - start) * 1e-9;
+    return NULL;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+struct bench_result {
+    double mbps, cpb, opsps, p50, p99, op_secs;
+};
+
+/* nthreads copies of the cipher on sz byte buffers, returns -1 if out of memory */
+static int bench_run(const struct bench_cipher *cipher, size_t sz, unsigned nthreads,
+                     double secs, struct bench_result *res) {
+    struct bench_thread *threads = calloc(nthreads, sizeof *threads);
+    pthread_t *tids = calloc(nthreads, sizeof *tids);
+    uint64_t *samples = malloc((size_t)nthreads * BENCH_SAMPLES * sizeof *samples);
+    pthread_barrier_t barrier;
+    uint64_t ops = 0, ticks = 0;
+    size_t nsamples = 0;
+    double elapsed = 0;
+    unsigned started = 0;
+    int ret = -1;
+
+    if(!threads || !tids || !samples) goto out;
+    for(unsigned i = 0; i < nthreads; i++) {
+        struct bench_thread *t = &threads[i];
+        if(!(t->buf = malloc(sz))) goto out;
+        /* filling a gigabyte would take longer than the run, repeat a block */
+        random_text((char *)t->buf, sz < BENCH_FILL ? sz : BENCH_FILL);
+        for(size_t off = BENCH_FILL; off < sz; off += BENCH_FILL)
+            memcpy(t->buf + off, t->buf, sz - off < BENCH_FILL ? sz - off : BENCH_FILL);
+        if(cipher->init && cipher->init(&t->ctx, sz) < 0) {
+            if(cipher->free) cipher->free(&t->ctx);
+            goto out;
+        }
+        t->ready = 1;
+        t->cipher = cipher;
+        t->sz = sz;
+        t->secs = secs;
+        t->barrier = &barrier;
+        t->samples = samples + (size_t)i * BENCH_SAMPLES;
+        t->rng = 0x9e3779b97f4a7c15ULL + i;
+    }
+
+    pthread_barrier_init(&barrier, NULL, nthreads);
+    for(started = 1; started < nthreads; started++)
+        if(pthread_create(&tids[started], NULL, bench_thread, &threads[started]) != 0) break;
+    if(started < nthreads) {
+        /* the barrier would never open, nothing ran yet so just give up */
+        fprintf(stderr, "bench: could not start %u threads\n", nthreads);
+        exit(EXIT_FAILURE);
+    }
+    bench_thread(&threads[0]);
+    for(unsigned i = 1; i < nthreads; i++) pthread_join(tids[i], NULL);
+    pthread_barrier_destroy(&barrier);
+
+    for(unsigned i = 0; i < nthreads; i++) {
+        struct bench_thread *t = &threads[i];
+        ops += t->ops;
+        ticks += t->ticks;
+        if(t->elapsed > elapsed) elapsed = t->elapsed;
+        memmove(samples + nsamples, t->samples, t->nsamples * sizeof *samples);
+        nsamples += t->nsamples;
+    }
+    qsort(samples, nsamples, sizeof *samples, compare_u64);
+
+    res->mbps = (double)ops * sz / elapsed / 1e6;
+    res->cpb = ticks ? (double)ticks / ((double)ops * sz) : 0;
+    res->opsps = ops / elapsed;
+    res->p50 = samples[nsamples / 2] * 1e-3;
+    res->p99 = samples[nsamples * 99 / 100] * 1e-3;
+    res->op_secs = elapsed * nthreads / ops;
+    ret = 0;
+
+out:
+    for(unsigned i = 0; threads && i < nthreads; i++) {
+        if(threads[i].ready && cipher->free) cipher->free(&threads[i].ctx);
+        free(threads[i].buf);
+    }
+    free(threads); free(tids); free(samples);
+    return ret;
+}
+
+static void print_size(char *out, size_t n, size_t sz) {
+    const char *units = "BKMG";
+    while(sz >= 1024 && sz % 1024 == 0 && units[1]) sz /= 1024, units++;
+    snprintf(out, n, "%zu%c", sz, *units);
+}
+
+static int bench_usage(void) {
+    fprintf(stderr,
+        "Usage: encro bench [options]\n"
+        "\n"
+        "  --json           one JSON object per line instead of a table\n"
+        "  --threads=n      threads for the parallel runs (default all cpus, 1\n"
+        "                   skips them)\n"
+        "  --min=size       smallest payload (default 16)\n"
+        "  --max=size       largest payload (default 1G)\n"
+        "  --time=secs      time per cipher and size (default 0.25)\n"
+        "  --only=name,...  ciphers to run\n");
+    return EXIT_FAILURE;
+}
+
+static int wanted(const char *only, const char *name) {
+    size_t len = strlen(name);
+    while(only) {
+        if(strncmp(only, name, len) == 0 && (only[len] == ',' || only[len] == '\0'))
+            return 1;
+        if((only = strchr(only, ','))) only++;
+    }
+    return 0;
+}
+
+int cmd_bench(int argc, char *argv[]) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned nthreads = ncpu > 0 ? ncpu : 1;
+    size_t min = BENCH_MIN_SIZE, max = BENCH_MAX_SIZE;
+    double secs = BENCH_TIME;
+    const char *only = NULL;
+    int json = 0;
+    char size[24], cpb[32];
+
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--json") == 0)
+            json = 1;
+        else if(strncmp(argv[i], "--threads=", 10) == 0)
+            nthreads = strtoul(argv[i] + 10, NULL, 10);
+        else if(strncmp(argv[i], "--min=", 6) == 0)
+            min = parse_size(argv[i] + 6);
+        else if(strncmp(argv[i], "--max=", 6) == 0)
+            max = parse_size(argv[i] + 6);
+        else if(strncmp(argv[i], "--time=", 7) == 0)
+            secs = strtod(argv[i] + 7, NULL);
+        else if(strncmp(argv[i], "--only=", 7) == 0)
+            only = argv[i] + 7;
+        else
+            return bench_usage();
+    }
+    if(nthreads == 0 || secs <= 0 || min < BENCH_MIN_SIZE || max < min)
+        return bench_usage();
+
+    if(!json)
+        printf("%-12s %6s %7s %10s %9s %12s %10s %10s\n", "cipher", "size", "threads",
+               "MB/s", "cycles/B", "ops/s", "p50 us", "p99 us");
+    for(size_t c = 0; c < sizeof ciphers / sizeof ciphers[0]; c++) {
+        const struct bench_cipher *cipher = &ciphers[c];
+        double op_secs = 0;
+
+        if(only && !wanted(only, cipher->name)) continue;
+        for(size_t sz = BENCH_MIN_SIZE; sz <= max; sz *= 4) {
+            unsigned runs[2] = { 1, nthreads };
+
+            if(sz < min) continue;
+            print_size(size, sizeof size, sz);
+            /* throughput barely depends on size past a few kilobytes */
+            if(op_secs * 4 > secs * BENCH_SKIP) {
+                if(!json) printf("%-12s %6s %7s %10s\n", cipher->name, size, "", "skipped");
+                continue;
+            }
+            for(unsigned r = 0; r < (nthreads > 1 ? 2u : 1u); r++) {
+                struct bench_result res;
+
+                /* a gigabyte per thread may not fit, the other runs still can */
+                if(bench_run(cipher, sz, runs[r], secs, &res) < 0) {
+                    fprintf(stderr, "bench: out of memory for %s at %s x %u, skipped\n",
+                            cipher->name, size, runs[r]);
+                    if(!json) printf("%-12s %6s %7u %10s\n", cipher->name, size, runs[r],
+                                     "skipped");
+                    continue;
+                }
+                if(r == 0) op_secs = res.op_secs;
+                /* no tsc, no cycles */
+                if(res.cpb > 0)
+                    snprintf(cpb, sizeof cpb, json ? "%.3f" : "%.2f", res.cpb);
+                else
+                    strcpy(cpb, json ? "null" : "-");
+                if(json)
+                    printf("{\"cipher\":\"%s\",\"size\":%zu,\"threads\":%u,"
+                           "\"mb_per_s\":%.3f,\"cycles_per_byte\":%s,\"ops_per_s\":%.1f,"
+                           "\"p50_us\":%.3f,\"p99_us\":%.3f}\n",
+                           cipher->name, sz, runs[r], res.mbps, cpb, res.opsps,
+                           res.p50, res.p99);
+                else
+                    printf("%-12s %6s %7u %10.1f %9s %12.0f %10.2f %10.2f\n",
+                           cipher->name, size, runs[r], res.mbps, cpb, res.opsps,
+                           res.p50, res.p99);
+                fflush(stdout);
+            }
+        }
+        PERF_REPORT(stderr, cipher->name);
+    }
+    return EXIT_SUCCESS;
+}
+
+REGISTER_COMMAND("bench", cmd_bench);
@@ -1,25 +1,83 @@
 #include <algorithms.h>
 
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <algo_utils.h>
+#include <encro.h>
+#include <perf.h>
+#include <stream.h>
 
-void algo_caesar(void) {
-    char buf[256];
-    unsigned char shift;
+/* branchless so the compiler can vectorize it */
+void encro_caesar_buf(char *buf, size_t sz, unsigned shift) {
+    PERF_BEGIN(PERF_CLASSICAL);
+    shift %= 26;
+    for(size_t i = 0; i < sz; i++) {
+        unsigned char c = buf[i], idx = (c | 0x20) - 'a';
+        unsigned char s = idx + shift >= 26 ? shift - 26 : shift;
+        buf[i] = idx < 26 ? c + s : c;
+    }
+    PERF_END(PERF_CLASSICAL);
+}
+
+static void caesar_stream(char *buf, size_t sz, void *udata) {
+    encro_caesar_buf(buf, sz, *(unsigned *)udata);
+}
+
+static void caesar(int decrypt) {
+    struct stream s;
+    char line[16];
+    unsigned shift;
+
+    if(stream_init(&s, STDIN_FILENO, STDOUT_FILENO) < 0) {
+        fprintf(stderr, "out of memory\n");
+        return;
+    }
 
-    printf("plaintext: ");
-    fgets(buf, sizeof buf, stdin);
-    buf[strcspn(buf, "\n")] = '\0';
     printf("shift: ");
-    scanf("%hhu", &shift);
+    if(stream_getline(&s, line, sizeof line) < 0) goto out;
+    shift = strtoul(line, NULL, 10) % 26;
+    if(decrypt) shift = (26 - shift) % 26;
+
+    printf(decrypt ? "ciphertext: " : "plaintext: ");
+    stream_transform(&s, decrypt ? "plaintext: " : "ciphertext: ", caesar_stream, &shift);
+
+out:
+    stream_free(&s);
+}
+
+void algo_caesar(void) {
+    caesar(0);
+}
+
+void algo_caesar_decrypt(void) {
+    caesar(1);
+}
+
+int verify_caesar(size_t sz) {
+    char *orig = malloc(sz), *buf = malloc(sz);
+    unsigned shift = 1 + encro_rng_uniform(25);
+    double t0, t1, t2;
+    int ok;
 
-    for(char *c = buf; *c; c++) {
-        if(IS_UPPERCASE(*c))
-            *c = 'A' + (*c - 'A' + shift) % 26;
-        else if(IS_LOWERCASE(*c))
-            *c = 'a' + (*c - 'a' + shift) % 26;
+    if(!orig || !buf) {
+        free(orig); free(buf);
+        return 0;
     }
-    printf("ciphertext: %s\n", buf);
+    random_text(orig, sz);
+    memcpy(buf, orig, sz);
+
+    t0 = time_now();
+    encro_caesar_buf(buf, sz, shift);
+    t1 = time_now();
+    encro_caesar_buf(buf, sz, 26 - shift);
+    t2 = time_now();
+
+    ok = verify_report("caesar", sz, t1 - t0, t2 - t1, memcmp(orig, buf, sz) == 0);
+    free(orig); free(buf);
+    return ok;
 }
+
+REGISTER_ALGORITHM("caesar", algo_caesar, algo_caesar_decrypt, verify_caesar);
@@ -0,0 +1,409 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <algorithms.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algo_utils.h>
+#include <alloc.h>
+#include <chacha20.h>
+#include <perf.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHACHA20_X86
+#endif
+
+#define ROTL32(x, n) ((uint32_t)((x) << (n)) | ((x) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d) \
+    a += b; d ^= a; d = ROTL32(d, 16); \
+    c += d; b ^= c; b = ROTL32(b, 12); \
+    a += b; d ^= a; d = ROTL32(d, 8); \
+    c += d; b ^= c; b = ROTL32(b, 7);
+
+static uint32_t load32_le(const uint8_t *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1]<<8 | (uint32_t)p[2]<<16 | (uint32_t)p[3]<<24;
+}
+
+static void store32_le(uint8_t *p, uint32_t v) {
+    p[0] = v; p[1] = v>>8; p[2] = v>>16; p[3] = v>>24;
+}
+
+static int always(void) {
+    return 1;
+}
+
+static void portable_xor_blocks(const uint32_t *state, uint8_t *buf, size_t n) {
+    for(uint32_t blk = 0; blk < n; blk++, buf += ENCRO_CHACHA20_BLOCKLEN) {
+        uint32_t x[16];
+
+        memcpy(x, state, sizeof x);
+        x[12] += blk;
+        for(int i = 0; i < 10; i++) {
+            QUARTERROUND(x[0], x[4], x[8],  x[12]);
+            QUARTERROUND(x[1], x[5], x[9],  x[13]);
+            QUARTERROUND(x[2], x[6], x[10], x[14]);
+            QUARTERROUND(x[3], x[7], x[11], x[15]);
+            QUARTERROUND(x[0], x[5], x[10], x[15]);
+            QUARTERROUND(x[1], x[6], x[11], x[12]);
+            QUARTERROUND(x[2], x[7], x[8],  x[13]);
+            QUARTERROUND(x[3], x[4], x[9],  x[14]);
+        }
+        for(int i = 0; i < 16; i++) {
+            uint32_t in = state[i] + (i == 12 ? blk : 0);
+            store32_le(buf + i*4, load32_le(buf + i*4) ^ (x[i] + in));
+        }
+    }
+}
+
+static const struct encro_chacha20_kernel kernel_portable = {
+    .name = "portable",
+    .blocks = 1,
+    .supported = always,
+    .xor_blocks = portable_xor_blocks,
+};
+
+#ifdef CHACHA20_X86
+
+/* Both SIMD kernels keep word i of every block in vector x[i], so a whole
+ * double round is the portable one with vector adds, xors and rotates. */
+
+#define VQUARTERROUND(add, xor, rotl, a, b, c, d) \
+    a = add(a, b); d = xor(d, a); d = rotl(d, 16); \
+    c = add(c, d); b = xor(b, c); b = rotl(b, 12); \
+    a = add(a, b); d = xor(d, a); d = rotl(d, 8); \
+    c = add(c, d); b = xor(b, c); b = rotl(b, 7);
+
+#define VDOUBLEROUND(add, xor, rotl, x) \
+    VQUARTERROUND(add, xor, rotl, x[0], x[4], x[8],  x[12]) \
+    VQUARTERROUND(add, xor, rotl, x[1], x[5], x[9],  x[13]) \
+    VQUARTERROUND(add, xor, rotl, x[2], x[6], x[10], x[14]) \
+    VQUARTERROUND(add, xor, rotl, x[3], x[7], x[11], x[15]) \
+    VQUARTERROUND(add, xor, rotl, x[0], x[5], x[10], x[15]) \
+    VQUARTERROUND(add, xor, rotl, x[1], x[6], x[11], x[12]) \
+    VQUARTERROUND(add, xor, rotl, x[2], x[7], x[8],  x[13]) \
+    VQUARTERROUND(add, xor, rotl, x[3], x[4], x[9],  x[14])
+
+#define SSE2_ROTL(x, n) _mm_or_si128(_mm_slli_epi32(x, n), _mm_srli_epi32(x, 32 - (n)))
+
+static int sse2_supported(void) {
+    return __builtin_cpu_supports("sse2");
+}
+
+/* words a-d of 4 blocks to 16 bytes of each block */
+#define SSE2_TRANSPOSE(a, b, c, d) { \
+    __m128i t0 = _mm_unpacklo_epi32(a, b), t1 = _mm_unpacklo_epi32(c, d); \
+    __m128i t2 = _mm_unpackhi_epi32(a, b), t3 = _mm_unpackhi_epi32(c, d); \
+    a = _mm_unpacklo_epi64(t0, t1); b = _mm_unpackhi_epi64(t0, t1); \
+    c = _mm_unpacklo_epi64(t2, t3); d = _mm_unpackhi_epi64(t2, t3); }
+
+__attribute__((target("sse2")))
+static void sse2_xor_4(const uint32_t *state, uint8_t *buf) {
+    __m128i x[16], in[16];
+
+    for(int i = 0; i < 16; i++)
+        in[i] = _mm_set1_epi32(state[i]);
+    in[12] = _mm_add_epi32(in[12], _mm_set_epi32(3, 2, 1, 0));
+    memcpy(x, in, sizeof x);
+
+    for(int i = 0; i < 10; i++) {
+        VDOUBLEROUND(_mm_add_epi32, _mm_xor_si128, SSE2_ROTL, x)
+    }
+
+    for(int i = 0; i < 16; i++)
+        x[i] = _mm_add_epi32(x[i], in[i]);
+    for(int g = 0; g < 4; g++) {
+        SSE2_TRANSPOSE(x[g*4], x[g*4+1], x[g*4+2], x[g*4+3]);
+        for(int blk = 0; blk < 4; blk++) {
+            __m128i *p = (__m128i *)(buf + blk*ENCRO_CHACHA20_BLOCKLEN + g*16);
+            _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), x[g*4 + blk]));
+        }
+    }
+}
+
+static void sse2_xor_blocks(const uint32_t *state, uint8_t *buf, size_t n) {
+    uint32_t s[16];
+    memcpy(s, state, sizeof s);
+    for(; n >= 4; n -= 4, s[12] += 4, buf += 4*ENCRO_CHACHA20_BLOCKLEN)
+        sse2_xor_4(s, buf);
+    if(n > 0) portable_xor_blocks(s, buf, n);
+}
+
+static const struct encro_chacha20_kernel kernel_sse2 = {
+    .name = "sse2",
+    .blocks = 4,
+    .supported = sse2_supported,
+    .xor_blocks = sse2_xor_blocks,
+};
+
+#define AVX2_ROTL(x, n) _mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+
+static int avx2_supported(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+/* same as SSE2_TRANSPOSE in each 128-bit lane, the low lane ends up with
+ * blocks 0-3 and the high lane with blocks 4-7 */
+#define AVX2_TRANSPOSE(a, b, c, d) { \
+    __m256i t0 = _mm256_unpacklo_epi32(a, b), t1 = _mm256_unpacklo_epi32(c, d); \
+    __m256i t2 = _mm256_unpackhi_epi32(a, b), t3 = _mm256_unpackhi_epi32(c, d); \
+    a = _mm256_unpacklo_epi64(t0, t1); b = _mm256_unpackhi_epi64(t0, t1); \
+    c = _mm256_unpacklo_epi64(t2, t3); d = _mm256_unpackhi_epi64(t2, t3); }
+
+__attribute__((target("avx2")))
+static void avx2_xor_8(const uint32_t *state, uint8_t *buf) {
+    __m256i x[16], in[16];
+
+    for(int i = 0; i < 16; i++)
+        in[i] = _mm256_set1_epi32(state[i]);
+    in[12] = _mm256_add_epi32(in[12], _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+    memcpy(x, in, sizeof x);
+
+    for(int i = 0; i < 10; i++) {
+        VDOUBLEROUND(_mm256_add_epi32, _mm256_xor_si256, AVX2_ROTL, x)
+    }
+
+    for(int i = 0; i < 16; i++)
+        x[i] = _mm256_add_epi32(x[i], in[i]);
+    for(int g = 0; g < 4; g++)
+        AVX2_TRANSPOSE(x[g*4], x[g*4+1], x[g*4+2], x[g*4+3]);
+
+    /* x[g*4 + blk] holds bytes g*16.. of blocks blk and blk+4 */
+    for(int blk = 0; blk < 4; blk++)
+        for(int half = 0; half < 2; half++) {
+            __m256i lo = x[half*8 + blk], hi = x[half*8 + 4 + blk];
+            __m256i *p0 = (__m256i *)(buf + blk*ENCRO_CHACHA20_BLOCKLEN + half*32);
+            __m256i *p1 = (__m256i *)(buf + (blk+4)*ENCRO_CHACHA20_BLOCKLEN + half*32);
+            _mm256_storeu_si256(p0, _mm256_xor_si256(_mm256_loadu_si256(p0),
+                                _mm256_permute2x128_si256(lo, hi, 0x20)));
+            _mm256_storeu_si256(p1, _mm256_xor_si256(_mm256_loadu_si256(p1),
+                                _mm256_permute2x128_si256(lo, hi, 0x31)));
+        }
+}
+
+static void avx2_xor_blocks(const uint32_t *state, uint8_t *buf, size_t n) {
+    uint32_t s[16];
+    memcpy(s, state, sizeof s);
+    for(; n >= 8; n -= 8, s[12] += 8, buf += 8*ENCRO_CHACHA20_BLOCKLEN)
+        avx2_xor_8(s, buf);
+    sse2_xor_blocks(s, buf, n);
+}
+
+static const struct encro_chacha20_kernel kernel_avx2 = {
+    .name = "avx2",
+    .blocks = 8,
+    .supported = avx2_supported,
+    .xor_blocks = avx2_xor_blocks,
+};
+
+#endif
+
+/* fastest first */
+static const struct encro_chacha20_kernel *kernels[] = {
+#ifdef CHACHA20_X86
+    &kernel_avx2,
+    &kernel_sse2,
+#endif
+    &kernel_portable,
+};
+
+const struct encro_chacha20_kernel *encro_chacha20_find_kernel(const char *name) {
+    for(size_t i = 0; i < sizeof kernels / sizeof kernels[0]; i++)
+        if(strcmp(kernels[i]->name, name) == 0 && kernels[i]->supported())
+            return kernels[i];
+    return NULL;
+}
+
+const struct encro_chacha20_kernel *encro_chacha20_default_kernel(void) {
+    const char *name = getenv("ENCRO_CHACHA");
+    const struct encro_chacha20_kernel *kernel = name ? encro_chacha20_find_kernel(name) : NULL;
+
+    for(size_t i = 0; !kernel; i++)
+        if(kernels[i]->supported()) kernel = kernels[i];
+    return kernel;
+}
+
+void encro_chacha20_init_kernel(struct encro_chacha20_ctx *ctx,
+                                const struct encro_chacha20_kernel *kernel,
+                                const uint8_t *key, const uint8_t *nonce, uint32_t counter) {
+    PERF_BEGIN(PERF_KEY_EXPANSION);
+    /* "expand 32-byte k" */
+    ctx->state[0] = 0x61707865;
+    ctx->state[1] = 0x3320646e;
+    ctx->state[2] = 0x79622d32;
+    ctx->state[3] = 0x6b206574;
+    for(int i = 0; i < 8; i++)
+        ctx->state[4 + i] = load32_le(key + i*4);
+    ctx->kernel = kernel;
+    encro_chacha20_set_nonce(ctx, nonce, counter);
+    PERF_END(PERF_KEY_EXPANSION);
+}
+
+void encro_chacha20_set_nonce(struct encro_chacha20_ctx *ctx, const uint8_t *nonce,
+                              uint32_t counter) {
+    ctx->state[12] = counter;
+    for(int i = 0; i < 3; i++)
+        ctx->state[13 + i] = load32_le(nonce + i*4);
+    ctx->ks_pos = sizeof ctx->ks;
+}
+
+void encro_chacha20_init(struct encro_chacha20_ctx *ctx, const uint8_t *key,
+                         const uint8_t *nonce, uint32_t counter) {
+    encro_chacha20_init_kernel(ctx, encro_chacha20_default_kernel(), key, nonce, counter);
+}
+
+void encro_chacha20_xcrypt_buf(struct encro_chacha20_ctx *ctx, uint8_t *buf, size_t sz) {
+    size_t n;
+
+    PERF_BEGIN(PERF_BLOCK);
+    /* leftover keystream from the last call */
+    if(ctx->ks_pos < sizeof ctx->ks) {
+        n = sizeof ctx->ks - ctx->ks_pos;
+        if(n > sz) n = sz;
+        for(size_t i = 0; i < n; i++)
+            buf[i] ^= ctx->ks[ctx->ks_pos + i];
+        ctx->ks_pos += n;
+        buf += n;
+        sz -= n;
+    }
+
+    /* whole blocks go straight through the kernel */
+    n = sz / ENCRO_CHACHA20_BLOCKLEN;
+    if(n > 0) {
+        ctx->kernel->xor_blocks(ctx->state, buf, n);
+        ctx->state[12] += n;
+        buf += n*ENCRO_CHACHA20_BLOCKLEN;
+        sz -= n*ENCRO_CHACHA20_BLOCKLEN;
+    }
+
+    if(sz > 0) {
+        memset(ctx->ks, 0, sizeof ctx->ks);
+        ctx->kernel->xor_blocks(ctx->state, ctx->ks, ENCRO_CHACHA20_BATCH);
+        ctx->state[12] += ENCRO_CHACHA20_BATCH;
+        for(size_t i = 0; i < sz; i++)
+            buf[i] ^= ctx->ks[i];
+        ctx->ks_pos = sz;
+    }
+    PERF_END(PERF_BLOCK);
+}
+
+void encro_chacha20_seek(struct encro_chacha20_ctx *ctx, uint64_t off) {
+    uint8_t skip[ENCRO_CHACHA20_BLOCKLEN] = { 0 };
+
+    ctx->state[12] += off / ENCRO_CHACHA20_BLOCKLEN;
+    ctx->ks_pos = sizeof ctx->ks;
+    encro_chacha20_xcrypt_buf(ctx, skip, off % ENCRO_CHACHA20_BLOCKLEN);
+}
+
+static void chacha20_encrypt(void) {
+    char *line = NULL;
+    size_t cap = 0, len;
+    struct encro_chacha20_ctx ctx;
+    uint8_t key[ENCRO_CHACHA20_KEYLEN], nonce[ENCRO_CHACHA20_NONCELEN];
+
+    keygen(key, sizeof key);
+    keygen(nonce, sizeof nonce);
+
+    printf("plaintext: ");
+    if(getline(&line, &cap, stdin) < 0) {
+        free(line);
+        return;
+    }
+    len = strcspn(line, "\n");
+    line[len] = '\0';
+
+    /* encryption */
+    encro_chacha20_init(&ctx, key, nonce, 0);
+    encro_chacha20_xcrypt_buf(&ctx, (uint8_t *)line, len);
+    printf("ciphertext: "); print_ciphertext((uint8_t *)line, len);
+    printf("key: "); print_hex(key, sizeof key);
+    printf("nonce: "); print_hex(nonce, sizeof nonce);
+
+    /* decryption */
+    encro_chacha20_init(&ctx, key, nonce, 0);
+    encro_chacha20_xcrypt_buf(&ctx, (uint8_t *)line, len);
+    printf("decrypted: %s\n", line);
+
+    free(line);
+}
+
+static void chacha20_decrypt(void) {
+    char *line = NULL;
+    uint8_t *buf = NULL;
+    size_t cap = 0, len;
+    ssize_t n;
+    struct encro_chacha20_ctx ctx;
+    uint8_t key[ENCRO_CHACHA20_KEYLEN], nonce[ENCRO_CHACHA20_NONCELEN];
+
+    printf("ciphertext: ");
+    if((n = getline(&line, &cap, stdin)) < 0) goto out;
+    if(!(buf = slab_alloc(n + 1))) {
+        fprintf(stderr, "out of memory\n");
+        goto out;
+    }
+    if((len = parse_ciphertext(buf, line, n)) == (size_t)-1) {
+        fprintf(stderr, "ciphertext must be hex or base64\n");
+        goto out;
+    }
+    printf("key: ");
+    if(getline(&line, &cap, stdin) < 0) goto out;
+    if(parse_hex(key, sizeof key, line) != sizeof key) {
+        fprintf(stderr, "key must be %d hex bytes\n", ENCRO_CHACHA20_KEYLEN);
+        goto out;
+    }
+    printf("nonce: ");
+    if(getline(&line, &cap, stdin) < 0) goto out;
+    if(parse_hex(nonce, sizeof nonce, line) != sizeof nonce) {
+        fprintf(stderr, "nonce must be %d hex bytes\n", ENCRO_CHACHA20_NONCELEN);
+        goto out;
+    }
+
+    encro_chacha20_init(&ctx, key, nonce, 0);
+    encro_chacha20_xcrypt_buf(&ctx, buf, len);
+    buf[len] = '\0';
+    printf("plaintext: %s\n", buf);
+
+out:
+    slab_free(buf);
+    free(line);
+}
+
+void algo_chacha20(void) {
+    chacha20_encrypt();
+}
+
+void algo_chacha20_decrypt(void) {
+    chacha20_decrypt();
+}
+
+int verify_chacha20(size_t sz) {
+    uint8_t *orig = malloc(sz), *buf = malloc(sz);
+    uint8_t key[ENCRO_CHACHA20_KEYLEN], nonce[ENCRO_CHACHA20_NONCELEN];
+    struct encro_chacha20_ctx ctx;
+    double t0, t1, t2;
+    int ok = 0;
+
+    if(!orig || !buf) goto out;
+    keygen(key, sizeof key);
+    keygen(nonce, sizeof nonce);
+    random_text((char *)orig, sz);
+    memcpy(buf, orig, sz);
+
+    t0 = time_now();
+    encro_chacha20_init(&ctx, key, nonce, 0);
+    encro_chacha20_xcrypt_buf(&ctx, buf, sz);
+    t1 = time_now();
+    encro_chacha20_init(&ctx, key, nonce, 0);
+    encro_chacha20_xcrypt_buf(&ctx, buf, sz);
+    t2 = time_now();
+
+    ok = verify_report("chacha20", sz, t1 - t0, t2 - t1, memcmp(orig, buf, sz) == 0);
+out:
+    free(orig); free(buf);
+    return ok;
+}
+
+REGISTER_ALGORITHM("chacha20", algo_chacha20, algo_chacha20_decrypt, verify_chacha20);
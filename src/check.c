@@ -0,0 +1,641 @@
+#define _POSIX_C_SOURCE 200809L
+
+/* make check: every accelerated kernel against the reference code on random
+ * keys, lengths and buffer offsets, plus the published test vectors.
+ *
+ *     ./encro-check [seed [rounds]]
+ *
+ * the reference for AES is the ref engine, for ChaCha20 the portable kernel,
+ * for the codec and the classical ciphers the scalar loops below and for RSA
+ * a left to right powmod. a failure prints the seed so the run can be
+ * repeated. not part of libencro or encro */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <inttypes.h>
+
+#include <encro.h>
+
+#define MAX_LEN     4096             /* longest random message */
+#define MAX_OFFSET  64               /* buffers start this far off alignment at most */
+#define MAX_REPORTS 20
+
+static uint64_t seed, state;
+static unsigned rounds = 200;
+static unsigned failures;
+
+/* splitmix64, so a seed repeats a run exactly */
+static uint64_t next(void) {
+    uint64_t z = (state += 0x9e3779b97f4a7c15);
+    z = (z ^ z >> 30) * 0xbf58476d1ce4e5b9;
+    z = (z ^ z >> 27) * 0x94d049bb133111eb;
+    return z ^ z >> 31;
+}
+
+static void random_bytes(void *buf, size_t sz) {
+    for(size_t i = 0; i < sz; i++) ((uint8_t *)buf)[i] = next();
+}
+
+/* mostly lengths right around a multiple of 64, which is where the batched
+ * kernels hand over to their tail code */
+static size_t random_len(void) {
+    switch(next() % 4) {
+    case 0:  return next() % 64;
+    case 1:  return 64*(1 + next() % 16) - 3 + next() % 7;
+    default: return next() % (MAX_LEN + 1);
+    }
+}
+
+/* a buffer at a random misalignment, the base is kept for free */
+struct buf {
+    uint8_t *base, *p;
+};
+
+static void buf_alloc(struct buf *b) {
+    if(!(b->base = malloc(MAX_LEN + 2*MAX_OFFSET))) {
+        fprintf(stderr, "out of memory\n");
+        exit(2);
+    }
+    b->p = b->base;
+}
+
+static uint8_t *buf_shift(struct buf *b) {
+    return b->p = b->base + next() % MAX_OFFSET;
+}
+
+static void fail(const char *fmt, ...) {
+    va_list ap;
+
+    if(failures++ >= MAX_REPORTS) return;
+    fprintf(stderr, "FAIL ");
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+}
+
+/* reports the first differing byte under what */
+static int same(const void *got, const void *want, size_t sz, const char *what, size_t len) {
+    const uint8_t *g = got, *w = want;
+
+    for(size_t i = 0; i < sz; i++)
+        if(g[i] != w[i]) {
+            fail("%s, length %zu: byte %zu is %02x, want %02x", what, len, i, g[i], w[i]);
+            return 0;
+        }
+    return 1;
+}
+
+static size_t unhex(uint8_t *out, const char *hex) {
+    size_t n = 0;
+
+    for(; hex[0] && hex[1]; hex += 2) {
+        unsigned v;
+        sscanf(hex, "%2x", &v);
+        out[n++] = v;
+    }
+    return n;
+}
+
+static void section(const char *name, unsigned before) {
+    printf("%-10s %s\n", name, failures == before ? "ok" : "FAILED");
+}
+
+/*==============================================================================
+ * AES
+ *============================================================================*/
+
+/* every engine but the reference one */
+static const char *aes_engines[] = { "bitslice" };
+
+/* FIPS-197 appendix B and C.1 */
+static const struct {
+    const char *key, *plain, *cipher;
+} aes_blocks[] = {
+    { "2b7e151628aed2a6abf7158809cf4f3c", "3243f6a8885a308d313198a2e0370734",
+      "3925841d02dc09fbdc118597196a0b32" },
+    { "000102030405060708090a0b0c0d0e0f", "00112233445566778899aabbccddeeff",
+      "69c4e0d86a7b0430d8cdb78070b4c55a" },
+};
+
+/* SP 800-38A F.2.1 and F.5.1, AES-128 in CBC and CTR mode */
+#define SP800_38A_KEY   "2b7e151628aed2a6abf7158809cf4f3c"
+#define SP800_38A_PLAIN "6bc1bee22e409f96e93d7e117393172a" "ae2d8a571e03ac9c9eb76fac45af8e51" \
+                        "30c81c46a35ce411e5fbc1191a0a52ef" "f69f2445df4f9b17ad2b417be66c3710"
+#define CBC_IV          "000102030405060708090a0b0c0d0e0f"
+#define CBC_CIPHER      "7649abac8119b246cee98e9b12e9197d" "5086cb9b507219ee95db113a917678b2" \
+                        "73bed6b8e3c1743b7116e69e22229516" "3ff1caa1681fac09120eca307586e1a7"
+#define CTR_IV          "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff"
+#define CTR_CIPHER      "874d6191b620e3261bef6864990db6ce" "9806f66b7970fdff8617187bb9fffdff" \
+                        "5ae4df3edbd5d35e5b4f09020db03eab" "1e031dda2fbe03d1792170a0f3009cee"
+
+static void aes_vectors(const struct encro_aes_engine *e) {
+    uint8_t key[ENCRO_AES_KEYLEN], iv[ENCRO_AES_BLOCKLEN] = { 0 }, plain[64], cipher[64], buf[64];
+    struct encro_aes_ctx ctx;
+    size_t sz;
+
+    for(size_t i = 0; i < sizeof aes_blocks / sizeof aes_blocks[0]; i++) {
+        unhex(key, aes_blocks[i].key);
+        unhex(plain, aes_blocks[i].plain);
+        unhex(cipher, aes_blocks[i].cipher);
+        encro_aes_init_engine(&ctx, e, key, iv);
+        memcpy(buf, plain, ENCRO_AES_BLOCKLEN);
+        e->encrypt(&ctx, buf, 1);
+        same(buf, cipher, ENCRO_AES_BLOCKLEN, "aes FIPS-197 encrypt", i);
+        e->decrypt(&ctx, buf, 1);
+        same(buf, plain, ENCRO_AES_BLOCKLEN, "aes FIPS-197 decrypt", i);
+    }
+
+    unhex(key, SP800_38A_KEY);
+    sz = unhex(plain, SP800_38A_PLAIN);
+    unhex(iv, CBC_IV);
+    unhex(cipher, CBC_CIPHER);
+    memcpy(buf, plain, sz);
+    encro_aes_init_engine(&ctx, e, key, iv);
+    encro_aes_cbc_encrypt_buf(&ctx, buf, sz);
+    same(buf, cipher, sz, "aes-cbc SP 800-38A encrypt", sz);
+    encro_aes_init_engine(&ctx, e, key, iv);
+    encro_aes_cbc_decrypt_buf(&ctx, buf, sz);
+    same(buf, plain, sz, "aes-cbc SP 800-38A decrypt", sz);
+
+    unhex(iv, CTR_IV);
+    unhex(cipher, CTR_CIPHER);
+    memcpy(buf, plain, sz);
+    encro_aes_init_engine(&ctx, e, key, iv);
+    encro_aes_ctr_xcrypt_buf(&ctx, buf, sz);
+    same(buf, cipher, sz, "aes-ctr SP 800-38A", sz);
+}
+
+static void aes_random(const struct encro_aes_engine *e) {
+    const struct encro_aes_engine *ref = &encro_aes_engine_ref;
+    uint8_t key[ENCRO_AES_KEYLEN], iv[ENCRO_AES_BLOCKLEN];
+    struct buf a, b, orig;
+    struct encro_aes_ctx rctx, ctx;
+
+    buf_alloc(&a); buf_alloc(&b); buf_alloc(&orig);
+    for(unsigned r = 0; r < rounds; r++) {
+        size_t len = random_len(), blocks = len / ENCRO_AES_BLOCKLEN, off, done;
+        uint8_t *x = buf_shift(&a), *y = buf_shift(&b), *m = buf_shift(&orig);
+
+        random_bytes(key, sizeof key);
+        random_bytes(iv, sizeof iv);
+        random_bytes(m, len);
+
+        /* raw blocks, in whatever batches the engine takes */
+        encro_aes_init_engine(&rctx, ref, key, iv);
+        encro_aes_init_engine(&ctx, e, key, iv);
+        memcpy(x, m, len);
+        memcpy(y, m, len);
+        for(size_t i = 0; i < blocks; i++) ref->encrypt(&rctx, x + i*ENCRO_AES_BLOCKLEN, 1);
+        e->encrypt(&ctx, y, blocks);
+        same(y, x, blocks*ENCRO_AES_BLOCKLEN, "aes encrypt blocks", blocks);
+        for(size_t i = 0; i < blocks; i++) ref->decrypt(&rctx, x + i*ENCRO_AES_BLOCKLEN, 1);
+        e->decrypt(&ctx, y, blocks);
+        same(y, x, blocks*ENCRO_AES_BLOCKLEN, "aes decrypt blocks", blocks);
+        same(x, m, blocks*ENCRO_AES_BLOCKLEN, "aes ref round trip", blocks);
+
+        /* CBC with padding, the tail is whatever len leaves over */
+        encro_aes_init_engine(&rctx, ref, key, iv);
+        encro_aes_init_engine(&ctx, e, key, iv);
+        memcpy(x, m, len);
+        memcpy(y, m, len);
+        if(encro_aes_cbc_encrypt_padded(&ctx, y, len) != encro_aes_cbc_encrypt_padded(&rctx, x, len))
+            fail("aes-cbc padded length %zu: sizes differ", len);
+        same(y, x, len + ENCRO_AES_BLOCKLEN - len % ENCRO_AES_BLOCKLEN, "aes-cbc encrypt", len);
+        encro_aes_init_engine(&ctx, e, key, iv);
+        if(encro_aes_cbc_decrypt_padded(&ctx, y,
+                                        len + ENCRO_AES_BLOCKLEN - len % ENCRO_AES_BLOCKLEN) != len)
+            fail("aes-cbc padded length %zu: bad padding after decrypt", len);
+        same(y, m, len, "aes-cbc decrypt", len);
+
+        /* CTR in one go for the reference, in random pieces for the engine */
+        encro_aes_init_engine(&rctx, ref, key, iv);
+        encro_aes_init_engine(&ctx, e, key, iv);
+        memcpy(x, m, len);
+        memcpy(y, m, len);
+        encro_aes_ctr_xcrypt_buf(&rctx, x, len);
+        for(done = 0; done < len; ) {
+            size_t n = next() % 200;
+            if(n > len - done) n = len - done;
+            encro_aes_ctr_xcrypt_buf(&ctx, y + done, n);
+            done += n;
+        }
+        same(y, x, len, "aes-ctr in pieces", len);
+
+        /* and from a random offset */
+        off = len ? next() % len : 0;
+        encro_aes_init_engine(&ctx, e, key, iv);
+        encro_aes_ctr_seek(&ctx, off);
+        memcpy(y, m, len);
+        encro_aes_ctr_xcrypt_buf(&ctx, y + off, len - off);
+        same(y + off, x + off, len - off, "aes-ctr after seek", off);
+    }
+    free(a.base); free(b.base); free(orig.base);
+}
+
+static void check_aes(void) {
+    unsigned before = failures;
+
+    aes_vectors(&encro_aes_engine_ref);
+    for(size_t i = 0; i < sizeof aes_engines / sizeof aes_engines[0]; i++) {
+        const struct encro_aes_engine *e = encro_aes_find_engine(aes_engines[i]);
+
+        if(!e) {
+            fail("aes engine %s is missing", aes_engines[i]);
+            continue;
+        }
+        aes_vectors(e);
+        aes_random(e);
+    }
+    section("aes", before);
+}
+
+/*==============================================================================
+ * ChaCha20
+ *============================================================================*/
+
+/* every kernel but the portable one, unsupported ones are skipped */
+static const char *chacha20_kernels[] = { "avx2", "sse2" };
+
+/* RFC 8439 2.4.2 */
+#define RFC8439_KEY    "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+#define RFC8439_NONCE  "000000000000004a00000000"
+#define RFC8439_PLAIN  "Ladies and Gentlemen of the class of '99: If I could offer you " \
+                       "only one tip for the future, sunscreen would be it."
+#define RFC8439_CIPHER "6e2e359a2568f98041ba0728dd0d6981e97e7aec1d4360c20a27afccfd9fae0b" \
+                       "f91b65c5524733ab8f593dabcd62b3571639d624e65152ab8f530c359f0861d8" \
+                       "07ca0dbf500d6a6156a38e088a22b65e52bc514d16ccf806818ce91ab7793736" \
+                       "5af90bbf74a35be6b40b8eedf2785e42874d"
+
+static void chacha20_vector(const struct encro_chacha20_kernel *k) {
+    uint8_t key[ENCRO_CHACHA20_KEYLEN], nonce[ENCRO_CHACHA20_NONCELEN], cipher[128], buf[128];
+    size_t sz = sizeof RFC8439_PLAIN - 1;
+    struct encro_chacha20_ctx ctx;
+
+    unhex(key, RFC8439_KEY);
+    unhex(nonce, RFC8439_NONCE);
+    unhex(cipher, RFC8439_CIPHER);
+    memcpy(buf, RFC8439_PLAIN, sz);
+    encro_chacha20_init_kernel(&ctx, k, key, nonce, 1);
+    encro_chacha20_xcrypt_buf(&ctx, buf, sz);
+    same(buf, cipher, sz, "chacha20 RFC 8439", sz);
+}
+
+static void chacha20_random(const struct encro_chacha20_kernel *k) {
+    const struct encro_chacha20_kernel *ref = encro_chacha20_find_kernel("portable");
+    uint8_t key[ENCRO_CHACHA20_KEYLEN], nonce[ENCRO_CHACHA20_NONCELEN];
+    struct encro_chacha20_ctx rctx, ctx;
+    struct buf a, b, orig;
+
+    buf_alloc(&a); buf_alloc(&b); buf_alloc(&orig);
+    for(unsigned r = 0; r < rounds; r++) {
+        size_t len = random_len(), off, done;
+        uint8_t *x = buf_shift(&a), *y = buf_shift(&b), *m = buf_shift(&orig);
+        /* now and then right below where the block counter wraps */
+        uint32_t counter = next() % 4 ? (uint32_t)next() : UINT32_MAX - next() % 16;
+
+        random_bytes(key, sizeof key);
+        random_bytes(nonce, sizeof nonce);
+        random_bytes(m, len);
+
+        encro_chacha20_init_kernel(&rctx, ref, key, nonce, counter);
+        encro_chacha20_init_kernel(&ctx, k, key, nonce, counter);
+        memcpy(x, m, len);
+        memcpy(y, m, len);
+        encro_chacha20_xcrypt_buf(&rctx, x, len);
+        for(done = 0; done < len; ) {
+            size_t n = next() % 700;
+            if(n > len - done) n = len - done;
+            encro_chacha20_xcrypt_buf(&ctx, y + done, n);
+            done += n;
+        }
+        same(y, x, len, "chacha20 in pieces", len);
+
+        off = len ? next() % len : 0;
+        encro_chacha20_init_kernel(&ctx, k, key, nonce, counter);
+        encro_chacha20_seek(&ctx, off);
+        memcpy(y, m, len);
+        encro_chacha20_xcrypt_buf(&ctx, y + off, len - off);
+        same(y + off, x + off, len - off, "chacha20 after seek", off);
+    }
+    free(a.base); free(b.base); free(orig.base);
+}
+
+static void check_chacha20(void) {
+    unsigned before = failures;
+
+    chacha20_vector(encro_chacha20_find_kernel("portable"));
+    for(size_t i = 0; i < sizeof chacha20_kernels / sizeof chacha20_kernels[0]; i++) {
+        const struct encro_chacha20_kernel *k = encro_chacha20_find_kernel(chacha20_kernels[i]);
+
+        if(!k) {
+            printf("%-10s %s not supported here, skipped\n", "chacha20", chacha20_kernels[i]);
+            continue;
+        }
+        chacha20_vector(k);
+        chacha20_random(k);
+    }
+    section("chacha20", before);
+}
+
+/*==============================================================================
+ * hex and base64
+ *============================================================================*/
+
+static const char *codec_kernels[] = { "avx2", "ssse3" };
+
+static const char b64[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static size_t ref_hex_encode(char *out, const uint8_t *in, size_t sz) {
+    for(size_t i = 0; i < sz; i++) sprintf(out + 2*i, "%02X", in[i]);
+    return 2*sz;
+}
+
+static size_t ref_base64_encode(char *out, const uint8_t *in, size_t sz) {
+    size_t o = 0;
+
+    for(size_t i = 0; i < sz; i += 3) {
+        uint32_t w = (uint32_t)in[i] << 16;
+        if(i + 1 < sz) w |= in[i+1] << 8;
+        if(i + 2 < sz) w |= in[i+2];
+        out[o++] = b64[w >> 18];
+        out[o++] = b64[w >> 12 & 0x3f];
+        out[o++] = i + 1 < sz ? b64[w >> 6 & 0x3f] : '=';
+        out[o++] = i + 2 < sz ? b64[w & 0x3f] : '=';
+    }
+    return o;
+}
+
+/* lowercases a random half of the letters, the decoders take both */
+static void mix_case(char *s, size_t len) {
+    for(size_t i = 0; i < len; i++)
+        if(s[i] >= 'A' && s[i] <= 'F' && next() & 1) s[i] += 'a' - 'A';
+}
+
+/* a character neither alphabet has */
+static char not_codec(void) {
+    static const char bad[] = " \n\t=-_.!*\x80\xff";
+    return bad[next() % (sizeof bad - 1)];
+}
+
+static void codec_random(const struct encro_codec_kernel *k) {
+    struct buf in, enc, got;
+
+    buf_alloc(&in); buf_alloc(&got);
+    /* encoded text is twice as long */
+    enc.base = malloc(2*MAX_LEN + 4 + MAX_OFFSET);
+    if(!enc.base) exit(2);
+    for(unsigned r = 0; r < rounds; r++) {
+        size_t len = random_len(), elen, n, bad;
+        uint8_t *m = buf_shift(&in), *g = buf_shift(&got);
+        char *e = (char *)(enc.base + next() % MAX_OFFSET), *ref;
+
+        random_bytes(m, len);
+        if(!(ref = malloc(2*len + 4))) exit(2);
+
+        /* the kernels do a prefix, which has to be what the scalar code writes */
+        elen = ref_hex_encode(ref, m, len);
+        if((n = k->hex_encode(e, m, len)) > len)
+            fail("hex_encode %s used %zu of %zu bytes", k->name, n, len);
+        else
+            same(e, ref, 2*n, "hex_encode", len);
+        mix_case(ref, elen);
+        memcpy(e, ref, elen);
+        if((n = k->hex_decode(g, e, elen)) > elen || n % 2)
+            fail("hex_decode %s used %zu of %zu characters", k->name, n, elen);
+        else
+            same(g, m, n/2, "hex_decode", len);
+        /* and stops short of anything that isn't hex */
+        if(elen) {
+            bad = next() % elen;
+            e[bad] = not_codec();
+            if((n = k->hex_decode(g, e, elen)) > bad)
+                fail("hex_decode %s read past a bad character at %zu of %zu", k->name, bad, elen);
+            else
+                same(g, m, n/2, "hex_decode before a bad character", len);
+            if(encro_hex_decode(g, e, elen) != bad/2)
+                fail("hex_decode stopped in the wrong place, bad character at %zu", bad);
+        }
+
+        elen = ref_base64_encode(ref, m, len);
+        if((n = k->base64_encode(e, m, len)) > len || n % 3)
+            fail("base64_encode %s used %zu of %zu bytes", k->name, n, len);
+        else
+            same(e, ref, n/3*4, "base64_encode", len);
+        memcpy(e, ref, elen);
+        if((n = k->base64_decode(g, e, elen)) > elen || n % 4)
+            fail("base64_decode %s used %zu of %zu characters", k->name, n, elen);
+        else
+            same(g, m, n/4*3, "base64_decode", len);
+        if(elen) {
+            bad = next() % elen;
+            e[bad] = not_codec();
+            if((n = k->base64_decode(g, e, elen)) > bad)
+                fail("base64_decode %s read past a bad character at %zu of %zu", k->name, bad, elen);
+            else
+                same(g, m, n/4*3, "base64_decode before a bad character", len);
+        }
+
+        /* the whole thing with whatever kernel is the default */
+        ref_hex_encode(ref, m, len);
+        encro_hex_encode(e, m, len);
+        if(same(e, ref, 2*len, "hex_encode", len)) {
+            mix_case(e, 2*len);
+            if(encro_hex_decode(g, e, 2*len) != len) fail("hex_decode length %zu: short", len);
+            same(g, m, len, "hex round trip", len);
+        }
+        elen = ref_base64_encode(ref, m, len);
+        encro_base64_encode(e, m, len);
+        if(same(e, ref, elen, "base64_encode", len)) {
+            /* without the padding too */
+            while(elen && e[elen-1] == '=' && next() & 1) elen--;
+            if(encro_base64_decode(g, e, elen) != len) fail("base64_decode length %zu: wrong size", len);
+            same(g, m, len, "base64 round trip", len);
+        }
+        free(ref);
+    }
+    free(in.base); free(enc.base); free(got.base);
+}
+
+static void check_codec(void) {
+    unsigned before = failures;
+
+    codec_random(encro_codec_find_kernel("portable"));
+    for(size_t i = 0; i < sizeof codec_kernels / sizeof codec_kernels[0]; i++) {
+        const struct encro_codec_kernel *k = encro_codec_find_kernel(codec_kernels[i]);
+
+        if(!k) {
+            printf("%-10s %s not supported here, skipped\n", "codec", codec_kernels[i]);
+            continue;
+        }
+        codec_random(k);
+    }
+    section("codec", before);
+}
+
+/*==============================================================================
+ * caesar, vigenere and atbash
+ *============================================================================*/
+
+/* the textbook loops the branchless ones replaced */
+
+static void ref_caesar(char *buf, size_t sz, unsigned shift) {
+    for(size_t i = 0; i < sz; i++) {
+        char c = buf[i];
+        if(c >= 'A' && c <= 'Z') buf[i] = 'A' + (c - 'A' + shift % 26) % 26;
+        else if(c >= 'a' && c <= 'z') buf[i] = 'a' + (c - 'a' + shift % 26) % 26;
+    }
+}
+
+static void ref_atbash(char *buf, size_t sz) {
+    for(size_t i = 0; i < sz; i++) {
+        char c = buf[i];
+        if(c >= 'A' && c <= 'Z') buf[i] = 'Z' - (c - 'A');
+        else if(c >= 'a' && c <= 'z') buf[i] = 'z' - (c - 'a');
+    }
+}
+
+/* the key is walked from the start of the message, only letters use it up */
+static void ref_vigenere(char *buf, size_t sz, const char *key, int decrypt) {
+    size_t k = 0, klen = strlen(key);
+
+    for(size_t i = 0; i < sz; i++) {
+        char c = buf[i], base;
+        unsigned shift;
+
+        if(c >= 'A' && c <= 'Z') base = 'A';
+        else if(c >= 'a' && c <= 'z') base = 'a';
+        else continue;
+        shift = key[k] >= 'A' && key[k] <= 'Z' ? key[k] - 'A'
+              : key[k] >= 'a' && key[k] <= 'z' ? key[k] - 'a'
+              : 0;
+        if(decrypt) shift = 26 - shift;
+        buf[i] = base + (c - base + shift) % 26;
+        k = (k + 1) % klen;
+    }
+}
+
+/* text with plenty of letters, the rest any byte but nul */
+static void random_mixed(char *buf, size_t sz) {
+    for(size_t i = 0; i < sz; i++) {
+        uint64_t v = next();
+        buf[i] = v % 4 == 0 ? 1 + (v >> 8) % 255
+               : (v % 4 == 1 ? 'A' : 'a') + (v >> 8) % 26;
+    }
+}
+
+static void check_classical(void) {
+    unsigned before = failures;
+    struct buf a, b;
+    char key[48];
+
+    buf_alloc(&a); buf_alloc(&b);
+    for(unsigned r = 0; r < rounds; r++) {
+        size_t len = random_len(), klen, done;
+        char *x = (char *)buf_shift(&a), *y = (char *)buf_shift(&b);
+        unsigned shift = next() % 1000;
+        struct encro_vigenere v;
+        int decrypt = next() & 1;
+
+        random_mixed(x, len);
+        memcpy(y, x, len);
+        ref_caesar(x, len, shift);
+        encro_caesar_buf(y, len, shift);
+        same(y, x, len, "caesar", len);
+
+        ref_atbash(x, len);
+        encro_atbash_buf(y, len);
+        same(y, x, len, "atbash", len);
+
+        klen = 1 + next() % (sizeof key - 1);
+        random_mixed(key, klen);
+        key[klen] = '\0';
+        ref_vigenere(x, len, key, decrypt);
+        encro_vigenere_init(&v, key, decrypt);
+        for(done = 0; done < len; ) {
+            size_t n = next() % 300;
+            if(n > len - done) n = len - done;
+            encro_vigenere_buf(&v, y + done, n);
+            done += n;
+        }
+        same(y, x, len, decrypt ? "vigenere decrypt in pieces" : "vigenere in pieces", len);
+    }
+    free(a.base); free(b.base);
+    section("classical", before);
+}
+
+/*==============================================================================
+ * RSA
+ *============================================================================*/
+
+/* left to right, where rsa.c goes right to left */
+static uint32_t ref_powmod(uint32_t b, uint32_t e, uint32_t m) {
+    uint64_t c = 1 % m;
+
+    b %= m;
+    for(int bit = 31; bit >= 0; bit--) {
+        c = c*c % m;
+        if(e >> bit & 1) c = c*b % m;
+    }
+    return c;
+}
+
+static void check_rsa(void) {
+    unsigned before = failures;
+    uint8_t in[256], out[256];
+    uint32_t words[256];
+
+    for(unsigned r = 0; r < rounds / 4 + 1; r++) {
+        struct encro_rsa_key key;
+
+        encro_rsa_keygen(&key);
+        for(unsigned i = 0; i < 32; i++) {
+            /* the edges and then anything below n */
+            uint32_t m = i < 3 ? (uint32_t[]){ 0, 1, key.n - 1 }[i] : next() % key.n;
+            uint32_t c = encro_rsa_encrypt(&key, m);
+
+            if(c != ref_powmod(m, key.e, key.n))
+                fail("rsa_encrypt m=%"PRIu32" e=%"PRIu32" n=%"PRIu32": %"PRIu32", want %"PRIu32,
+                     m, key.e, key.n, c, ref_powmod(m, key.e, key.n));
+            if(encro_rsa_decrypt(&key, c) != ref_powmod(c, key.d, key.n))
+                fail("rsa_decrypt c=%"PRIu32" d=%"PRIu32" n=%"PRIu32, c, key.d, key.n);
+            if(encro_rsa_decrypt(&key, c) != m)
+                fail("rsa round trip m=%"PRIu32" e=%"PRIu32" d=%"PRIu32" n=%"PRIu32,
+                     m, key.e, key.d, key.n);
+        }
+
+        random_bytes(in, sizeof in);
+        encro_fake_rsa_encrypt(words, in, sizeof in, &key);
+        for(size_t i = 0; i < sizeof in; i++)
+            if(words[i] != ref_powmod(in[i], key.e, key.n)) {
+                fail("fake_rsa_encrypt byte %zu of n=%"PRIu32, i, key.n);
+                break;
+            }
+        encro_fake_rsa_decrypt(out, words, sizeof in, &key);
+        same(out, in, sizeof in, "fake_rsa round trip", sizeof in);
+    }
+    section("rsa", before);
+}
+
+int main(int argc, char *argv[]) {
+    seed = argc > 1 ? strtoull(argv[1], NULL, 0) : encro_rng_u64();
+    if(argc > 2) rounds = strtoul(argv[2], NULL, 0);
+    state = seed;
+    printf("seed %"PRIu64", %u rounds\n", seed, rounds);
+
+    check_aes();
+    check_chacha20();
+    check_codec();
+    check_classical();
+    check_rsa();
+
+    if(failures) {
+        printf("%u failures, repeat with ./encro-check %"PRIu64" %u\n", failures, seed, rounds);
+        return 1;
+    }
+    printf("PASSED\n");
+    return 0;
+}
@@ -0,0 +1,154 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <cipher.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algo_utils.h>
+
+static const char *names[] = {
+    [CIPHER_CAESAR] = "caesar",
+    [CIPHER_ATBASH] = "atbash",
+    [CIPHER_VIGENERE] = "vigenere",
+    [CIPHER_AES] = "aes",
+    [CIPHER_AES_CTR] = "aes-ctr",
+    [CIPHER_CHACHA20] = "chacha20",
+};
+
+int cipher_algo(const char *name) {
+    for(size_t i = 1; i < sizeof names / sizeof names[0]; i++)
+        if(strcmp(name, names[i]) == 0) return i;
+    return 0;
+}
+
+int cipher_is_binary(unsigned algo) {
+    return algo == CIPHER_AES || algo == CIPHER_AES_CTR || algo == CIPHER_CHACHA20;
+}
+
+ssize_t cipher_parse_key(unsigned algo, const char *s, uint8_t *key, size_t cap) {
+    size_t sz, keysz;
+
+    switch(algo) {
+    case CIPHER_CAESAR:
+        if(cap < 1) return -1;
+        key[0] = strtoul(s, NULL, 10) % 26;
+        return 1;
+    case CIPHER_ATBASH:
+        return 0;
+    case CIPHER_VIGENERE:
+        if((sz = strlen(s)) >= ENCRO_VIGENERE_KEYSZ || sz > cap) return -1;
+        memcpy(key, s, sz);
+        return sz;
+    case CIPHER_AES:
+    case CIPHER_AES_CTR:
+        keysz = ENCRO_AES_KEYLEN;
+        break;
+    case CIPHER_CHACHA20:
+        keysz = ENCRO_CHACHA20_KEYLEN;
+        break;
+    default:
+        return -1;
+    }
+    sz = keysz + cipher_nonce_size(algo);
+    if(sz > cap) return -1;
+    if(strlen(s) == 2*keysz) {
+        if(parse_hex(key, keysz, s) != keysz) return -1;
+        memset(key + keysz, 0, sz - keysz);
+    } else if(parse_hex(key, sz, s) != sz || s[2*sz] != '\0') {
+        return -1;
+    }
+    return sz;
+}
+
+int cipher_key_init(struct cipher_key *k, unsigned algo, const uint8_t *key, size_t sz) {
+    char text[ENCRO_VIGENERE_KEYSZ];
+
+    memset(k, 0, sizeof *k);
+    k->algo = algo;
+    switch(algo) {
+    case CIPHER_CAESAR:
+        if(sz != 1) return -1;
+        k->u.shift = key[0] % 26;
+        return 0;
+    case CIPHER_ATBASH:
+        return sz == 0 ? 0 : -1;
+    case CIPHER_VIGENERE:
+        if(sz >= sizeof text) return -1;
+        memcpy(text, key, sz);
+        text[sz] = '\0';
+        encro_vigenere_init(&k->u.vigenere[0], text, 0);
+        encro_vigenere_init(&k->u.vigenere[1], text, 1);
+        return 0;
+    case CIPHER_AES:
+    case CIPHER_AES_CTR:
+        if(sz != ENCRO_AES_KEYLEN + ENCRO_AES_BLOCKLEN) return -1;
+        encro_aes_init(&k->u.aes, key, key + ENCRO_AES_KEYLEN);
+        return 0;
+    case CIPHER_CHACHA20:
+        if(sz != ENCRO_CHACHA20_KEYLEN + ENCRO_CHACHA20_NONCELEN) return -1;
+        encro_chacha20_init(&k->u.chacha20, key, key + ENCRO_CHACHA20_KEYLEN, 0);
+        return 0;
+    }
+    return -1;
+}
+
+size_t cipher_nonce_size(unsigned algo) {
+    switch(algo) {
+    case CIPHER_AES:
+    case CIPHER_AES_CTR:
+        return ENCRO_AES_BLOCKLEN;
+    case CIPHER_CHACHA20:
+        return ENCRO_CHACHA20_NONCELEN;
+    }
+    return 0;
+}
+
+void cipher_set_nonce(struct cipher_key *k, const uint8_t *nonce) {
+    switch(k->algo) {
+    case CIPHER_AES:
+    case CIPHER_AES_CTR:
+        encro_aes_set_iv(&k->u.aes, nonce);
+        break;
+    case CIPHER_CHACHA20:
+        encro_chacha20_set_nonce(&k->u.chacha20, nonce, 0);
+        break;
+    }
+}
+
+size_t cipher_message(struct cipher_key *k, int decrypt, uint8_t *buf, size_t sz) {
+    switch(k->algo) {
+    case CIPHER_CAESAR:
+        encro_caesar_buf((char *)buf, sz, decrypt ? 26 - k->u.shift : k->u.shift);
+        return sz;
+    case CIPHER_ATBASH:
+        encro_atbash_buf((char *)buf, sz);
+        return sz;
+    case CIPHER_VIGENERE:
+        encro_vigenere_buf(&k->u.vigenere[decrypt != 0], (char *)buf, sz);
+        return sz;
+    case CIPHER_AES:
+        if(decrypt) return encro_aes_cbc_decrypt_padded(&k->u.aes, buf, sz);
+        return encro_aes_cbc_encrypt_padded(&k->u.aes, buf, sz);
+    case CIPHER_AES_CTR:
+        encro_aes_ctr_xcrypt_buf(&k->u.aes, buf, sz);
+        return sz;
+    case CIPHER_CHACHA20:
+        encro_chacha20_xcrypt_buf(&k->u.chacha20, buf, sz);
+        return sz;
+    }
+    return (size_t)-1;
+}
+
+int cipher_seek(struct cipher_key *k, uint64_t off) {
+    switch(k->algo) {
+    case CIPHER_AES_CTR:
+        encro_aes_ctr_seek(&k->u.aes, off);
+        return 0;
+    case CIPHER_CHACHA20:
+        encro_chacha20_seek(&k->u.chacha20, off);
+        return 0;
+    }
+    return -1;
+}
@@ -0,0 +1,349 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <algorithms.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <algo_utils.h>
+#include <alloc.h>
+#include <cipher.h>
+#include <rng.h>
+#include <serve.h>
+
+/* encro client sends stdin to a running encro serve as one request and
+ * writes the reply to stdout, with the iv or nonce the server picked in front
+ * of aes, aes-ctr and chacha20 ciphertext. encro loadgen keeps a number of connections
+ * busy with requests of one size and reports what the server managed */
+
+#define LOADGEN_CONNS   4
+#define LOADGEN_SIZE    4096
+#define LOADGEN_TIME    5.0
+#define LOADGEN_SAMPLES (1<<16)         /* latencies kept per connection */
+
+/* one request and its reply, out needs room for cap bytes
+ * returns the reply status or -1 if the connection broke */
+static int roundtrip(int fd, struct serve_request *req, const void *payload,
+                     void *out, size_t cap, size_t *len) {
+    struct serve_reply rep;
+    struct iovec iov[2] = {
+        { req, sizeof *req },
+        { (void *)payload, req->len },
+    };
+
+    if(serve_write(fd, iov, req->len ? 2 : 1) < 0) return -1;
+    if(serve_read(fd, &rep, sizeof rep) <= 0) return -1;
+    if(rep.len > cap) return -1;
+    if(rep.len && serve_read(fd, out, rep.len) <= 0) return -1;
+    if(len) *len = rep.len;
+    return rep.status;
+}
+
+static int add_key(int fd, int algo, const uint8_t *key, size_t sz, uint64_t *handle) {
+    struct serve_request req = { sz, SERVE_ADD_KEY, algo, 0, 0 };
+    size_t len;
+    int ret = roundtrip(fd, &req, key, handle, sizeof *handle, &len);
+
+    if(ret == SERVE_OK && len != sizeof *handle) return -1;
+    return ret;
+}
+
+static void del_key(int fd, uint64_t handle) {
+    struct serve_request req = { 0, SERVE_DEL_KEY, 0, 0, handle };
+    roundtrip(fd, &req, NULL, NULL, 0, NULL);
+}
+
+/* random key material for the load generator */
+static size_t random_key(int algo, uint8_t *key) {
+    switch(algo) {
+    case CIPHER_CAESAR:
+        key[0] = 1 + encro_rng_uniform(25);
+        return 1;
+    case CIPHER_VIGENERE:
+        for(size_t i = 0; i < 16; i++) key[i] = 'A' + encro_rng_uniform(26);
+        return 16;
+    case CIPHER_AES:
+    case CIPHER_AES_CTR:
+        keygen(key, ENCRO_AES_KEYLEN);
+        memset(key + ENCRO_AES_KEYLEN, 0, ENCRO_AES_BLOCKLEN);
+        return ENCRO_AES_KEYLEN + ENCRO_AES_BLOCKLEN;
+    case CIPHER_CHACHA20:
+        keygen(key, ENCRO_CHACHA20_KEYLEN);
+        memset(key + ENCRO_CHACHA20_KEYLEN, 0, ENCRO_CHACHA20_NONCELEN);
+        return ENCRO_CHACHA20_KEYLEN + ENCRO_CHACHA20_NONCELEN;
+    }
+    return 0;
+}
+
+static int client_usage(void) {
+    fprintf(stderr,
+        "Usage: encro client [options] algorithm [-d] < input > output\n"
+        "\n"
+        "  --socket=path    server socket (default " SERVE_SOCKET ")\n"
+        "  --key=key        key for this run: the shift for caesar, the key for\n"
+        "                   vigenere and the key in hex for aes, aes-ctr and\n"
+        "                   chacha20. their ciphertext starts with the iv or nonce\n"
+        "  --keep           leave the key on the server, prints its handle\n"
+        "  --handle=n       a key left on the server with --keep\n"
+        "  -d               decrypt instead of encrypt\n"
+        "\n"
+        "Algorithms: caesar, vigenere, atbash, aes, aes-ctr, chacha20\n");
+    return EXIT_FAILURE;
+}
+
+int cmd_client(int argc, char *argv[]) {
+    const char *path = SERVE_SOCKET, *keystr = NULL, *name = NULL;
+    struct serve_request req = { 0, SERVE_ENCRYPT, 0, 0, 0 };
+    uint8_t key[CIPHER_KEYSZ], *buf = NULL, *p;
+    size_t sz = 0, cap = 0, len;
+    ssize_t n;
+    int keep = 0, fd, ret = EXIT_FAILURE, status;
+
+    for(int i = 1; i < argc; i++) {
+        if(strncmp(argv[i], "--socket=", 9) == 0)
+            path = argv[i] + 9;
+        else if(strncmp(argv[i], "--key=", 6) == 0)
+            keystr = argv[i] + 6;
+        else if(strcmp(argv[i], "--keep") == 0)
+            keep = 1;
+        else if(strncmp(argv[i], "--handle=", 9) == 0)
+            req.key = strtoull(argv[i] + 9, NULL, 0);
+        else if(strcmp(argv[i], "-d") == 0)
+            req.op = SERVE_DECRYPT;
+        else if(!name && (req.algo = cipher_algo(argv[i])))
+            name = argv[i];
+        else
+            return client_usage();
+    }
+    if(!req.algo || (keystr && req.key) || (req.algo != CIPHER_ATBASH && !keystr && !req.key))
+        return client_usage();
+
+    /* the whole input is one request */
+    do {
+        if(sz == cap) {
+            cap = cap ? cap * 2 : 1<<16;
+            if(cap > SERVE_MAX_PAYLOAD) {
+                fprintf(stderr, "client: input over %d bytes\n", SERVE_MAX_PAYLOAD);
+                goto out;
+            }
+            if(!(p = slab_realloc(buf, cap + CIPHER_NONCESZ + ENCRO_AES_BLOCKLEN))) {
+                fprintf(stderr, "client: out of memory\n");
+                goto out;
+            }
+            buf = p;
+        }
+        if((n = read(STDIN_FILENO, buf + sz, cap - sz)) < 0 && errno != EINTR) {
+            perror("client: read");
+            goto out;
+        }
+        if(n > 0) sz += n;
+    } while(n != 0);
+
+    if((fd = serve_connect(path)) < 0) {
+        fprintf(stderr, "client: %s: %s\n", path, strerror(errno));
+        goto out;
+    }
+    if(keystr) {
+        if((n = cipher_parse_key(req.algo, keystr, key, sizeof key)) < 0) {
+            fprintf(stderr, "client: bad key for %s\n", name);
+            client_usage();
+            goto disconnect;
+        }
+        if((status = add_key(fd, req.algo, key, n, &req.key)) != SERVE_OK) {
+            fprintf(stderr, "client: adding key: %s\n",
+                    status < 0 ? "connection lost" : serve_strerror(status));
+            goto disconnect;
+        }
+        if(keep) fprintf(stderr, "handle: %llu\n", (unsigned long long)req.key);
+    }
+
+    req.len = sz;
+    status = roundtrip(fd, &req, buf, buf, cap + CIPHER_NONCESZ + ENCRO_AES_BLOCKLEN, &len);
+    if(status == SERVE_OK) {
+        fwrite(buf, 1, len, stdout);
+        ret = fflush(stdout) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else {
+        fprintf(stderr, "client: %s\n", status < 0 ? "connection lost" : serve_strerror(status));
+    }
+    if(keystr && !keep && status >= 0) del_key(fd, req.key);
+
+disconnect:
+    close(fd);
+out:
+    slab_free(buf);
+    return ret;
+}
+
+struct loadgen_conn {
+    pthread_t tid;
+    const char *path;
+    int algo;
+    size_t size;
+    double secs;
+    uint64_t requests, errors;
+    double *samples;                    /* seconds per request */
+    size_t nsamples;
+    uint64_t rng;
+};
+
+static void *loadgen_conn(void *arg) {
+    struct loadgen_conn *c = arg;
+    struct serve_request req = { c->size, SERVE_ENCRYPT, c->algo, 0, 0 };
+    uint8_t key[ENCRO_CHACHA20_KEYLEN + ENCRO_CHACHA20_NONCELEN];
+    uint8_t *in = malloc(c->size), *out = malloc(c->size + CIPHER_NONCESZ + ENCRO_AES_BLOCKLEN);
+    size_t want = cipher_nonce_size(c->algo) + (c->algo != CIPHER_AES ? c->size :
+                  (c->size / ENCRO_AES_BLOCKLEN + 1) * ENCRO_AES_BLOCKLEN);
+    size_t len, j;
+    double start, deadline, prev, now;
+    int fd, status;
+
+    if(!in || !out || (fd = serve_connect(c->path)) < 0) {
+        c->errors++;
+        goto out;
+    }
+    random_text((char *)in, c->size);
+    if(c->algo != CIPHER_ATBASH &&
+       add_key(fd, c->algo, key, random_key(c->algo, key), &req.key) != SERVE_OK) {
+        c->errors++;
+        close(fd);
+        goto out;
+    }
+
+    start = prev = time_now();
+    deadline = start + c->secs;
+    do {
+        status = roundtrip(fd, &req, in, out, c->size + CIPHER_NONCESZ + ENCRO_AES_BLOCKLEN, &len);
+        now = time_now();
+        if(status < 0) {
+            c->errors++;
+            break;
+        }
+        if(status != SERVE_OK || len != want) c->errors++;
+        c->requests++;
+        /* a uniform sample of all latencies once the array is full */
+        if(c->nsamples < LOADGEN_SAMPLES) {
+            c->samples[c->nsamples++] = now - prev;
+        } else {
+            c->rng ^= c->rng << 13;
+            c->rng ^= c->rng >> 7;
+            c->rng ^= c->rng << 17;
+            if((j = c->rng % c->requests) < LOADGEN_SAMPLES) c->samples[j] = now - prev;
+        }
+        prev = now;
+    } while(now < deadline);
+    if(req.key) del_key(fd, req.key);
+    close(fd);
+
+out:
+    free(in);
+    free(out);
+    return NULL;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static int loadgen_usage(void) {
+    fprintf(stderr,
+        "Usage: encro loadgen [options]\n"
+        "\n"
+        "  --socket=path    server socket (default " SERVE_SOCKET ")\n"
+        "  --algo=name      algorithm to request (default aes-ctr)\n"
+        "  --conns=n        connections, a thread each (default 4)\n"
+        "  --size=size      payload of every request (default 4k)\n"
+        "  --time=secs      how long to run (default 5)\n"
+        "  --json           print the result as a JSON object\n");
+    return EXIT_FAILURE;
+}
+
+int cmd_loadgen(int argc, char *argv[]) {
+    const char *path = SERVE_SOCKET, *name = "aes-ctr";
+    int algo = CIPHER_AES_CTR, json = 0;
+    unsigned nconns = LOADGEN_CONNS;
+    size_t size = LOADGEN_SIZE, nsamples = 0;
+    double secs = LOADGEN_TIME, elapsed, *samples, p50 = 0, p99 = 0, max = 0;
+    uint64_t requests = 0, errors = 0;
+    struct loadgen_conn *conns;
+
+    for(int i = 1; i < argc; i++) {
+        if(strncmp(argv[i], "--socket=", 9) == 0)
+            path = argv[i] + 9;
+        else if(strncmp(argv[i], "--algo=", 7) == 0)
+            algo = cipher_algo(name = argv[i] + 7);
+        else if(strncmp(argv[i], "--conns=", 8) == 0)
+            nconns = strtoul(argv[i] + 8, NULL, 10);
+        else if(strncmp(argv[i], "--size=", 7) == 0)
+            size = parse_size(argv[i] + 7);
+        else if(strncmp(argv[i], "--time=", 7) == 0)
+            secs = strtod(argv[i] + 7, NULL);
+        else if(strcmp(argv[i], "--json") == 0)
+            json = 1;
+        else
+            return loadgen_usage();
+    }
+    if(!algo || !nconns || !size || size > SERVE_MAX_PAYLOAD - ENCRO_AES_BLOCKLEN || secs <= 0)
+        return loadgen_usage();
+
+    conns = calloc(nconns, sizeof *conns);
+    samples = malloc((size_t)nconns * LOADGEN_SAMPLES * sizeof *samples);
+    if(!conns || !samples) {
+        fprintf(stderr, "loadgen: out of memory\n");
+        return EXIT_FAILURE;
+    }
+    elapsed = time_now();
+    for(unsigned i = 0; i < nconns; i++) {
+        struct loadgen_conn *c = &conns[i];
+        c->path = path;
+        c->algo = algo;
+        c->size = size;
+        c->secs = secs;
+        c->samples = samples + (size_t)i * LOADGEN_SAMPLES;
+        c->rng = 0x9e3779b97f4a7c15ULL + i;
+        if(pthread_create(&c->tid, NULL, loadgen_conn, c) != 0) {
+            fprintf(stderr, "loadgen: could not start connection %u\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+    for(unsigned i = 0; i < nconns; i++) {
+        pthread_join(conns[i].tid, NULL);
+        requests += conns[i].requests;
+        errors += conns[i].errors;
+        /* packs the samples of every connection at the front */
+        memmove(samples + nsamples, conns[i].samples, conns[i].nsamples * sizeof *samples);
+        nsamples += conns[i].nsamples;
+    }
+    elapsed = time_now() - elapsed;
+
+    if(nsamples) {
+        qsort(samples, nsamples, sizeof *samples, compare_double);
+        p50 = samples[nsamples / 2] * 1e6;
+        p99 = samples[nsamples * 99 / 100] * 1e6;
+        max = samples[nsamples - 1] * 1e6;
+    }
+    if(json)
+        printf("{\"algo\":\"%s\",\"size\":%zu,\"conns\":%u,\"requests\":%llu,\"errors\":%llu,"
+               "\"requests_per_s\":%.1f,\"mb_per_s\":%.3f,\"p50_us\":%.3f,\"p99_us\":%.3f,"
+               "\"max_us\":%.3f}\n",
+               name, size, nconns, (unsigned long long)requests, (unsigned long long)errors,
+               requests / elapsed, requests * size / elapsed / 1e6, p50, p99, max);
+    else
+        printf("%llu requests, %llu errors in %.2f s\n"
+               "%.0f requests/s, %.1f MB/s\n"
+               "latency: p50 %.2f us, p99 %.2f us, max %.2f us\n",
+               (unsigned long long)requests, (unsigned long long)errors, elapsed,
+               requests / elapsed, requests * size / elapsed / 1e6, p50, p99, max);
+
+    free(conns);
+    free(samples);
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+REGISTER_COMMAND("client", cmd_client);
+REGISTER_COMMAND("loadgen", cmd_loadgen);
@@ -0,0 +1,373 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <codec.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <perf.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CODEC_X86
+#endif
+
+static const char hex_digits[] = "0123456789ABCDEF";
+static const char base64_digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static int hex_value(char c) {
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static int base64_value(char c) {
+    if(c >= 'A' && c <= 'Z') return c - 'A';
+    if(c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if(c >= '0' && c <= '9') return c - '0' + 52;
+    if(c == '+') return 62;
+    if(c == '/') return 63;
+    return -1;
+}
+
+static int always(void) {
+    return 1;
+}
+
+/* the portable kernel leaves everything to the scalar loops */
+static size_t no_encode(char *out, const uint8_t *in, size_t sz) {
+    (void)out, (void)in, (void)sz;
+    return 0;
+}
+
+static size_t no_decode(uint8_t *out, const char *in, size_t len) {
+    (void)out, (void)in, (void)len;
+    return 0;
+}
+
+static const struct encro_codec_kernel kernel_portable = {
+    .name = "portable",
+    .supported = always,
+    .hex_encode = no_encode,
+    .hex_decode = no_decode,
+    .base64_encode = no_encode,
+    .base64_decode = no_decode,
+};
+
+#ifdef CODEC_X86
+
+static int ssse3_supported(void) {
+    return __builtin_cpu_supports("ssse3");
+}
+
+static int avx2_supported(void) {
+    return __builtin_cpu_supports("avx2");
+}
+
+/* each nibble looked up in a table of the 16 digits */
+__attribute__((target("ssse3")))
+static size_t ssse3_hex_encode(char *out, const uint8_t *in, size_t sz) {
+    const __m128i digits = _mm_loadu_si128((const __m128i *)hex_digits);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    size_t i;
+
+    for(i = 0; i + 16 <= sz; i += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(x, 4), nibble));
+        __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(x, nibble));
+        _mm_storeu_si128((__m128i *)(out + 2*i), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(out + 2*i + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+    return i;
+}
+
+/* the digit values of 16 characters, lanes of *ok set where they are hex */
+__attribute__((target("ssse3")))
+static inline __m128i ssse3_hex_values(__m128i v, __m128i *ok) {
+    __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    __m128i l = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i is_d = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    __m128i is_l = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+
+    *ok = _mm_or_si128(is_d, is_l);
+    return _mm_or_si128(_mm_and_si128(is_d, d),
+                        _mm_and_si128(is_l, _mm_add_epi8(l, _mm_set1_epi8(10))));
+}
+
+/* pairs of digits become hi*16 + lo in one multiply-add */
+__attribute__((target("ssse3")))
+static size_t ssse3_hex_decode(uint8_t *out, const char *in, size_t len) {
+    const __m128i weights = _mm_set1_epi16(0x0110);
+    size_t i;
+
+    for(i = 0; i + 32 <= len; i += 32) {
+        __m128i ok0, ok1;
+        __m128i v0 = ssse3_hex_values(_mm_loadu_si128((const __m128i *)(in + i)), &ok0);
+        __m128i v1 = ssse3_hex_values(_mm_loadu_si128((const __m128i *)(in + i + 16)), &ok1);
+        if(_mm_movemask_epi8(_mm_and_si128(ok0, ok1)) != 0xffff) break;
+        _mm_storeu_si128((__m128i *)(out + i/2),
+                         _mm_packus_epi16(_mm_maddubs_epi16(v0, weights),
+                                          _mm_maddubs_epi16(v1, weights)));
+    }
+    return i;
+}
+
+/* 12 bytes to 16 indices with two multiplies and a table lookup per lane,
+ * after W. Mula and D. Lemire, "Faster Base64 Encoding and Decoding using
+ * AVX2 Instructions" */
+__attribute__((target("ssse3")))
+static size_t ssse3_base64_encode(char *out, const uint8_t *in, size_t sz) {
+    const __m128i shuffle = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+    size_t i, o = 0;
+
+    /* loads 16 bytes for every 12 */
+    for(i = 0; i + 16 <= sz; i += 12, o += 16) {
+        __m128i x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + i)), shuffle);
+        __m128i a = _mm_mulhi_epu16(_mm_and_si128(x, _mm_set1_epi32(0x0fc0fc00)),
+                                    _mm_set1_epi32(0x04000040));
+        __m128i b = _mm_mullo_epi16(_mm_and_si128(x, _mm_set1_epi32(0x003f03f0)),
+                                    _mm_set1_epi32(0x01000010));
+        __m128i idx = _mm_or_si128(a, b);
+        /* 0 for a-z, 1-10 for digits, 11 and 12 for + and /, 13 for A-Z */
+        __m128i r = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+        r = _mm_or_si128(r, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), idx),
+                                          _mm_set1_epi8(13)));
+        _mm_storeu_si128((__m128i *)(out + o), _mm_add_epi8(_mm_shuffle_epi8(offsets, r), idx));
+    }
+    return i;
+}
+
+/* the character's high nibble picks the offset to its value and, with the
+ * low nibble, whether it is base64 at all */
+__attribute__((target("ssse3")))
+static size_t ssse3_base64_decode(uint8_t *out, const char *in, size_t len) {
+    const __m128i shifts = _mm_setr_epi8(0, 0, 19, 4, -65, -65, -71, -71,
+                                         0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i masks = _mm_setr_epi8(0xa8, 0xf8, 0xf8, 0xf8, 0xf8, 0xf8, 0xf8, 0xf8,
+                                        0xf8, 0xf8, 0xf0, 0x54, 0x50, 0x50, 0x50, 0x54);
+    const __m128i bits = _mm_setr_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+                                       0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    size_t i, o = 0;
+
+    /* stores 16 bytes for every 12 */
+    for(i = 0; i + 24 <= len; i += 16, o += 12) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i hi = _mm_and_si128(_mm_srli_epi32(v, 4), nibble);
+        __m128i lo = _mm_and_si128(v, nibble);
+        __m128i slash = _mm_cmpeq_epi8(v, _mm_set1_epi8('/'));
+        __m128i shift = _mm_or_si128(_mm_and_si128(slash, _mm_set1_epi8(16)),
+                                     _mm_andnot_si128(slash, _mm_shuffle_epi8(shifts, hi)));
+        __m128i bad = _mm_cmpeq_epi8(_mm_and_si128(_mm_shuffle_epi8(masks, lo),
+                                                   _mm_shuffle_epi8(bits, hi)),
+                                     _mm_setzero_si128());
+        if(_mm_movemask_epi8(bad)) break;
+        v = _mm_add_epi8(v, shift);
+        /* four 6 bit values to 24 bits in each 32 bit lane */
+        v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+        v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+        _mm_storeu_si128((__m128i *)(out + o), _mm_shuffle_epi8(v, pack));
+    }
+    return i;
+}
+
+static const struct encro_codec_kernel kernel_ssse3 = {
+    .name = "ssse3",
+    .supported = ssse3_supported,
+    .hex_encode = ssse3_hex_encode,
+    .hex_decode = ssse3_hex_decode,
+    .base64_encode = ssse3_base64_encode,
+    .base64_decode = ssse3_base64_decode,
+};
+
+/* the SSSE3 code on both lanes, the unpacks and packs work within a lane
+ * so the halves are put back in order at the end */
+__attribute__((target("avx2")))
+static size_t avx2_hex_encode(char *out, const uint8_t *in, size_t sz) {
+    const __m256i digits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)hex_digits));
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    size_t i;
+
+    for(i = 0; i + 32 <= sz; i += 32) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(in + i));
+        __m256i hi = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble));
+        __m256i lo = _mm256_shuffle_epi8(digits, _mm256_and_si256(x, nibble));
+        __m256i a = _mm256_unpacklo_epi8(hi, lo), b = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i *)(out + 2*i), _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i *)(out + 2*i + 32), _mm256_permute2x128_si256(a, b, 0x31));
+    }
+    return i + ssse3_hex_encode(out + 2*i, in + i, sz - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_hex_values(__m256i v, __m256i *ok) {
+    __m256i d = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+    __m256i l = _mm256_sub_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    __m256i is_d = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+    __m256i is_l = _mm256_cmpeq_epi8(_mm256_min_epu8(l, _mm256_set1_epi8(5)), l);
+
+    *ok = _mm256_or_si256(is_d, is_l);
+    return _mm256_or_si256(_mm256_and_si256(is_d, d),
+                           _mm256_and_si256(is_l, _mm256_add_epi8(l, _mm256_set1_epi8(10))));
+}
+
+__attribute__((target("avx2")))
+static size_t avx2_hex_decode(uint8_t *out, const char *in, size_t len) {
+    const __m256i weights = _mm256_set1_epi16(0x0110);
+    size_t i;
+
+    for(i = 0; i + 64 <= len; i += 64) {
+        __m256i ok0, ok1;
+        __m256i v0 = avx2_hex_values(_mm256_loadu_si256((const __m256i *)(in + i)), &ok0);
+        __m256i v1 = avx2_hex_values(_mm256_loadu_si256((const __m256i *)(in + i + 32)), &ok1);
+        if((unsigned)_mm256_movemask_epi8(_mm256_and_si256(ok0, ok1)) != 0xffffffff) break;
+        _mm256_storeu_si256((__m256i *)(out + i/2),
+                            _mm256_permute4x64_epi64(
+                                _mm256_packus_epi16(_mm256_maddubs_epi16(v0, weights),
+                                                    _mm256_maddubs_epi16(v1, weights)),
+                                0xd8));
+    }
+    return i + ssse3_hex_decode(out + i/2, in + i, len - i);
+}
+
+/* base64 stays on the SSSE3 code, the AVX2 version needs lane crossing
+ * loads and gains little at the sizes ciphertext comes in */
+static const struct encro_codec_kernel kernel_avx2 = {
+    .name = "avx2",
+    .supported = avx2_supported,
+    .hex_encode = avx2_hex_encode,
+    .hex_decode = avx2_hex_decode,
+    .base64_encode = ssse3_base64_encode,
+    .base64_decode = ssse3_base64_decode,
+};
+
+#endif
+
+/* fastest first */
+static const struct encro_codec_kernel *kernels[] = {
+#ifdef CODEC_X86
+    &kernel_avx2,
+    &kernel_ssse3,
+#endif
+    &kernel_portable,
+};
+
+static const struct encro_codec_kernel *kernel;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void kernel_init(void) {
+    kernel = encro_codec_default_kernel();
+}
+
+const struct encro_codec_kernel *encro_codec_find_kernel(const char *name) {
+    for(size_t i = 0; i < sizeof kernels / sizeof kernels[0]; i++)
+        if(strcmp(kernels[i]->name, name) == 0 && kernels[i]->supported())
+            return kernels[i];
+    return NULL;
+}
+
+const struct encro_codec_kernel *encro_codec_default_kernel(void) {
+    const char *name = getenv("ENCRO_CODEC");
+    const struct encro_codec_kernel *k = name ? encro_codec_find_kernel(name) : NULL;
+
+    for(size_t i = 0; !k; i++)
+        if(kernels[i]->supported()) k = kernels[i];
+    return k;
+}
+
+size_t encro_hex_encode(char *out, const uint8_t *in, size_t sz) {
+    size_t i;
+
+    pthread_once(&kernel_once, kernel_init);
+    PERF_BEGIN(PERF_FORMAT);
+    for(i = kernel->hex_encode(out, in, sz); i < sz; i++) {
+        out[2*i] = hex_digits[in[i] >> 4];
+        out[2*i+1] = hex_digits[in[i] & 0xf];
+    }
+    PERF_END(PERF_FORMAT);
+    return ENCRO_HEX_LEN(sz);
+}
+
+size_t encro_hex_decode(uint8_t *out, const char *in, size_t len) {
+    size_t i;
+    int hi, lo;
+
+    pthread_once(&kernel_once, kernel_init);
+    PERF_BEGIN(PERF_FORMAT);
+    for(i = kernel->hex_decode(out, in, len); i + 2 <= len; i += 2) {
+        if((hi = hex_value(in[i])) < 0 || (lo = hex_value(in[i+1])) < 0) break;
+        out[i/2] = hi<<4 | lo;
+    }
+    PERF_END(PERF_FORMAT);
+    return i/2;
+}
+
+size_t encro_base64_encode(char *out, const uint8_t *in, size_t sz) {
+    size_t i, o;
+
+    pthread_once(&kernel_once, kernel_init);
+    PERF_BEGIN(PERF_FORMAT);
+    i = kernel->base64_encode(out, in, sz);
+    for(o = i/3*4; i + 3 <= sz; i += 3, o += 4) {
+        uint32_t w = (uint32_t)in[i] << 16 | in[i+1] << 8 | in[i+2];
+        out[o] = base64_digits[w >> 18];
+        out[o+1] = base64_digits[w >> 12 & 0x3f];
+        out[o+2] = base64_digits[w >> 6 & 0x3f];
+        out[o+3] = base64_digits[w & 0x3f];
+    }
+    if(i < sz) {
+        uint32_t w = (uint32_t)in[i] << 16 | (i + 1 < sz ? in[i+1] << 8 : 0);
+        out[o] = base64_digits[w >> 18];
+        out[o+1] = base64_digits[w >> 12 & 0x3f];
+        out[o+2] = i + 1 < sz ? base64_digits[w >> 6 & 0x3f] : '=';
+        out[o+3] = '=';
+    }
+    PERF_END(PERF_FORMAT);
+    return ENCRO_BASE64_LEN(sz);
+}
+
+static size_t base64_decode_rest(uint8_t *out, const char *in, size_t len) {
+    size_t i, o;
+    uint32_t w = 0;
+    int n = 0, v;
+
+    i = kernel->base64_decode(out, in, len);
+    /* padding only at the very end */
+    while(len > i && in[len-1] == '=' && len % 4 != 1) len--;
+    for(o = i/4*3; i < len; i++) {
+        if((v = base64_value(in[i])) < 0) return (size_t)-1;
+        w = w << 6 | v;
+        if(++n == 4) {
+            out[o++] = w >> 16;
+            out[o++] = w >> 8;
+            out[o++] = w;
+            w = 0;
+            n = 0;
+        }
+    }
+    /* a single character left over is half a byte */
+    if(n == 1) return (size_t)-1;
+    if(n == 2) out[o++] = w >> 4;
+    if(n == 3) {
+        out[o++] = w >> 10;
+        out[o++] = w >> 2;
+    }
+    return o;
+}
+
+size_t encro_base64_decode(uint8_t *out, const char *in, size_t len) {
+    size_t n;
+
+    pthread_once(&kernel_once, kernel_init);
+    PERF_BEGIN(PERF_FORMAT);
+    n = base64_decode_rest(out, in, len);
+    PERF_END(PERF_FORMAT);
+    return n;
+}
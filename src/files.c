@@ -0,0 +1,577 @@
+#define _GNU_SOURCE                     /* O_DIRECT */
+
+#include <algorithms.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+
+#include <algo_utils.h>
+#include <cipher.h>
+#include <perf.h>
+#include <rng.h>
+#include <uring.h>
+
+/* encro files encrypts whole files with aes-ctr or chacha20, each file a
+ * message of its own as in cipher.h. every .enc starts with a header of one
+ * O_DIRECT block holding a random iv or nonce for that file, -d reads it back
+ * from there. the files are cut into chunks that are read, encrypted and
+ * written independently, a chunk knows its offset so the keystream can be
+ * moved there with cipher_seek.
+ *
+ * with io_uring the main thread does all the I/O: it keeps a read in flight
+ * for every free chunk buffer, hands what was read to the worker threads and
+ * writes what they give back. the buffers are registered with the ring once
+ * so the kernel doesn't map them again for every read and write, and the
+ * workers wake the main thread with an eventfd it polls through the ring.
+ * without io_uring every worker reads, encrypts and writes a chunk of its
+ * own with pread and pwrite. */
+
+#define FILES_CHUNK (1<<20)
+#define FILES_DEPTH 16
+/* O_DIRECT wants offsets, sizes and buffers aligned to the logical block
+ * size, 4096 is enough for every device */
+#define FILES_ALIGN 4096
+#define ALIGN_UP(n) (((n) + FILES_ALIGN - 1) & ~(uint64_t)(FILES_ALIGN - 1))
+
+/* the header: magic, the algorithm, the iv or nonce at FILES_NONCE and zeros
+ * up to a whole block so the data after it stays aligned. a file without it
+ * fails -d with EBADMSG */
+#define FILES_MAGIC  "encrof01"
+#define FILES_NONCE  16
+#define FILES_HEADER FILES_ALIGN
+
+enum { FILE_WAITING, FILE_OPEN, FILE_CLOSED };
+
+struct file {
+    const char *in;
+    char *out;
+    int fd_in, fd_out;
+    int state, direct, failed;
+    uint64_t size, next;                /* next is where the next chunk starts */
+    uint64_t in_off, out_off;           /* where the data starts, after the header */
+    unsigned busy;                      /* chunks read but not yet written */
+    struct cipher_key key;              /* with the iv or nonce of this file */
+};
+
+struct chunk {
+    struct file *f;
+    uint64_t off;
+    size_t len, done;                   /* bytes of the file, and read or written so far */
+    int writing;
+    uint8_t *buf;
+    struct iovec iov;                   /* for READV and WRITEV without registered buffers */
+    unsigned index;                     /* registered buffer */
+    struct chunk *next;                 /* on the free, work or crypted list */
+};
+
+struct files {
+    struct file *files;
+    unsigned nfiles, cur;               /* cur is the file chunks are cut from */
+    const struct cipher_key *key;
+    int decrypt, direct;
+    size_t chunk;
+    int failed;
+    /* the lists between the I/O thread and the workers */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct chunk *work, *crypted;
+    int efd, quit;
+};
+
+static size_t io_len(const struct chunk *c) {
+    return c->f->direct ? ALIGN_UP(c->len) : c->len;
+}
+
+static ssize_t pread_full(int fd, uint8_t *buf, size_t sz, size_t want, off_t off) {
+    size_t done = 0;
+    ssize_t n = 0;
+
+    PERF_BEGIN(PERF_IO);
+    while(done < want) {
+        if((n = pread(fd, buf + done, sz - done, off + done)) < 0) {
+            if(errno == EINTR) continue;
+            break;
+        }
+        if(n == 0) {
+            errno = EIO;
+            n = -1;
+            break;
+        }
+        done += n;
+    }
+    PERF_END(PERF_IO);
+    return n < 0 ? -1 : (ssize_t)done;
+}
+
+static ssize_t pwrite_full(int fd, const uint8_t *buf, size_t sz, off_t off) {
+    size_t done = 0;
+    ssize_t n = 0;
+
+    PERF_BEGIN(PERF_IO);
+    while(done < sz) {
+        if((n = pwrite(fd, buf + done, sz - done, off + done)) < 0) {
+            if(errno == EINTR) continue;
+            break;
+        }
+        done += n;
+    }
+    PERF_END(PERF_IO);
+    return n < 0 ? -1 : (ssize_t)done;
+}
+
+static void file_error(struct files *fs, struct file *f, const char *path, int err) {
+    if(!f->failed) fprintf(stderr, "files: %s: %s\n", path, strerror(err));
+    f->failed = 1;
+    fs->failed = 1;
+}
+
+/* writes the header of a new file or checks the one read, and sets the key
+ * of the file from it. returns 0 or an errno */
+static int file_header(struct files *fs, struct file *f) {
+    size_t ns = cipher_nonce_size(fs->key->algo);
+    uint8_t *hdr;
+    void *buf;
+    int err = 0;
+
+    if(posix_memalign(&buf, FILES_ALIGN, FILES_HEADER) != 0) return ENOMEM;
+    hdr = buf;
+    if(!fs->decrypt) {
+        memset(hdr, 0, FILES_HEADER);
+        memcpy(hdr, FILES_MAGIC, 8);
+        hdr[8] = fs->key->algo;
+        encro_rng_bytes(hdr + FILES_NONCE, ns);
+        if(pwrite_full(f->fd_out, hdr, FILES_HEADER, 0) < 0) err = errno;
+        f->out_off = FILES_HEADER;
+    } else if(f->size < FILES_HEADER || pread_full(f->fd_in, hdr, FILES_HEADER, FILES_HEADER, 0) < 0) {
+        err = f->size < FILES_HEADER ? EBADMSG : errno;
+    } else if(memcmp(hdr, FILES_MAGIC, 8) != 0 || hdr[8] != fs->key->algo) {
+        err = EBADMSG;
+    } else {
+        f->in_off = FILES_HEADER;
+        f->size -= FILES_HEADER;
+    }
+    if(!err) {
+        f->key = *fs->key;
+        cipher_set_nonce(&f->key, hdr + FILES_NONCE);
+    }
+    free(buf);
+    return err;
+}
+
+static void file_open(struct files *fs, struct file *f) {
+    int direct = fs->direct ? O_DIRECT : 0, err;
+    struct stat st;
+
+    f->state = FILE_OPEN;
+    f->fd_out = -1;
+    if((f->fd_in = open(f->in, O_RDONLY | direct)) < 0 && errno == EINVAL && direct) {
+        /* tmpfs and some network file systems can't do O_DIRECT */
+        direct = 0;
+        f->fd_in = open(f->in, O_RDONLY);
+    }
+    if(f->fd_in < 0 || fstat(f->fd_in, &st) < 0) {
+        file_error(fs, f, f->in, errno);
+        return;
+    }
+    f->size = st.st_size;
+    if((f->fd_out = open(f->out, O_WRONLY | O_CREAT | O_TRUNC | direct, 0666)) < 0 &&
+       errno == EINVAL && direct) {
+        close(f->fd_in);
+        f->fd_in = open(f->in, O_RDONLY);
+        direct = 0;
+        f->fd_out = open(f->out, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    }
+    if(f->fd_in < 0) file_error(fs, f, f->in, errno);
+    else if(f->fd_out < 0) file_error(fs, f, f->out, errno);
+    else if((err = file_header(fs, f)) != 0)
+        file_error(fs, f, fs->decrypt ? f->in : f->out, err);
+    f->direct = direct != 0;
+}
+
+static void file_close(struct files *fs, struct file *f) {
+    /* O_DIRECT wrote the last chunk out to a whole block */
+    if(!f->failed && f->direct && ftruncate(f->fd_out, f->out_off + f->size) < 0)
+        file_error(fs, f, f->out, errno);
+    if(f->fd_in >= 0) close(f->fd_in);
+    if(f->fd_out >= 0 && close(f->fd_out) < 0) file_error(fs, f, f->out, errno);
+    if(f->failed && f->fd_out >= 0) unlink(f->out);
+    f->state = FILE_CLOSED;
+}
+
+/* cuts the next chunk off the current file, opening and closing files on the
+ * way, returns 0 when there is nothing left */
+static int next_chunk(struct files *fs, struct chunk *c) {
+    for(; fs->cur < fs->nfiles; fs->cur++) {
+        struct file *f = &fs->files[fs->cur];
+
+        if(f->state == FILE_WAITING) file_open(fs, f);
+        if(f->failed || f->next >= f->size) {
+            if(f->state == FILE_OPEN && f->busy == 0) file_close(fs, f);
+            continue;
+        }
+        c->f = f;
+        c->off = f->next;
+        c->len = f->size - f->next < fs->chunk ? f->size - f->next : fs->chunk;
+        c->done = 0;
+        c->writing = 0;
+        f->next += c->len;
+        f->busy++;
+        return 1;
+    }
+    return 0;
+}
+
+/* err is 0 or an errno */
+static void chunk_finish(struct files *fs, struct chunk *c, int err) {
+    struct file *f = c->f;
+
+    if(err) file_error(fs, f, c->writing ? f->out : f->in, err);
+    /* the file is closed by whoever is last, the cutting or the writing */
+    if(--f->busy == 0 && (f->failed || f->next >= f->size) && f->state == FILE_OPEN)
+        file_close(fs, f);
+}
+
+static void chunk_crypt(const struct files *fs, struct chunk *c) {
+    struct cipher_key k = c->f->key;
+
+    cipher_seek(&k, c->off);
+    cipher_message(&k, fs->decrypt, c->buf, c->len);
+    /* what O_DIRECT writes past the end is cut off again, but it shouldn't
+     * be whatever the buffer held before */
+    memset(c->buf + c->len, 0, io_len(c) - c->len);
+}
+
+static void *files_worker(void *arg) {
+    struct files *fs = arg;
+    struct chunk *c;
+    uint64_t one = 1;
+
+    pthread_mutex_lock(&fs->lock);
+    for(;;) {
+        while(!fs->work && !fs->quit) pthread_cond_wait(&fs->cond, &fs->lock);
+        if(fs->quit) break;
+        c = fs->work;
+        fs->work = c->next;
+        pthread_mutex_unlock(&fs->lock);
+
+        chunk_crypt(fs, c);
+
+        pthread_mutex_lock(&fs->lock);
+        c->next = fs->crypted;
+        fs->crypted = c;
+        if(write(fs->efd, &one, sizeof one) < 0) perror("files: eventfd");
+    }
+    pthread_mutex_unlock(&fs->lock);
+    return NULL;
+}
+
+static void submit_io(struct uring *r, struct chunk *c, int registered) {
+    /* never NULL, the ring has an entry for every chunk and the eventfd */
+    struct io_uring_sqe *sqe = uring_sqe(r);
+    size_t len = io_len(c) - c->done;
+
+    if(registered) {
+        sqe->opcode = c->writing ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->addr = (uintptr_t)(c->buf + c->done);
+        sqe->len = len;
+        sqe->buf_index = c->index;
+    } else {
+        sqe->opcode = c->writing ? IORING_OP_WRITEV : IORING_OP_READV;
+        c->iov.iov_base = c->buf + c->done;
+        c->iov.iov_len = len;
+        sqe->addr = (uintptr_t)&c->iov;
+        sqe->len = 1;
+    }
+    sqe->fd = c->writing ? c->f->fd_out : c->f->fd_in;
+    sqe->off = (c->writing ? c->f->out_off : c->f->in_off) + c->off + c->done;
+    sqe->user_data = (uintptr_t)c;
+}
+
+static void submit_poll(struct uring *r, int efd) {
+    struct io_uring_sqe *sqe = uring_sqe(r);
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = efd;
+    sqe->poll_events = POLLIN;
+    sqe->user_data = 0;
+}
+
+/* returns -1 if io_uring can't be used, before anything is read */
+static int run_uring(struct files *fs, unsigned depth, unsigned nthreads) {
+    struct uring r;
+    struct chunk *chunks, *free_list = NULL, *c;
+    struct iovec *iov;
+    pthread_t *tids;
+    unsigned started = 0, busy = 0;
+    int registered, ret = -1;
+
+    if(uring_init(&r, depth + 1) < 0) return -1;
+    chunks = calloc(depth, sizeof *chunks);
+    iov = calloc(depth, sizeof *iov);
+    tids = calloc(nthreads, sizeof *tids);
+    if(!chunks || !iov || !tids) goto out;
+    for(unsigned i = 0; i < depth; i++) {
+        void *buf;
+        if(posix_memalign(&buf, FILES_ALIGN, fs->chunk) != 0) goto out;
+        chunks[i].buf = buf;
+        chunks[i].index = i;
+        chunks[i].next = free_list;
+        free_list = &chunks[i];
+        iov[i].iov_base = buf;
+        iov[i].iov_len = fs->chunk;
+    }
+    /* fails on kernels that count it against a small RLIMIT_MEMLOCK */
+    registered = uring_register_buffers(&r, iov, depth) == 0;
+    if((fs->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) goto out;
+    for(; started < nthreads; started++)
+        if(pthread_create(&tids[started], NULL, files_worker, fs) != 0) break;
+    if(!started) goto out;
+    ret = 0;
+
+    submit_poll(&r, fs->efd);
+    for(;;) {
+        struct io_uring_cqe *cqe;
+        struct chunk *crypted;
+
+        while(free_list && next_chunk(fs, free_list)) {
+            c = free_list;
+            free_list = c->next;
+            submit_io(&r, c, registered);
+            busy++;
+        }
+        pthread_mutex_lock(&fs->lock);
+        crypted = fs->crypted;
+        fs->crypted = NULL;
+        pthread_mutex_unlock(&fs->lock);
+        while((c = crypted)) {
+            crypted = c->next;
+            c->writing = 1;
+            c->done = 0;
+            submit_io(&r, c, registered);
+        }
+        if(busy == 0) break;
+
+        if(uring_enter(&r, 1) < 0) {
+            perror("files: io_uring_enter");
+            fs->failed = 1;
+            break;
+        }
+        while((cqe = uring_cqe(&r))) {
+            int res = cqe->res;
+            c = (struct chunk *)(uintptr_t)cqe->user_data;
+            uring_cqe_seen(&r);
+
+            if(!c) {
+                uint64_t n;
+                if(read(fs->efd, &n, sizeof n) < 0 && errno != EAGAIN) perror("files: eventfd");
+                submit_poll(&r, fs->efd);
+                continue;
+            }
+            if(res == -EINTR || res == -EAGAIN) {
+                submit_io(&r, c, registered);
+                continue;
+            }
+            if(res > 0) c->done += res;
+            if(res > 0 && c->done < (c->writing ? io_len(c) : c->len)) {
+                submit_io(&r, c, registered);
+                continue;
+            }
+            if(res <= 0 || c->writing) {
+                /* a read of nothing means the file got shorter */
+                chunk_finish(fs, c, res < 0 ? -res : res == 0 ? EIO : 0);
+                c->next = free_list;
+                free_list = c;
+                busy--;
+                continue;
+            }
+            pthread_mutex_lock(&fs->lock);
+            c->next = fs->work;
+            fs->work = c;
+            pthread_cond_signal(&fs->cond);
+            pthread_mutex_unlock(&fs->lock);
+        }
+    }
+
+out:
+    pthread_mutex_lock(&fs->lock);
+    fs->quit = 1;
+    pthread_cond_broadcast(&fs->cond);
+    pthread_mutex_unlock(&fs->lock);
+    for(unsigned i = 0; i < started; i++) pthread_join(tids[i], NULL);
+    if(fs->efd >= 0) close(fs->efd);
+    uring_free(&r);
+    for(unsigned i = 0; chunks && i < depth; i++) free(chunks[i].buf);
+    free(chunks);
+    free(iov);
+    free(tids);
+    return ret;
+}
+
+static void *pool_worker(void *arg) {
+    struct files *fs = arg;
+    struct chunk c = { 0 };
+    void *buf;
+
+    pthread_mutex_lock(&fs->lock);
+    if(posix_memalign(&buf, FILES_ALIGN, fs->chunk) != 0) {
+        fprintf(stderr, "files: out of memory\n");
+        fs->failed = 1;
+        pthread_mutex_unlock(&fs->lock);
+        return NULL;
+    }
+    c.buf = buf;
+    while(next_chunk(fs, &c)) {
+        int err = 0;
+        pthread_mutex_unlock(&fs->lock);
+
+        if(pread_full(c.f->fd_in, c.buf, io_len(&c), c.len, c.f->in_off + c.off) < 0) {
+            err = errno;
+        } else {
+            chunk_crypt(fs, &c);
+            c.writing = 1;
+            if(pwrite_full(c.f->fd_out, c.buf, io_len(&c), c.f->out_off + c.off) < 0) err = errno;
+        }
+
+        pthread_mutex_lock(&fs->lock);
+        chunk_finish(fs, &c, err);
+    }
+    pthread_mutex_unlock(&fs->lock);
+    free(buf);
+    return NULL;
+}
+
+static void run_pool(struct files *fs, unsigned nthreads) {
+    pthread_t *tids = calloc(nthreads, sizeof *tids);
+    unsigned started = 0;
+
+    if(tids)
+        for(; started < nthreads; started++)
+            if(pthread_create(&tids[started], NULL, pool_worker, fs) != 0) break;
+    /* no threads at all still gets the work done */
+    if(!started) pool_worker(fs);
+    for(unsigned i = 0; i < started; i++) pthread_join(tids[i], NULL);
+    free(tids);
+}
+
+/* name.enc when encrypting, name without .enc or name.dec when decrypting,
+ * in dir if there is one */
+static char *output_name(const char *in, const char *dir, int decrypt) {
+    const char *base = dir && strrchr(in, '/') ? strrchr(in, '/') + 1 : in;
+    size_t len = strlen(base), dlen = dir ? strlen(dir) + 1 : 0;
+    char *out = malloc(dlen + len + 5);
+
+    if(!out) return NULL;
+    if(dir) sprintf(out, "%s/", dir);
+    if(decrypt && len > 4 && strcmp(base + len - 4, ".enc") == 0)
+        sprintf(out + dlen, "%.*s", (int)(len - 4), base);
+    else
+        sprintf(out + dlen, "%s%s", base, decrypt ? ".dec" : ".enc");
+    return out;
+}
+
+static int files_usage(void) {
+    fprintf(stderr,
+        "Usage: encro files [options] algorithm [-d] file...\n"
+        "\n"
+        "  --key=key        the key in hex. every file.enc starts with a random iv\n"
+        "                   or nonce of its own\n"
+        "  --out=dir        write the results to dir, otherwise next to the\n"
+        "                   files as file.enc, or without .enc when decrypting\n"
+        "  --direct         O_DIRECT, past the page cache\n"
+        "  --chunk=size     bytes per read and write (default 1M)\n"
+        "  --depth=n        chunks in flight (default 16)\n"
+        "  --threads=n      threads encrypting (default all cpus)\n"
+        "  --pread          pread and pwrite from every thread, not io_uring\n"
+        "  -d               decrypt instead of encrypt\n"
+        "\n"
+        "Algorithms: aes-ctr, chacha20\n");
+    return EXIT_FAILURE;
+}
+
+int cmd_files(int argc, char *argv[]) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned nthreads = ncpu > 0 ? ncpu : 1, depth = FILES_DEPTH, algo = 0;
+    const char *keystr = NULL, *dir = NULL, *name = NULL;
+    struct files fs = { .chunk = FILES_CHUNK, .efd = -1 };
+    struct cipher_key key, probe;
+    uint8_t material[CIPHER_KEYSZ];
+    int use_uring = 1, ret = EXIT_FAILURE, i;
+    ssize_t n;
+
+    for(i = 1; i < argc && !(algo && argv[i][0] != '-'); i++) {
+        if(strncmp(argv[i], "--key=", 6) == 0)
+            keystr = argv[i] + 6;
+        else if(strncmp(argv[i], "--out=", 6) == 0)
+            dir = argv[i] + 6;
+        else if(strcmp(argv[i], "--direct") == 0)
+            fs.direct = 1;
+        else if(strncmp(argv[i], "--chunk=", 8) == 0)
+            fs.chunk = ALIGN_UP(parse_size(argv[i] + 8));
+        else if(strncmp(argv[i], "--depth=", 8) == 0)
+            depth = strtoul(argv[i] + 8, NULL, 10);
+        else if(strncmp(argv[i], "--threads=", 10) == 0)
+            nthreads = strtoul(argv[i] + 10, NULL, 10);
+        else if(strcmp(argv[i], "--pread") == 0)
+            use_uring = 0;
+        else if(strcmp(argv[i], "-d") == 0)
+            fs.decrypt = 1;
+        else if(!algo && argv[i][0] != '-')
+            algo = cipher_algo(name = argv[i]);
+        else
+            return files_usage();
+    }
+    if(!algo || !keystr || i == argc || !fs.chunk || !depth || !nthreads) return files_usage();
+    if((n = cipher_parse_key(algo, keystr, material, sizeof material)) < 0 ||
+       cipher_key_init(&key, algo, material, n) < 0) {
+        fprintf(stderr, "files: bad key\n");
+        return files_usage();
+    }
+    probe = key;
+    if(cipher_seek(&probe, 0) < 0) {
+        fprintf(stderr, "files: %s can't be split into chunks\n", name);
+        return files_usage();
+    }
+    fs.key = &key;
+
+    fs.nfiles = argc - i;
+    if(!(fs.files = calloc(fs.nfiles, sizeof *fs.files))) {
+        fprintf(stderr, "files: out of memory\n");
+        return ret;
+    }
+    for(unsigned j = 0; j < fs.nfiles; j++) {
+        fs.files[j].in = argv[i + j];
+        if(!(fs.files[j].out = output_name(argv[i + j], dir, fs.decrypt))) {
+            fprintf(stderr, "files: out of memory\n");
+            goto out;
+        }
+    }
+    pthread_mutex_init(&fs.lock, NULL);
+    pthread_cond_init(&fs.cond, NULL);
+
+    if(!use_uring || run_uring(&fs, depth, nthreads) < 0) run_pool(&fs, nthreads);
+    /* files the cutting never got to when the I/O gave up */
+    for(unsigned j = 0; j < fs.nfiles; j++)
+        if(fs.files[j].state == FILE_OPEN) {
+            fs.files[j].failed = 1;
+            file_close(&fs, &fs.files[j]);
+        }
+    if(!fs.failed) ret = EXIT_SUCCESS;
+
+    pthread_cond_destroy(&fs.cond);
+    pthread_mutex_destroy(&fs.lock);
+out:
+    for(unsigned j = 0; j < fs.nfiles; j++) free(fs.files[j].out);
+    free(fs.files);
+    return ret;
+}
+
+REGISTER_COMMAND("files", cmd_files);
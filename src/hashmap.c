@@ -2,11 +2,28 @@
 // Use of this source code is governed by an MIT-style
 // license that can be found in the LICENSE file.
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
+#include <errno.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef HASHMAP_STATS
+#include <time.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __x86_64__
+#include <wmmintrin.h>
+#endif
 #include "hashmap.h"
 
 static void *(*_malloc)(size_t) = NULL;
@@ -32,7 +49,8 @@ struct bucket {
     uint64_t dib:16;
 };
 
-// hashmap is an open addressed hash map using robinhood hashing.
+// hashmap is an open addressed hash map using robinhood hashing, or the
+// swiss table layout when ctrl is set (see hashmap_new_swiss).
 struct hashmap {
     void *(*malloc)(size_t);
     void *(*realloc)(void *, size_t);
@@ -55,8 +73,34 @@ struct hashmap {
     void *buckets;
     void *spare;
     void *edata;
+    uint8_t *ctrl;
+    size_t deleted;
+    bool incremental;
+    void *old;                  // buckets still being migrated, or NULL
+    size_t old_nbuckets;
+    size_t old_mask;
+    size_t old_start;           // the bucket after an empty one
+    size_t old_moved;           // buckets migrated from old_start on
+    void *mapped;               // snapshot the buckets live in, read-only
+    size_t mapped_len;
+#ifdef HASHMAP_STATS
+    uint64_t resizes;
+    uint64_t resize_ns;
+    uint64_t hits;
+    uint64_t misses;
+#endif
 };
 
+// Counters are bumped with relaxed atomics because the sharded map lets
+// several readers into hashmap_get at once. Every lookup then writes the same
+// cache line, which is why they are left out unless asked for.
+#ifdef HASHMAP_STATS
+#define stat_add(_map_, _field_, _n_) \
+    __atomic_fetch_add(&(_map_)->_field_, (_n_), __ATOMIC_RELAXED)
+#else
+#define stat_add(_map_, _field_, _n_) ((void)0)
+#endif
+
 static struct bucket *bucket_at(struct hashmap *map, size_t index) {
     return (struct bucket*)(((char*)map->buckets)+(map->bucketsz*index));
 }
@@ -65,8 +109,8 @@ static void *bucket_item(struct bucket *entry) {
     return ((char*)entry)+sizeof(struct bucket);
 }
 
-static uint64_t get_hash(struct hashmap *map, const void *key) {
-    return map->hash(key, map->seed0, map->seed1) << 16 >> 16;
+static uint64_t clip_hash(uint64_t hash) {
+    return hash << 16 >> 16;
 }
 
 // hashmap_new_with_allocator returns a new hash map using a custom allocator.
@@ -169,12 +213,403 @@ struct hashmap *hashmap_new(size_t elsize, size_t cap,
     );
 }
 
+//-----------------------------------------------------------------------------
+// Swiss table layout
+//
+// Buckets keep their header but are only used for the stored hash and an
+// occupied flag (dib 1 or 0), so scan, iter, probe and clear work on both
+// layouts. Lookups never touch them until the key is likely there: a
+// separate array holds one control byte per bucket, either the low 7 bits of
+// the hash or one of the markers below, and probing compares 16 of those at
+// a time. The array is followed by a copy of its first 16 bytes so a group
+// can be loaded at any index without wrapping. Groups are probed
+// triangularly like abseil does, the step grows by a group every time, so
+// probe sequences that start close together split up instead of piling into
+// one long run. With a power of two buckets the sequence still reaches every
+// group.
+//-----------------------------------------------------------------------------
+
+#define GROUP_WIDTH 16
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xFE
+
+#ifdef __SSE2__
+static uint32_t group_match(const uint8_t *g, uint8_t h2) {
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)g);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(h2)));
+}
+
+// slots that are empty or deleted, both markers have the top bit set
+static uint32_t group_free(const uint8_t *g) {
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)g));
+}
+#else
+static uint32_t group_match(const uint8_t *g, uint8_t h2) {
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++) {
+        mask |= (uint32_t)(g[i] == h2) << i;
+    }
+    return mask;
+}
+
+static uint32_t group_free(const uint8_t *g) {
+    uint32_t mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++) {
+        mask |= (uint32_t)(g[i] >> 7) << i;
+    }
+    return mask;
+}
+#endif
+
+static uint32_t group_empty(const uint8_t *g) {
+    return group_match(g, CTRL_EMPTY);
+}
+
+static uint8_t ctrl_h2(uint64_t hash) {
+    return hash & 0x7F;
+}
+
+static size_t ctrl_h1(struct hashmap *map, uint64_t hash) {
+    return (hash >> 7) & map->mask;
+}
+
+static void set_ctrl(struct hashmap *map, size_t i, uint8_t c) {
+    map->ctrl[i] = c;
+    if (i < GROUP_WIDTH) {
+        map->ctrl[map->nbuckets+i] = c;
+    }
+}
+
+static void swiss_reset(struct hashmap *map) {
+    memset(map->ctrl, CTRL_EMPTY, map->nbuckets+GROUP_WIDTH);
+    map->deleted = 0;
+    map->growat = map->nbuckets-map->nbuckets/8;
+}
+
+// hashmap_new_swiss returns a new hash map that uses the swiss table layout.
+// It takes the same params as hashmap_new and works with every other
+// hashmap_* function. Probing stays in the control bytes, so it does better
+// than robinhood with large items and on lookups that miss.
+struct hashmap *hashmap_new_swiss(size_t elsize, size_t cap,
+                            uint64_t seed0, uint64_t seed1,
+                            uint64_t (*hash)(const void *item,
+                                             uint64_t seed0, uint64_t seed1),
+                            int (*compare)(const void *a, const void *b,
+                                           void *udata),
+                            void (*elfree)(void *item),
+                            void *udata)
+{
+    struct hashmap *map = hashmap_new(elsize, cap, seed0, seed1, hash,
+                                      compare, elfree, udata);
+    if (!map) {
+        return NULL;
+    }
+    map->ctrl = map->malloc(map->nbuckets+GROUP_WIDTH);
+    if (!map->ctrl) {
+        hashmap_free(map);
+        return NULL;
+    }
+    swiss_reset(map);
+    return map;
+}
+
+// returns the index of the bucket holding key or SIZE_MAX
+static size_t swiss_find(struct hashmap *map, const void *key, uint64_t hash) {
+    uint8_t h2 = ctrl_h2(hash);
+    size_t i = ctrl_h1(map, hash), stride = 0;
+    for (;;) {
+        const uint8_t *g = map->ctrl+i;
+        for (uint32_t m = group_match(g, h2); m; m &= m-1) {
+            size_t j = (i+__builtin_ctz(m)) & map->mask;
+            struct bucket *bucket = bucket_at(map, j);
+            if (bucket->hash == hash &&
+                map->compare(key, bucket_item(bucket), map->udata) == 0)
+            {
+                return j;
+            }
+        }
+        if (group_empty(g)) {
+            return SIZE_MAX;
+        }
+        stride += GROUP_WIDTH;
+        i = (i+stride) & map->mask;
+    }
+}
+
+// first empty or deleted bucket on the probe sequence of hash
+static size_t swiss_find_free(struct hashmap *map, uint64_t hash) {
+    size_t i = ctrl_h1(map, hash), stride = 0;
+    for (;;) {
+        uint32_t m = group_free(map->ctrl+i);
+        if (m) {
+            return (i+__builtin_ctz(m)) & map->mask;
+        }
+        stride += GROUP_WIDTH;
+        i = (i+stride) & map->mask;
+    }
+}
+
+// slots a lookup for the item in bucket i looks at, counted along the probe
+// sequence of hash up to the first group that holds i
+static size_t swiss_dib(struct hashmap *map, size_t i, uint64_t hash) {
+    size_t g = ctrl_h1(map, hash), stride = 0;
+    while (((i-g) & map->mask) >= GROUP_WIDTH) {
+        stride += GROUP_WIDTH;
+        g = (g+stride) & map->mask;
+    }
+    return stride + ((i-g) & map->mask) + 1;
+}
+
+static bool swiss_resize(struct hashmap *map, size_t new_cap) {
+    void *buckets = map->malloc(map->bucketsz*new_cap);
+    uint8_t *ctrl = map->malloc(new_cap+GROUP_WIDTH);
+    if (!buckets || !ctrl) {
+        map->free(buckets);
+        map->free(ctrl);
+        return false;
+    }
+    memset(buckets, 0, map->bucketsz*new_cap);
+    void *old_buckets = map->buckets;
+    size_t old_nbuckets = map->nbuckets;
+    map->free(map->ctrl);
+    map->buckets = buckets;
+    map->ctrl = ctrl;
+    map->nbuckets = new_cap;
+    map->mask = new_cap-1;
+    map->shrinkat = new_cap*0.10;
+    swiss_reset(map);
+    for (size_t i = 0; i < old_nbuckets; i++) {
+        struct bucket *entry = (struct bucket*)
+            ((char*)old_buckets+map->bucketsz*i);
+        if (!entry->dib) {
+            continue;
+        }
+        size_t j = swiss_find_free(map, entry->hash);
+        set_ctrl(map, j, ctrl_h2(entry->hash));
+        memcpy(bucket_at(map, j), entry, map->bucketsz);
+    }
+    map->free(old_buckets);
+    return true;
+}
+
+static bool resize(struct hashmap *map, size_t new_cap);
+
+static void *swiss_set(struct hashmap *map, const void *item, uint64_t hash) {
+    if (map->count+map->deleted >= map->growat) {
+        // mostly tombstones means a rehash in place is enough
+        size_t cap = map->count >= map->nbuckets/2 ? map->nbuckets*2 :
+                     map->nbuckets;
+        if (!resize(map, cap)) {
+            map->oom = true;
+            return NULL;
+        }
+    }
+    size_t i = swiss_find(map, item, hash);
+    if (i != SIZE_MAX) {
+        void *old = bucket_item(bucket_at(map, i));
+        memcpy(map->spare, old, map->elsize);
+        memcpy(old, item, map->elsize);
+        return map->spare;
+    }
+    i = swiss_find_free(map, hash);
+    if (map->ctrl[i] == CTRL_DELETED) {
+        map->deleted--;
+    }
+    set_ctrl(map, i, ctrl_h2(hash));
+    struct bucket *bucket = bucket_at(map, i);
+    bucket->hash = hash;
+    bucket->dib = 1;
+    memcpy(bucket_item(bucket), item, map->elsize);
+    map->count++;
+    return NULL;
+}
+
+static void *swiss_delete(struct hashmap *map, const void *key, uint64_t hash) {
+    size_t i = swiss_find(map, key, hash);
+    if (i == SIZE_MAX) {
+        return NULL;
+    }
+    struct bucket *bucket = bucket_at(map, i);
+    memcpy(map->spare, bucket_item(bucket), map->elsize);
+    bucket->dib = 0;
+    // A probe only moves past a group with no empty slot. If every group
+    // holding this bucket still has one, nothing probed past it and the
+    // bucket can go back to empty, otherwise it needs a tombstone.
+    uint32_t after = group_empty(map->ctrl+i) | 1u << GROUP_WIDTH;
+    uint32_t before = group_empty(map->ctrl+((i-GROUP_WIDTH) & map->mask));
+    size_t run = __builtin_ctz(after) + (__builtin_clz(before|1) - 16);
+    if (before && run < GROUP_WIDTH) {
+        set_ctrl(map, i, CTRL_EMPTY);
+    } else {
+        set_ctrl(map, i, CTRL_DELETED);
+        map->deleted++;
+    }
+    map->count--;
+    if (map->nbuckets > map->cap && map->count <= map->shrinkat) {
+        resize(map, map->nbuckets/2);
+    }
+    return map->spare;
+}
+
+//-----------------------------------------------------------------------------
+// Incremental resize
+//
+// With hashmap_set_incremental a resize only allocates the new buckets. The
+// old ones stay around and every set and delete moves the next few of them
+// over, so no single call pays for the whole table. Lookups check the new
+// buckets and then the old.
+//
+// Migration walks the old buckets in order starting right after an empty
+// one, which means no cluster is split at the start. A key still in the old
+// buckets whose home has already been moved therefore sits in the unbroken
+// run that starts at the cursor, and that is where its lookup starts.
+//-----------------------------------------------------------------------------
+
+#define MIGRATE_STEP 8
+
+static struct bucket *old_at(struct hashmap *map, size_t index) {
+    return (struct bucket*)(((char*)map->old)+(map->bucketsz*index));
+}
+
+// robinhood insert of an entry that is known not to be in the map
+static void insert_entry(struct hashmap *map, struct bucket *entry) {
+    entry->dib = 1;
+    size_t i = entry->hash & map->mask;
+    for (;;) {
+        struct bucket *bucket = bucket_at(map, i);
+        if (bucket->dib == 0) {
+            memcpy(bucket, entry, map->bucketsz);
+            return;
+        }
+        if (bucket->dib < entry->dib) {
+            memcpy(map->spare, bucket, map->bucketsz);
+            memcpy(bucket, entry, map->bucketsz);
+            memcpy(entry, map->spare, map->bucketsz);
+        }
+        i = (i + 1) & map->mask;
+        entry->dib += 1;
+    }
+}
+
+static void migrate(struct hashmap *map, size_t n) {
+    for (; n > 0 && map->old_moved < map->old_nbuckets; n--) {
+        size_t i = (map->old_start + map->old_moved) & map->old_mask;
+        struct bucket *entry = old_at(map, i);
+        if (entry->dib) {
+            memcpy(map->edata, entry, map->bucketsz);
+            entry->dib = 0;
+            insert_entry(map, map->edata);
+        }
+        map->old_moved++;
+    }
+    if (map->old_moved == map->old_nbuckets) {
+        map->free(map->old);
+        map->old = NULL;
+    }
+}
+
+static size_t old_find(struct hashmap *map, const void *key, uint64_t hash) {
+    size_t i = hash & map->old_mask;
+    if (((i - map->old_start) & map->old_mask) < map->old_moved) {
+        i = (map->old_start + map->old_moved) & map->old_mask;
+    }
+    for (;;) {
+        struct bucket *bucket = old_at(map, i);
+        if (!bucket->dib) {
+            return SIZE_MAX;
+        }
+        if (bucket->hash == hash &&
+            map->compare(key, bucket_item(bucket), map->udata) == 0)
+        {
+            return i;
+        }
+        i = (i + 1) & map->old_mask;
+    }
+}
+
+// Backward shift delete. It only moves buckets between i and the next empty
+// one, which never crosses the cursor because the bucket before old_start
+// stays empty.
+static void *old_delete(struct hashmap *map, const void *key, uint64_t hash) {
+    size_t i = old_find(map, key, hash);
+    if (i == SIZE_MAX) {
+        return NULL;
+    }
+    struct bucket *bucket = old_at(map, i);
+    memcpy(map->spare, bucket_item(bucket), map->elsize);
+    for (;;) {
+        struct bucket *prev = bucket;
+        i = (i + 1) & map->old_mask;
+        bucket = old_at(map, i);
+        if (bucket->dib <= 1) {
+            prev->dib = 0;
+            break;
+        }
+        memcpy(prev, bucket, map->bucketsz);
+        prev->dib--;
+    }
+    map->count--;
+    return map->spare;
+}
+
+static bool resize_incremental(struct hashmap *map, size_t new_cap) {
+    if (map->old) {
+        migrate(map, SIZE_MAX);
+    }
+    // Zeroing the new buckets up front is the one O(n) step left. With the
+    // system allocator calloc gets fresh pages from the kernel that are
+    // already zero, and the page faults are spread over later operations.
+    void *buckets;
+    if (map->malloc == malloc) {
+        buckets = calloc(new_cap, map->bucketsz);
+    } else if ((buckets = map->malloc(map->bucketsz*new_cap))) {
+        memset(buckets, 0, map->bucketsz*new_cap);
+    }
+    if (!buckets) {
+        return false;
+    }
+    size_t empty = 0;
+    while (bucket_at(map, empty)->dib) {
+        empty++;
+    }
+    map->old = map->buckets;
+    map->old_nbuckets = map->nbuckets;
+    map->old_mask = map->mask;
+    map->old_start = (empty + 1) & map->mask;
+    map->old_moved = 0;
+    map->buckets = buckets;
+    map->nbuckets = new_cap;
+    map->mask = new_cap-1;
+    map->growat = new_cap*0.75;
+    map->shrinkat = new_cap*0.10;
+    return true;
+}
+
+// hashmap_set_incremental turns incremental resizing on or off. When on, a
+// resize spreads the rehash over the following sets and deletes instead of
+// doing it all at once, which bounds the cost of any single call. Only the
+// robinhood layout supports it, returns false for a swiss map.
+bool hashmap_set_incremental(struct hashmap *map, bool incremental) {
+    if (map->ctrl || map->mapped) {
+        return false;
+    }
+    if (!incremental && map->old) {
+        migrate(map, SIZE_MAX);
+    }
+    map->incremental = incremental;
+    return true;
+}
+
 static void free_elements(struct hashmap *map) {
     if (map->elfree) {
         for (size_t i = 0; i < map->nbuckets; i++) {
             struct bucket *bucket = bucket_at(map, i);
             if (bucket->dib) map->elfree(bucket_item(bucket));
         }
+        for (size_t i = 0; map->old && i < map->old_nbuckets; i++) {
+            struct bucket *bucket = old_at(map, i);
+            if (bucket->dib) map->elfree(bucket_item(bucket));
+        }
     }
 }
 
@@ -186,26 +621,50 @@ static void free_elements(struct hashmap *map) {
 // the currently number of allocated buckets. This is an optimization to ensure
 // that this operation does not perform any allocations.
 void hashmap_clear(struct hashmap *map, bool update_cap) {
+    if (map->mapped) {
+        panic("map is a read-only snapshot");
+    }
     map->count = 0;
     free_elements(map);
+    if (map->old) {
+        map->free(map->old);
+        map->old = NULL;
+    }
     if (update_cap) {
         map->cap = map->nbuckets;
     } else if (map->nbuckets != map->cap) {
         void *new_buckets = map->malloc(map->bucketsz*map->cap);
+        uint8_t *new_ctrl = NULL;
+        if (map->ctrl) {
+            new_ctrl = map->malloc(map->cap+GROUP_WIDTH);
+        }
         if (new_buckets) {
             map->free(map->buckets);
             map->buckets = new_buckets;
         }
+        if (new_ctrl) {
+            map->free(map->ctrl);
+            map->ctrl = new_ctrl;
+        }
         map->nbuckets = map->cap;
     }
     memset(map->buckets, 0, map->bucketsz*map->nbuckets);
     map->mask = map->nbuckets-1;
     map->growat = map->nbuckets*0.75;
     map->shrinkat = map->nbuckets*0.10;
+    if (map->ctrl) {
+        swiss_reset(map);
+    }
 }
 
 
-static bool resize(struct hashmap *map, size_t new_cap) {
+static bool resize_buckets(struct hashmap *map, size_t new_cap) {
+    if (map->ctrl) {
+        return swiss_resize(map, new_cap);
+    }
+    if (map->incremental) {
+        return resize_incremental(map, new_cap);
+    }
     struct hashmap *map2 = hashmap_new_with_allocator(map->malloc, map->realloc, map->free,
                                                       map->elsize, new_cap, map->seed0, 
                                                       map->seed1, map->hash, map->compare,
@@ -245,6 +704,21 @@ static bool resize(struct hashmap *map, size_t new_cap) {
     return true;
 }
 
+static bool resize(struct hashmap *map, size_t new_cap) {
+#ifdef HASHMAP_STATS
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    bool ok = resize_buckets(map, new_cap);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    stat_add(map, resizes, 1);
+    stat_add(map, resize_ns, (uint64_t)((t1.tv_sec-t0.tv_sec)*1000000000 +
+                                        (t1.tv_nsec-t0.tv_nsec)));
+    return ok;
+#else
+    return resize_buckets(map, new_cap);
+#endif
+}
+
 // hashmap_set inserts or replaces an item in the hash map. If an item is
 // replaced then it is returned otherwise NULL is returned. This operation
 // may allocate memory. If the system is unable to allocate additional
@@ -253,7 +727,29 @@ void *hashmap_set(struct hashmap *map, const void *item) {
     if (!item) {
         panic("item is null");
     }
+    return hashmap_set_with_hash(map, item, map->hash(item, map->seed0,
+                                                      map->seed1));
+}
+
+// hashmap_set_with_hash works like hashmap_set but takes the item's hash,
+// as returned by the map's hash function, instead of computing it.
+void *hashmap_set_with_hash(struct hashmap *map, const void *item,
+                            uint64_t hash)
+{
+    if (!item) {
+        panic("item is null");
+    }
+    if (map->mapped) {
+        panic("map is a read-only snapshot");
+    }
+    hash = clip_hash(hash);
     map->oom = false;
+    if (map->ctrl) {
+        return swiss_set(map, item, hash);
+    }
+    if (map->old) {
+        migrate(map, MIGRATE_STEP);
+    }
     if (map->count == map->growat) {
         if (!resize(map, map->nbuckets*2)) {
             map->oom = true;
@@ -263,9 +759,19 @@ void *hashmap_set(struct hashmap *map, const void *item) {
 
     
     struct bucket *entry = map->edata;
-    entry->hash = get_hash(map, item);
+    entry->hash = hash;
     entry->dib = 1;
     memcpy(bucket_item(entry), item, map->elsize);
+
+    if (map->old) {
+        size_t j = old_find(map, item, entry->hash);
+        if (j != SIZE_MAX) {
+            void *old = bucket_item(old_at(map, j));
+            memcpy(map->spare, old, map->elsize);
+            memcpy(old, item, map->elsize);
+            return map->spare;
+        }
+    }
     
     size_t i = entry->hash & map->mask;
 	for (;;) {
@@ -299,11 +805,22 @@ void *hashmap_get(struct hashmap *map, const void *key) {
     if (!key) {
         panic("key is null");
     }
-    uint64_t hash = get_hash(map, key);
+    return hashmap_get_with_hash(map, key, map->hash(key, map->seed0,
+                                                     map->seed1));
+}
+
+static void *get(struct hashmap *map, const void *key, uint64_t hash) {
+    if (map->ctrl) {
+        size_t i = swiss_find(map, key, hash);
+        return i == SIZE_MAX ? NULL : bucket_item(bucket_at(map, i));
+    }
 	size_t i = hash & map->mask;
 	for (;;) {
         struct bucket *bucket = bucket_at(map, i);
 		if (!bucket->dib) {
+            if (map->old && (i = old_find(map, key, hash)) != SIZE_MAX) {
+                return bucket_item(old_at(map, i));
+            }
 			return NULL;
 		}
 		if (bucket->hash == hash && 
@@ -315,9 +832,58 @@ void *hashmap_get(struct hashmap *map, const void *key) {
 	}
 }
 
+// hashmap_get_with_hash works like hashmap_get but takes the key's hash, as
+// returned by the map's hash function, instead of computing it.
+void *hashmap_get_with_hash(struct hashmap *map, const void *key,
+                            uint64_t hash)
+{
+    if (!key) {
+        panic("key is null");
+    }
+    void *item = get(map, key, clip_hash(hash));
+    if (item) {
+        stat_add(map, hits, 1);
+    } else {
+        stat_add(map, misses, 1);
+    }
+    return item;
+}
+
+#define GET_MANY_BATCH 16
+
+// hashmap_get_many looks up `n` keys stored back to back in `keys`, each the
+// size of an item, and stores the matching items or NULL in `out`. Keys are
+// hashed and their first buckets prefetched a batch at a time before any of
+// them is looked up, so the cache misses of independent keys overlap.
+void hashmap_get_many(struct hashmap *map, const void *keys, size_t n,
+                      void **out)
+{
+    const char *key = keys;
+    uint64_t hashes[GET_MANY_BATCH];
+    for (size_t i = 0; i < n; i += GET_MANY_BATCH) {
+        size_t m = n-i < GET_MANY_BATCH ? n-i : GET_MANY_BATCH;
+        for (size_t j = 0; j < m; j++) {
+            hashes[j] = map->hash(key+(i+j)*map->elsize, map->seed0,
+                                  map->seed1);
+            uint64_t hash = clip_hash(hashes[j]);
+            if (map->ctrl) {
+                __builtin_prefetch(map->ctrl+ctrl_h1(map, hash));
+                __builtin_prefetch(bucket_at(map, ctrl_h1(map, hash)));
+            } else {
+                __builtin_prefetch(bucket_at(map, hash & map->mask));
+            }
+        }
+        for (size_t j = 0; j < m; j++) {
+            out[i+j] = hashmap_get_with_hash(map, key+(i+j)*map->elsize,
+                                             hashes[j]);
+        }
+    }
+}
+
 // hashmap_probe returns the item in the bucket at position or NULL if an item
 // is not set for that bucket. The position is 'moduloed' by the number of 
-// buckets in the hashmap.
+// buckets in the hashmap. During an incremental resize only the new buckets
+// are probed.
 void *hashmap_probe(struct hashmap *map, uint64_t position) {
     size_t i = position & map->mask;
     struct bucket *bucket = bucket_at(map, i);
@@ -334,13 +900,34 @@ void *hashmap_delete(struct hashmap *map, void *key) {
     if (!key) {
         panic("key is null");
     }
+    return hashmap_delete_with_hash(map, key, map->hash(key, map->seed0,
+                                                        map->seed1));
+}
+
+// hashmap_delete_with_hash works like hashmap_delete but takes the key's
+// hash, as returned by the map's hash function, instead of computing it.
+void *hashmap_delete_with_hash(struct hashmap *map, const void *key,
+                               uint64_t hash)
+{
+    if (!key) {
+        panic("key is null");
+    }
+    if (map->mapped) {
+        panic("map is a read-only snapshot");
+    }
+    hash = clip_hash(hash);
     map->oom = false;
-    uint64_t hash = get_hash(map, key);
+    if (map->ctrl) {
+        return swiss_delete(map, key, hash);
+    }
+    if (map->old) {
+        migrate(map, MIGRATE_STEP);
+    }
 	size_t i = hash & map->mask;
 	for (;;) {
         struct bucket *bucket = bucket_at(map, i);
 		if (!bucket->dib) {
-			return NULL;
+			return map->old ? old_delete(map, key, hash) : NULL;
 		}
 		if (bucket->hash == hash && 
             map->compare(key, bucket_item(bucket), map->udata) == 0)
@@ -359,7 +946,10 @@ void *hashmap_delete(struct hashmap *map, void *key) {
                 prev->dib--;
             }
             map->count--;
-            if (map->nbuckets > map->cap && map->count <= map->shrinkat) {
+            // an incremental shrink waits for the running migration
+            if (map->nbuckets > map->cap && map->count <= map->shrinkat &&
+                !map->old)
+            {
                 // Ignore the return value. It's ok for the resize operation to
                 // fail to allocate enough memory because a shrink operation
                 // does not change the integrity of the data.
@@ -376,71 +966,701 @@ size_t hashmap_count(struct hashmap *map) {
     return map->count;
 }
 
-// hashmap_free frees the hash map
-// Every item is called with the element-freeing function given in hashmap_new,
-// if present, to free any data referenced in the elements of the hashmap.
-void hashmap_free(struct hashmap *map) {
+static void stats_add_dib(struct hashmap_stats *stats, size_t dib) {
+    stats->dibs[dib < HASHMAP_STATS_DIBS ? dib-1 : HASHMAP_STATS_DIBS-1]++;
+    stats->avg_dib += dib;
+    if (dib > stats->max_dib) {
+        stats->max_dib = dib;
+    }
+}
+
+// hashmap_stats fills in the probe distance histogram by walking every
+// bucket, so it costs as much as a scan. The dib of an item is the number of
+// buckets a lookup for it examines, 1 when it sits in its home bucket. For
+// the swiss layout that is counted in slots along its probe sequence, a
+// whole group for every group skipped. The resize and lookup counters are only kept when hashmap.c is
+// built with HASHMAP_STATS and are zero otherwise.
+void hashmap_stats(struct hashmap *map, struct hashmap_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->count = map->count;
+    stats->nbuckets = map->nbuckets + (map->old ? map->old_nbuckets : 0);
+    stats->load = (double)map->count/stats->nbuckets;
+    for (size_t i = 0; i < map->nbuckets; i++) {
+        struct bucket *bucket = bucket_at(map, i);
+        if (!bucket->dib) {
+            continue;
+        }
+        if (map->ctrl) {
+            stats_add_dib(stats, swiss_dib(map, i, bucket->hash));
+        } else {
+            stats_add_dib(stats, bucket->dib);
+        }
+    }
+    for (size_t i = 0; map->old && i < map->old_nbuckets; i++) {
+        struct bucket *bucket = old_at(map, i);
+        if (bucket->dib) {
+            stats_add_dib(stats, bucket->dib);
+        }
+    }
+    if (map->count) {
+        stats->avg_dib /= map->count;
+    }
+#ifdef HASHMAP_STATS
+    stats->counted = true;
+    stats->resizes = __atomic_load_n(&map->resizes, __ATOMIC_RELAXED);
+    stats->resize_ns = __atomic_load_n(&map->resize_ns, __ATOMIC_RELAXED);
+    stats->hits = __atomic_load_n(&map->hits, __ATOMIC_RELAXED);
+    stats->misses = __atomic_load_n(&map->misses, __ATOMIC_RELAXED);
+#endif
+}
+
+// hashmap_free frees the hash map
+// Every item is called with the element-freeing function given in hashmap_new,
+// if present, to free any data referenced in the elements of the hashmap.
+void hashmap_free(struct hashmap *map) {
+    if (!map) return;
+    if (map->mapped) {
+        munmap(map->mapped, map->mapped_len);
+        map->free(map);
+        return;
+    }
+    free_elements(map);
+    map->free(map->buckets);
+    map->free(map->ctrl);
+    map->free(map->old);
+    map->free(map);
+}
+
+// hashmap_oom returns true if the last hashmap_set() call failed due to the 
+// system being out of memory.
+bool hashmap_oom(struct hashmap *map) {
+    return map->oom;
+}
+
+// hashmap_scan iterates over all items in the hash map
+// Param `iter` can return false to stop iteration early.
+// Returns false if the iteration has been stopped early.
+bool hashmap_scan(struct hashmap *map, 
+                  bool (*iter)(const void *item, void *udata), void *udata)
+{
+    for (size_t i = 0; i < map->nbuckets; i++) {
+        struct bucket *bucket = bucket_at(map, i);
+        if (bucket->dib) {
+            if (!iter(bucket_item(bucket), udata)) {
+                return false;
+            }
+        }
+    }
+    for (size_t i = 0; map->old && i < map->old_nbuckets; i++) {
+        struct bucket *bucket = old_at(map, i);
+        if (bucket->dib) {
+            if (!iter(bucket_item(bucket), udata)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+// hashmap_iter iterates one key at a time yielding a reference to an
+// entry at each iteration. Useful to write simple loops and avoid writing
+// dedicated callbacks and udata structures, as in hashmap_scan.
+//
+// map is a hash map handle. i is a pointer to a size_t cursor that
+// should be initialized to 0 at the beginning of the loop. item is a void
+// pointer pointer that is populated with the retrieved item. Note that this
+// is NOT a copy of the item stored in the hash map and can be directly
+// modified.
+//
+// Note that if hashmap_delete() is called on the hashmap being iterated,
+// the buckets are rearranged and the iterator must be reset to 0, otherwise
+// unexpected results may be returned after deletion.
+//
+// This function has not been tested for thread safety.
+//
+// The function returns true if an item was retrieved; false if the end of the
+// iteration has been reached.
+bool hashmap_iter(struct hashmap *map, size_t *i, void **item)
+{
+    struct bucket *bucket;
+
+    do {
+        if (*i < map->nbuckets) {
+            bucket = bucket_at(map, *i);
+        } else if (map->old && *i < map->nbuckets+map->old_nbuckets) {
+            bucket = old_at(map, *i-map->nbuckets);
+        } else {
+            return false;
+        }
+        (*i)++;
+    } while (!bucket->dib);
+
+    *item = bucket_item(bucket);
+
+    return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Bulk loading
+//
+// hashmap_bulk_load hashes every item up front, on several threads when there
+// are enough of them, and then sorts them by home bucket with a counting
+// sort. Into an empty robinhood table items in home order can be laid down
+// left to right with no swaps, each one going to its home or the first free
+// bucket after it, which is exactly where robinhood insertion would have put
+// it. Only the few that run off the end of the table go through the normal
+// insert. The swiss layout has no swaps to skip and just inserts in that
+// order, which keeps the first group of each probe moving forward through
+// memory.
+//-----------------------------------------------------------------------------
+
+#define BULK_THREADS 8
+#define BULK_MIN_PER_THREAD 65536
+
+// hashmap_reserve grows the map so that it holds n items without resizing,
+// and keeps it from shrinking below that. A running incremental resize is
+// finished first. Returns false if the memory could not be allocated.
+bool hashmap_reserve(struct hashmap *map, size_t n) {
+    if (map->mapped) {
+        panic("map is a read-only snapshot");
+    }
+    size_t cap = map->nbuckets;
+    while ((map->ctrl ? cap-cap/8 : (size_t)(cap*0.75)) < n) {
+        cap *= 2;
+    }
+    if (cap > map->nbuckets && !resize(map, cap)) {
+        map->oom = true;
+        return false;
+    }
+    if (map->old) {
+        migrate(map, SIZE_MAX);
+    }
+    if (cap > map->cap) {
+        map->cap = cap;
+    }
+    return true;
+}
+
+struct bulk_hasher {
+    struct hashmap *map;
+    const char *items;
+    uint64_t *hashes;
+    size_t start;
+    size_t end;
+};
+
+static void *bulk_hash(void *arg) {
+    struct bulk_hasher *h = arg;
+    for (size_t i = h->start; i < h->end; i++) {
+        h->hashes[i] = clip_hash(h->map->hash(h->items+i*h->map->elsize,
+                                              h->map->seed0, h->map->seed1));
+    }
+    return NULL;
+}
+
+static void bulk_hash_all(struct hashmap *map, const char *items, size_t n,
+                          uint64_t *hashes)
+{
+    struct bulk_hasher hashers[BULK_THREADS];
+    pthread_t threads[BULK_THREADS];
+    size_t nthreads = n/BULK_MIN_PER_THREAD;
+    if (nthreads > BULK_THREADS) {
+        nthreads = BULK_THREADS;
+    }
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    for (size_t t = 0; t < nthreads; t++) {
+        hashers[t] = (struct bulk_hasher){
+            .map = map, .items = items, .hashes = hashes,
+            .start = n*t/nthreads, .end = n*(t+1)/nthreads,
+        };
+    }
+    // the calling thread takes the first share
+    size_t started = 1;
+    for (; started < nthreads; started++) {
+        if (pthread_create(&threads[started], NULL, bulk_hash,
+                           &hashers[started]) != 0)
+        {
+            break;
+        }
+    }
+    bulk_hash(&hashers[0]);
+    for (size_t t = started; t < nthreads; t++) {
+        bulk_hash(&hashers[t]);
+    }
+    for (size_t t = 1; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+}
+
+// lays out items sorted by home bucket into the empty table
+static void bulk_place(struct hashmap *map, const char *items,
+                       const uint64_t *hashes, const uint32_t *order, size_t n)
+{
+    size_t next = 0;            // first bucket not yet taken
+    size_t group = 0;           // first bucket of the current home
+    size_t home = SIZE_MAX;
+    size_t i = 0;
+    for (; i < n; i++) {
+        const void *item = items+order[i]*map->elsize;
+        uint64_t hash = hashes[order[i]];
+        if ((hash & map->mask) != home) {
+            home = hash & map->mask;
+            group = next > home ? next : home;
+        } else {
+            // a duplicate has the same home, the later item wins
+            size_t j = group;
+            for (; j < next; j++) {
+                struct bucket *bucket = bucket_at(map, j);
+                if (bucket->hash == hash &&
+                    map->compare(item, bucket_item(bucket), map->udata) == 0)
+                {
+                    break;
+                }
+            }
+            if (j < next) {
+                memcpy(bucket_item(bucket_at(map, j)), item, map->elsize);
+                continue;
+            }
+        }
+        size_t pos = next > home ? next : home;
+        if (pos >= map->nbuckets) {
+            break;
+        }
+        struct bucket *bucket = bucket_at(map, pos);
+        bucket->hash = hash;
+        bucket->dib = pos-home+1;
+        memcpy(bucket_item(bucket), item, map->elsize);
+        map->count++;
+        next = pos+1;
+    }
+    // the rest would wrap around to the start of the table
+    for (; i < n; i++) {
+        hashmap_set_with_hash(map, items+order[i]*map->elsize,
+                              hashes[order[i]]);
+    }
+}
+
+// hashmap_bulk_load sets `n` items stored back to back in `items`, as if by
+// calling hashmap_set on each in turn, but sizes the table once and skips the
+// robinhood swaps when the map is empty. The map's hash function is called
+// from several threads at once for large n. Returns false and sets
+// hashmap_oom if memory runs out, in which case some of the items may have
+// been loaded.
+bool hashmap_bulk_load(struct hashmap *map, const void *items, size_t n) {
+    map->oom = false;
+    if (n == 0) {
+        return true;
+    }
+    if (!hashmap_reserve(map, map->count+n)) {
+        return false;
+    }
+    uint64_t *hashes = map->malloc(n*sizeof(uint64_t));
+    if (!hashes) {
+        map->oom = true;
+        return false;
+    }
+    bulk_hash_all(map, items, n, hashes);
+
+    uint32_t *order = NULL;
+    uint32_t *start = NULL;
+    if (map->count == 0 && n < UINT32_MAX &&
+        map->nbuckets < UINT32_MAX)
+    {
+        order = map->malloc(n*sizeof(uint32_t));
+        start = map->malloc((map->nbuckets+1)*sizeof(uint32_t));
+    }
+    bool ok = true;
+    if (order && start) {
+        // counting sort by home bucket, stable so duplicates keep their order
+        memset(start, 0, (map->nbuckets+1)*sizeof(uint32_t));
+        for (size_t i = 0; i < n; i++) {
+            start[(hashes[i] & map->mask)+1]++;
+        }
+        for (size_t b = 0; b < map->nbuckets; b++) {
+            start[b+1] += start[b];
+        }
+        for (size_t i = 0; i < n; i++) {
+            order[start[hashes[i] & map->mask]++] = i;
+        }
+        if (map->ctrl) {
+            // no swaps to save, but the inserts walk the table in order
+            for (size_t i = 0; i < n; i++) {
+                hashmap_set_with_hash(map, (const char*)items+
+                                      order[i]*map->elsize, hashes[order[i]]);
+            }
+        } else {
+            bulk_place(map, items, hashes, order, n);
+        }
+    } else {
+        for (size_t i = 0; i < n && ok; i++) {
+            hashmap_set_with_hash(map, (const char*)items+i*map->elsize,
+                                  hashes[i]);
+            ok = !hashmap_oom(map);
+        }
+    }
+    map->free(order);
+    map->free(start);
+    map->free(hashes);
+    return ok;
+}
+
+//-----------------------------------------------------------------------------
+// Snapshots
+//
+// A snapshot is a header followed by the bucket array exactly as it is in
+// memory, and the control bytes for the swiss layout. Buckets hold hashes,
+// probe distances and items but no pointers, so the file can be mapped at any
+// address and looked up in place. That only holds for the items themselves
+// if they are plain data too, a pointer stored in an item will not survive.
+//
+// The file is written in the host's byte order and bucket layout, and opening
+// one from a different kind of machine fails on the magic number.
+//-----------------------------------------------------------------------------
+
+#define SNAPSHOT_MAGIC UINT64_C(0x31706e73706d6168) // "hampsnp1"
+#define SNAPSHOT_SWISS 2 // 1 was the swiss layout with linear probing
+
+struct snapshot {
+    uint64_t magic;
+    uint64_t flags;
+    uint64_t elsize;
+    uint64_t bucketsz;
+    uint64_t nbuckets;
+    uint64_t count;
+    uint64_t seed0;
+    uint64_t seed1;
+};
+
+// returns 0 if the size doesn't fit in a size_t, which only a corrupt header
+// asks for
+static size_t snapshot_len(size_t bucketsz, size_t nbuckets, bool swiss) {
+    if (bucketsz == SIZE_MAX ||
+        nbuckets > (SIZE_MAX-sizeof(struct snapshot)-GROUP_WIDTH)/(bucketsz+1))
+    {
+        return 0;
+    }
+    return sizeof(struct snapshot) + bucketsz*nbuckets +
+           (swiss ? nbuckets+GROUP_WIDTH : 0);
+}
+
+// hashmap_snapshot writes the map to path so that hashmap_open_snapshot can
+// map it back later. A running incremental resize is finished first. The
+// snapshot goes to a temporary file that is renamed over path, so a reader
+// never sees a partial one. The file is synced before the rename and the
+// directory after it, so a crash leaves either the old snapshot or the whole
+// new one. Returns false and leaves errno set on failure.
+bool hashmap_snapshot(struct hashmap *map, const char *path) {
+    if (map->old) {
+        migrate(map, SIZE_MAX);
+    }
+    struct snapshot hdr = {
+        .magic = SNAPSHOT_MAGIC,
+        .flags = map->ctrl ? SNAPSHOT_SWISS : 0,
+        .elsize = map->elsize,
+        .bucketsz = map->bucketsz,
+        .nbuckets = map->nbuckets,
+        .count = map->count,
+        .seed0 = map->seed0,
+        .seed1 = map->seed1,
+    };
+    size_t pathlen = strlen(path);
+    char *tmp = map->malloc(pathlen+5);
+    if (!tmp) {
+        return false;
+    }
+    memcpy(tmp, path, pathlen);
+    memcpy(tmp+pathlen, ".tmp", 5);
+    FILE *f = fopen(tmp, "wb");
+    bool ok = f &&
+        fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+        fwrite(map->buckets, map->bucketsz, map->nbuckets, f) ==
+            map->nbuckets &&
+        (!map->ctrl ||
+         fwrite(map->ctrl, 1, map->nbuckets+GROUP_WIDTH, f) ==
+            map->nbuckets+GROUP_WIDTH) &&
+        fflush(f) == 0 && fsync(fileno(f)) == 0;
+    if (f && fclose(f) != 0) {
+        ok = false;
+    }
+    if (ok && rename(tmp, path) != 0) {
+        ok = false;
+    }
+    if (!ok && f) {
+        int err = errno;
+        unlink(tmp);
+        errno = err;
+    }
+    if (ok) {
+        // the rename is only on disk once the directory holding it is
+        char *slash = strrchr(tmp, '/');
+        if (slash) {
+            slash[slash == tmp] = '\0';
+        } else {
+            strcpy(tmp, ".");
+        }
+        int fd = open(tmp, O_RDONLY);
+        if (fd == -1 || fsync(fd) != 0) {
+            ok = false;
+        }
+        if (fd != -1) {
+            int err = errno;
+            close(fd);
+            errno = err;
+        }
+    }
+    map->free(tmp);
+    return ok;
+}
+
+// hashmap_open_snapshot maps a file written by hashmap_snapshot read-only
+// and returns a map that hashmap_get, hashmap_get_many, hashmap_scan and
+// hashmap_iter work on directly, without reading or rehashing the items up
+// front. The hash and compare functions must be the ones the map was built
+// with, the seeds come from the file. Setting, deleting or clearing the map
+// panics. hashmap_free unmaps it. Returns NULL if the file cannot be mapped
+// or is not a snapshot of items of elsize bytes.
+struct hashmap *hashmap_open_snapshot(const char *path, size_t elsize,
+                            uint64_t (*hash)(const void *item,
+                                             uint64_t seed0, uint64_t seed1),
+                            int (*compare)(const void *a, const void *b,
+                                           void *udata),
+                            void *udata)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat st;
+    void *mem = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct snapshot)) {
+        mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mem == MAP_FAILED) {
+        return NULL;
+    }
+    const struct snapshot *hdr = mem;
+    bool swiss = hdr->flags & SNAPSHOT_SWISS;
+    struct hashmap *map = NULL;
+    if (hdr->magic == SNAPSHOT_MAGIC && hdr->elsize == elsize &&
+        !(hdr->flags & ~(uint64_t)SNAPSHOT_SWISS) &&
+        hdr->nbuckets >= 16 && !(hdr->nbuckets & (hdr->nbuckets-1)) &&
+        // a lookup that misses only stops at an empty bucket
+        hdr->count < hdr->nbuckets &&
+        (size_t)st.st_size == snapshot_len(hdr->bucketsz, hdr->nbuckets,
+                                           swiss))
+    {
+        map = hashmap_new_with_allocator(NULL, NULL, NULL, elsize, 0,
+                                         hdr->seed0, hdr->seed1, hash,
+                                         compare, NULL, udata);
+    }
+    if (!map || map->bucketsz != hdr->bucketsz) {
+        hashmap_free(map);
+        munmap(mem, st.st_size);
+        return NULL;
+    }
+    map->free(map->buckets);
+    map->mapped = mem;
+    map->mapped_len = st.st_size;
+    map->buckets = (char*)mem+sizeof(struct snapshot);
+    if (swiss) {
+        map->ctrl = (uint8_t*)map->buckets+map->bucketsz*hdr->nbuckets;
+    }
+    map->nbuckets = hdr->nbuckets;
+    map->cap = hdr->nbuckets;
+    map->mask = hdr->nbuckets-1;
+    map->count = hdr->count;
+    return map;
+}
+
+//-----------------------------------------------------------------------------
+// Sharded hashmap
+//
+// The plain hashmap is single threaded: set and delete share the map's spare
+// and edata scratch, and pointers returned by get dangle after a resize. The
+// sharded map spreads keys over independent hashmaps picked by the top 16
+// hash bits, which clip_hash throws away, so the shard does not correlate
+// with the bucket. Each shard has its own rwlock, and items are copied in and
+// out under it so callers never see a bucket pointer.
+//-----------------------------------------------------------------------------
+
+#define SHARD_LINE 64
+
+struct shard {
+    pthread_rwlock_t lock;
+    struct hashmap *map;
+} __attribute__((aligned(SHARD_LINE))); // one lock per cache line
+
+struct hashmap_sharded {
+    void (*free)(void *);
+    size_t elsize;
+    size_t nshards;
+    uint64_t seed0;
+    uint64_t seed1;
+    uint64_t (*hash)(const void *item, uint64_t seed0, uint64_t seed1);
+    void *mem;
+    struct shard *shards;
+};
+
+static struct shard *shard_for(struct hashmap_sharded *map, uint64_t hash) {
+    return &map->shards[(hash >> 48) & (map->nshards-1)];
+}
+
+// hashmap_sharded_new returns a new thread-safe hash map made of `nshards`
+// independent shards, rounded up to a power of two. Zero picks 16 shards.
+// Param `cap` is the total lower capacity, split evenly over the shards. The
+// other params are the same as for hashmap_new.
+struct hashmap_sharded *hashmap_sharded_new(size_t elsize, size_t cap,
+                            size_t nshards,
+                            uint64_t seed0, uint64_t seed1,
+                            uint64_t (*hash)(const void *item,
+                                             uint64_t seed0, uint64_t seed1),
+                            int (*compare)(const void *a, const void *b,
+                                           void *udata),
+                            void (*elfree)(void *item),
+                            void *udata)
+{
+    void *(*malloc_)(size_t) = _malloc ? _malloc : malloc;
+    void (*free_)(void *) = _free ? _free : free;
+    size_t n = 1;
+    if (nshards == 0) {
+        nshards = 16;
+    }
+    if (nshards > 65536) {
+        nshards = 65536;
+    }
+    while (n < nshards) {
+        n *= 2;
+    }
+    struct hashmap_sharded *map = malloc_(sizeof(struct hashmap_sharded));
+    if (!map) {
+        return NULL;
+    }
+    memset(map, 0, sizeof(struct hashmap_sharded));
+    map->free = free_;
+    map->elsize = elsize;
+    map->nshards = n;
+    map->seed0 = seed0;
+    map->seed1 = seed1;
+    map->hash = hash;
+    // the allocator makes no promise about alignment past max_align_t
+    map->mem = malloc_(sizeof(struct shard)*(n+1));
+    if (!map->mem) {
+        free_(map);
+        return NULL;
+    }
+    map->shards = (struct shard*)(((uintptr_t)map->mem+SHARD_LINE-1) &
+                                  ~(uintptr_t)(SHARD_LINE-1));
+    for (size_t i = 0; i < n; i++) {
+        struct shard *shard = &map->shards[i];
+        shard->map = hashmap_new(elsize, cap/n, seed0, seed1, hash, compare,
+                                 elfree, udata);
+        if (!shard->map || pthread_rwlock_init(&shard->lock, NULL) != 0) {
+            hashmap_free(shard->map);
+            map->nshards = i;
+            hashmap_sharded_free(map);
+            return NULL;
+        }
+    }
+    return map;
+}
+
+// hashmap_sharded_free frees the map and all shards. No other thread may be
+// using the map.
+void hashmap_sharded_free(struct hashmap_sharded *map) {
     if (!map) return;
-    free_elements(map);
-    map->free(map->buckets);
+    for (size_t i = 0; i < map->nshards; i++) {
+        pthread_rwlock_destroy(&map->shards[i].lock);
+        hashmap_free(map->shards[i].map);
+    }
+    map->free(map->mem);
     map->free(map);
 }
 
-// hashmap_oom returns true if the last hashmap_set() call failed due to the 
-// system being out of memory.
-bool hashmap_oom(struct hashmap *map) {
-    return map->oom;
+// hashmap_sharded_get copies the item matching `key` into `out`, which may
+// be NULL, and returns true. Returns false if there is no such item.
+bool hashmap_sharded_get(struct hashmap_sharded *map, const void *key,
+                         void *out)
+{
+    uint64_t hash = map->hash(key, map->seed0, map->seed1);
+    struct shard *shard = shard_for(map, hash);
+    pthread_rwlock_rdlock(&shard->lock);
+    void *item = hashmap_get_with_hash(shard->map, key, hash);
+    if (item && out) {
+        memcpy(out, item, map->elsize);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+    return item != NULL;
 }
 
-// hashmap_scan iterates over all items in the hash map
-// Param `iter` can return false to stop iteration early.
-// Returns false if the iteration has been stopped early.
-bool hashmap_scan(struct hashmap *map, 
-                  bool (*iter)(const void *item, void *udata), void *udata)
+// hashmap_sharded_set inserts or replaces an item. Returns 1 if an item was
+// replaced, copying it into `old` unless that is NULL, 0 if the item is new,
+// and -1 if the system is out of memory.
+int hashmap_sharded_set(struct hashmap_sharded *map, const void *item,
+                        void *old)
 {
-    for (size_t i = 0; i < map->nbuckets; i++) {
-        struct bucket *bucket = bucket_at(map, i);
-        if (bucket->dib) {
-            if (!iter(bucket_item(bucket), udata)) {
-                return false;
-            }
-        }
+    uint64_t hash = map->hash(item, map->seed0, map->seed1);
+    struct shard *shard = shard_for(map, hash);
+    int ret = 0;
+    pthread_rwlock_wrlock(&shard->lock);
+    void *prev = hashmap_set_with_hash(shard->map, item, hash);
+    if (prev) {
+        if (old) memcpy(old, prev, map->elsize);
+        ret = 1;
+    } else if (hashmap_oom(shard->map)) {
+        ret = -1;
     }
-    return true;
+    pthread_rwlock_unlock(&shard->lock);
+    return ret;
 }
 
-
-// hashmap_iter iterates one key at a time yielding a reference to an
-// entry at each iteration. Useful to write simple loops and avoid writing
-// dedicated callbacks and udata structures, as in hashmap_scan.
-//
-// map is a hash map handle. i is a pointer to a size_t cursor that
-// should be initialized to 0 at the beginning of the loop. item is a void
-// pointer pointer that is populated with the retrieved item. Note that this
-// is NOT a copy of the item stored in the hash map and can be directly
-// modified.
-//
-// Note that if hashmap_delete() is called on the hashmap being iterated,
-// the buckets are rearranged and the iterator must be reset to 0, otherwise
-// unexpected results may be returned after deletion.
-//
-// This function has not been tested for thread safety.
-//
-// The function returns true if an item was retrieved; false if the end of the
-// iteration has been reached.
-bool hashmap_iter(struct hashmap *map, size_t *i, void **item)
+// hashmap_sharded_delete removes the item matching `key`, copies it into
+// `out` unless that is NULL and returns true. Returns false if there is no
+// such item.
+bool hashmap_sharded_delete(struct hashmap_sharded *map, const void *key,
+                            void *out)
 {
-    struct bucket *bucket;
-
-    do {
-        if (*i >= map->nbuckets) return false;
-
-        bucket = bucket_at(map, *i);
-        (*i)++;
-    } while (!bucket->dib);
+    uint64_t hash = map->hash(key, map->seed0, map->seed1);
+    struct shard *shard = shard_for(map, hash);
+    pthread_rwlock_wrlock(&shard->lock);
+    void *item = hashmap_delete_with_hash(shard->map, key, hash);
+    if (item && out) {
+        memcpy(out, item, map->elsize);
+    }
+    pthread_rwlock_unlock(&shard->lock);
+    return item != NULL;
+}
 
-    *item = bucket_item(bucket);
+// hashmap_sharded_count returns the number of items in the map. Shards are
+// counted one at a time, so concurrent writers make this approximate.
+size_t hashmap_sharded_count(struct hashmap_sharded *map) {
+    size_t count = 0;
+    for (size_t i = 0; i < map->nshards; i++) {
+        pthread_rwlock_rdlock(&map->shards[i].lock);
+        count += hashmap_count(map->shards[i].map);
+        pthread_rwlock_unlock(&map->shards[i].lock);
+    }
+    return count;
+}
 
+// hashmap_sharded_scan iterates over all items, one shard at a time with
+// that shard read locked. `iter` must not modify the map.
+bool hashmap_sharded_scan(struct hashmap_sharded *map,
+                          bool (*iter)(const void *item, void *udata),
+                          void *udata)
+{
+    for (size_t i = 0; i < map->nshards; i++) {
+        pthread_rwlock_rdlock(&map->shards[i].lock);
+        bool ok = hashmap_scan(map->shards[i].map, iter, udata);
+        pthread_rwlock_unlock(&map->shards[i].lock);
+        if (!ok) {
+            return false;
+        }
+    }
     return true;
 }
 
@@ -596,6 +1816,150 @@ static void MM86128(const void *key, const int len, uint32_t seed, void *out) {
     ((uint32_t*)out)[3] = h4;
 }
 
+//-----------------------------------------------------------------------------
+// wyhash final 4 by Wang Yi, released into the public domain.
+// https://github.com/wangyi-fudan/wyhash
+//-----------------------------------------------------------------------------
+static const uint64_t WYP[4] = {
+    UINT64_C(0x2d358dccaa6c78a5), UINT64_C(0x8bb84b93962eacc9),
+    UINT64_C(0x4b33a62ed433d4a3), UINT64_C(0x4d5a2da51de1aa47),
+};
+
+static void wymum(uint64_t *a, uint64_t *b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32;
+    uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha*hb, rm0 = ha*lb, rm1 = hb*la, rl = la*lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static uint64_t wymix(uint64_t a, uint64_t b) {
+    wymum(&a, &b);
+    return a ^ b;
+}
+
+static uint64_t wyr8(const uint8_t *p) {
+    return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 |
+           (uint64_t)p[3] << 24 | (uint64_t)p[4] << 32 |
+           (uint64_t)p[5] << 40 | (uint64_t)p[6] << 48 |
+           (uint64_t)p[7] << 56;
+}
+
+static uint64_t wyr4(const uint8_t *p) {
+    return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 |
+           (uint64_t)p[3] << 24;
+}
+
+static uint64_t wyr3(const uint8_t *p, size_t k) {
+    return (uint64_t)p[0] << 16 | (uint64_t)p[k >> 1] << 8 | p[k-1];
+}
+
+static uint64_t WYHASH(const uint8_t *p, size_t len, uint64_t seed) {
+    uint64_t a, b;
+    seed ^= wymix(seed ^ WYP[0], WYP[1]);
+    if (len <= 16) {
+        if (len >= 4) {
+            a = wyr4(p) << 32 | wyr4(p+((len >> 3) << 2));
+            b = wyr4(p+len-4) << 32 | wyr4(p+len-4-((len >> 3) << 2));
+        } else if (len > 0) {
+            a = wyr3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wymix(wyr8(p) ^ WYP[1], wyr8(p+8) ^ seed);
+                see1 = wymix(wyr8(p+16) ^ WYP[2], wyr8(p+24) ^ see1);
+                see2 = wymix(wyr8(p+32) ^ WYP[3], wyr8(p+40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wymix(wyr8(p) ^ WYP[1], wyr8(p+8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wyr8(p+i-16);
+        b = wyr8(p+i-8);
+    }
+    a ^= WYP[1];
+    b ^= seed;
+    wymum(&a, &b);
+    return wymix(a ^ WYP[0] ^ len, b ^ WYP[1]);
+}
+
+//-----------------------------------------------------------------------------
+// AES-NI hash
+//
+// Every 16 byte block is used as the round key of one AES round over the
+// running state, four states in parallel for long input. The tail is the
+// last 16 bytes of the input, overlapping the previous block, or for short
+// input two overlapping loads. Three keyed rounds finish it off. Not a MAC,
+// just a fast well mixed hash for tables.
+//-----------------------------------------------------------------------------
+#ifdef __x86_64__
+__attribute__((target("aes")))
+static uint64_t AESHASH(const uint8_t *p, size_t len, uint64_t seed0,
+                        uint64_t seed1)
+{
+    const __m128i k0 = _mm_set_epi64x(seed1, seed0);
+    const __m128i k1 = _mm_xor_si128(k0, _mm_set_epi64x(WYP[0], WYP[1]));
+    __m128i h = _mm_xor_si128(k0, _mm_set_epi64x(0, len));
+    if (len > 64) {
+        __m128i h1 = _mm_xor_si128(h, _mm_set_epi64x(WYP[2], WYP[3]));
+        __m128i h2 = _mm_xor_si128(h, k1);
+        __m128i h3 = _mm_xor_si128(h1, k1);
+        for (; len > 64; p += 64, len -= 64) {
+            h = _mm_aesenc_si128(h, _mm_loadu_si128((const __m128i*)p));
+            h1 = _mm_aesenc_si128(h1, _mm_loadu_si128((const __m128i*)(p+16)));
+            h2 = _mm_aesenc_si128(h2, _mm_loadu_si128((const __m128i*)(p+32)));
+            h3 = _mm_aesenc_si128(h3, _mm_loadu_si128((const __m128i*)(p+48)));
+        }
+        h = _mm_aesenc_si128(h, h1);
+        h2 = _mm_aesenc_si128(h2, h3);
+        h = _mm_aesenc_si128(h, h2);
+    }
+    if (len >= 16) {
+        for (; len > 16; p += 16, len -= 16) {
+            h = _mm_aesenc_si128(h, _mm_loadu_si128((const __m128i*)p));
+        }
+        h = _mm_aesenc_si128(h, _mm_loadu_si128((const __m128i*)(p+len-16)));
+    } else if (len > 0) {
+        // overlapping loads like wyhash, the length is already in h
+        uint64_t lo, hi = 0;
+        if (len >= 8) {
+            lo = wyr8(p);
+            hi = wyr8(p+len-8);
+        } else if (len >= 4) {
+            lo = wyr4(p) << 32 | wyr4(p+len-4);
+        } else {
+            lo = wyr3(p, len);
+        }
+        h = _mm_aesenc_si128(h, _mm_set_epi64x(hi, lo));
+    }
+    h = _mm_aesenc_si128(h, k0);
+    h = _mm_aesenc_si128(h, k1);
+    h = _mm_aesenc_si128(h, k0);
+    return (uint64_t)_mm_cvtsi128_si64(h) ^
+           (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(h, h));
+}
+#endif
+
 // hashmap_sip returns a hash value for `data` using SipHash-2-4.
 uint64_t hashmap_sip(const void *data, size_t len, 
                      uint64_t seed0, uint64_t seed1)
@@ -612,10 +1976,34 @@ uint64_t hashmap_murmur(const void *data, size_t len,
     return *(uint64_t*)out;
 }
 
+// hashmap_wy returns a hash value for `data` using wyhash. It is much faster
+// than SipHash on short keys, but unlike SipHash makes no promise against
+// keys chosen by an attacker.
+uint64_t hashmap_wy(const void *data, size_t len,
+                    uint64_t seed0, uint64_t seed1)
+{
+    return WYHASH(data, len, seed0 ^ wymix(seed1, WYP[0]));
+}
+
+// hashmap_aes returns a hash value for `data` built from AES rounds. It
+// falls back to hashmap_wy when the CPU lacks AES-NI, so hash values are
+// only stable on one machine.
+uint64_t hashmap_aes(const void *data, size_t len,
+                     uint64_t seed0, uint64_t seed1)
+{
+#ifdef __x86_64__
+    if (__builtin_cpu_supports("aes")) {
+        return AESHASH(data, len, seed0, seed1);
+    }
+#endif
+    return hashmap_wy(data, len, seed0, seed1);
+}
+
 //==============================================================================
 // TESTS AND BENCHMARKS
-// $ cc -DHASHMAP_TEST hashmap.c && ./a.out              # run tests
-// $ cc -DHASHMAP_TEST -O3 hashmap.c && BENCH=1 ./a.out  # run benchmarks
+// $ cc -DHASHMAP_TEST -pthread hashmap.c alloc.c && ./a.out              # run tests
+// $ cc -DHASHMAP_TEST -pthread -O3 hashmap.c alloc.c && BENCH=1 ./a.out  # run benchmarks
+// add -DHASHMAP_STATS to check the resize and lookup counters as well
 //==============================================================================
 #ifdef HASHMAP_TEST
 
@@ -626,9 +2014,27 @@ static size_t deepcount(struct hashmap *map) {
             count++;
         }
     }
+    for (size_t i = 0; map->old && i < map->old_nbuckets; i++) {
+        if (old_at(map, i)->dib) {
+            count++;
+        }
+    }
     return count;
 }
 
+// every robinhood bucket's dib matches its distance from home
+static bool check_dibs(struct hashmap *map) {
+    for (size_t i = 0; !map->ctrl && i < map->nbuckets; i++) {
+        struct bucket *bucket = bucket_at(map, i);
+        if (bucket->dib &&
+            bucket->dib != ((i-bucket->hash) & map->mask)+1)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
 
 #pragma GCC diagnostic ignored "-Wextra"
 
@@ -638,7 +2044,9 @@ static size_t deepcount(struct hashmap *map) {
 #include <time.h>
 #include <assert.h>
 #include <stdio.h>
+#include <errno.h>
 #include "hashmap.h"
+#include "alloc.h"
 
 static bool rand_alloc_fail = false;
 static int rand_alloc_fail_odds = 3; // 1 in 3 chance malloc will fail.
@@ -706,10 +2114,33 @@ static void free_str(void *item) {
     xfree(*(char**)item);
 }
 
+// all() and benchmarks() run once per layout
+enum { ROBINHOOD, SWISS, INCREMENTAL, NLAYOUTS };
+static const char *layout_names[] = { "robinhood", "swiss", "incremental" };
+static int layout = ROBINHOOD;
+
+static struct hashmap *test_new(size_t elsize, size_t cap,
+                                uint64_t seed0, uint64_t seed1,
+                                uint64_t (*hash)(const void *item,
+                                                 uint64_t seed0, uint64_t seed1),
+                                int (*compare)(const void *a, const void *b,
+                                               void *udata),
+                                void (*elfree)(void *item),
+                                void *udata)
+{
+    struct hashmap *map = (layout == SWISS ? hashmap_new_swiss : hashmap_new)(
+        elsize, cap, seed0, seed1, hash, compare, elfree, udata);
+    if (map && layout == INCREMENTAL) {
+        hashmap_set_incremental(map, true);
+    }
+    return map;
+}
+
 static void all() {
     int seed = getenv("SEED")?atoi(getenv("SEED")):time(NULL);
     int N = getenv("N")?atoi(getenv("N")):2000;
-    printf("seed=%d, count=%d, item_size=%zu\n", seed, N, sizeof(int));
+    printf("seed=%d, count=%d, item_size=%zu, layout=%s\n", seed, N, sizeof(int),
+           layout_names[layout]);
     srand(seed);
 
     rand_alloc_fail = true;
@@ -718,6 +2149,28 @@ static void all() {
     assert(hashmap_sip("hello", 5, 1, 2) == 2957200328589801622);
     assert(hashmap_murmur("hello", 5, 1, 2) == 1682575153221130884);
 
+    // wyhash final 4 test vectors, and no collisions between the prefixes
+    // of a buffer, which covers every tail length of the aes hash
+    assert(hashmap_wy("", 0, 0, 0) == UINT64_C(0x93228a4de0eec5a2));
+    assert(hashmap_wy("abc", 3, 2, 0) == UINT64_C(0xa97f2f7b1d9b3314));
+    assert(hashmap_wy("message digest", 14, 3, 0) ==
+           UINT64_C(0x786d1f1df3801df4));
+    char buf[300];
+    uint64_t hashes[300*2];
+    for (int i = 0; i < 300; i++) {
+        buf[i] = rand();
+    }
+    for (int i = 0; i < 300; i++) {
+        hashes[i*2] = hashmap_wy(buf, i, seed, seed);
+        hashes[i*2+1] = hashmap_aes(buf, i, seed, seed);
+        assert(hashes[i*2+1] == hashmap_aes(buf, i, seed, seed));
+    }
+    for (int i = 0; i < 300*2; i++) {
+        for (int j = 0; j < i; j++) {
+            assert(hashes[i] != hashes[j]);
+        }
+    }
+
     int *vals;
     while (!(vals = xmalloc(N * sizeof(int)))) {}
     for (int i = 0; i < N; i++) {
@@ -726,7 +2179,7 @@ static void all() {
 
     struct hashmap *map;
 
-    while (!(map = hashmap_new(sizeof(int), 0, seed, seed, 
+    while (!(map = test_new(sizeof(int), 0, seed, seed, 
                                hash_int, compare_ints_udata, NULL, NULL))) {}
     shuffle(vals, N, sizeof(int));
     for (int i = 0; i < N; i++) {
@@ -787,6 +2240,88 @@ static void all() {
     }
     xfree(vals2);
 
+    // the hash taking variants agree with the plain ones
+    void **items;
+    while (!(items = xmalloc(N * sizeof(void*)))) {}
+    hashmap_get_many(map, vals, N, items);
+    for (int i = 0; i < N; i++) {
+        uint64_t hash = hash_int(&vals[i], seed, seed);
+        assert(items[i] && items[i] == hashmap_get(map, &vals[i]));
+        assert(items[i] == hashmap_get_with_hash(map, &vals[i], hash));
+    }
+    xfree(items);
+    int key = N;
+    uint64_t hash = hash_int(&key, seed, seed);
+    assert(!hashmap_get_with_hash(map, &key, hash));
+    while (true) {
+        assert(!hashmap_set_with_hash(map, &key, hash));
+        if (!hashmap_oom(map)) {
+            break;
+        }
+    }
+    int *v = hashmap_get_with_hash(map, &key, hash);
+    assert(v && *v == key);
+    v = hashmap_delete_with_hash(map, &key, hash);
+    assert(v && *v == key);
+    assert(map->count == N);
+
+    // a snapshot maps back with every item in place
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/hashmap-test-%d.snap", (int)getpid());
+    while (!hashmap_snapshot(map, path)) {}
+    struct hashmap *snap;
+    while (!(snap = hashmap_open_snapshot(path, sizeof(int), hash_int,
+                                          compare_ints_udata, NULL))) {}
+    assert(hashmap_count(snap) == N);
+    for (int i = 0; i < N; i++) {
+        int *v = hashmap_get(snap, &vals[i]);
+        assert(v && *v == vals[i]);
+    }
+    assert(!hashmap_get(snap, &key));
+    assert(!hashmap_open_snapshot(path, sizeof(int)*2, hash_int,
+                                  compare_ints_udata, NULL));
+    hashmap_free(snap);
+    // a full table, where a miss would never stop, and sizes that overflow
+    // are turned down
+    struct snapshot hdr;
+    int fd = open(path, O_RDWR);
+    assert(fd != -1 && pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr));
+    struct snapshot bad = hdr;
+    bad.count = bad.nbuckets;
+    assert(pwrite(fd, &bad, sizeof(bad), 0) == sizeof(bad));
+    assert(!hashmap_open_snapshot(path, sizeof(int), hash_int,
+                                  compare_ints_udata, NULL));
+    bad = hdr;
+    bad.nbuckets = (uint64_t)1 << 62;
+    bad.bucketsz = (uint64_t)1 << 40;
+    assert(pwrite(fd, &bad, sizeof(bad), 0) == sizeof(bad));
+    assert(!hashmap_open_snapshot(path, sizeof(int), hash_int,
+                                  compare_ints_udata, NULL));
+    close(fd);
+    unlink(path);
+
+    // the histogram accounts for every item, and with the counters compiled
+    // in one more miss and one more hit show up
+    struct hashmap_stats stats;
+    hashmap_stats(map, &stats);
+    size_t total = 0;
+    for (int i = 0; i < HASHMAP_STATS_DIBS; i++) {
+        total += stats.dibs[i];
+    }
+    assert(total == N && stats.count == N);
+    assert(stats.max_dib >= 1 && stats.avg_dib >= 1);
+    assert(stats.avg_dib <= stats.max_dib);
+#ifdef HASHMAP_STATS
+    assert(stats.counted && (map->nbuckets == 16 || stats.resizes > 0));
+    assert(!hashmap_get(map, &key));
+    assert(hashmap_get(map, &vals[0]));
+    struct hashmap_stats stats2;
+    hashmap_stats(map, &stats2);
+    assert(stats2.misses == stats.misses+1 && stats2.hits == stats.hits+1);
+#else
+    assert(!stats.counted && !stats.hits);
+#endif
+
     shuffle(vals, N, sizeof(int));
     for (int i = 0; i < N; i++) {
         int *v;
@@ -833,10 +2368,54 @@ static void all() {
 
     hashmap_free(map);
 
+    // bulk load every value twice over, into an empty map and then into a
+    // full one, and a table filled right up to its limit so that some items
+    // run off the end
+    int *dups;
+    while (!(dups = xmalloc(N*2*sizeof(int)))) {}
+    for (int i = 0; i < N; i++) {
+        dups[i] = vals[i];
+        dups[N+i] = vals[N-1-i];
+    }
+    for (int n = N; n >= 12; n = n == N ? 12 : 0) {
+        while (!(map = test_new(sizeof(int), 0, seed, seed, hash_int,
+                                compare_ints_udata, NULL, NULL))) {}
+        while (!hashmap_bulk_load(map, dups, n < N ? n : N*2)) {}
+        while (!hashmap_bulk_load(map, vals, n)) {}
+        assert(hashmap_count(map) == n && deepcount(map) == n);
+        assert(check_dibs(map));
+        for (int i = 0; i < n; i++) {
+            int *v = hashmap_get(map, &vals[i]);
+            assert(v && *v == vals[i]);
+        }
+        for (int i = 0; i < n; i++) {
+            assert(hashmap_delete(map, &vals[i]));
+        }
+        assert(hashmap_count(map) == 0);
+        hashmap_free(map);
+    }
+    xfree(dups);
+
+    // a reserved map does not resize before it holds that many
+    while (!(map = test_new(sizeof(int), 0, seed, seed, hash_int,
+                            compare_ints_udata, NULL, NULL))) {}
+    while (!hashmap_reserve(map, N)) {}
+    size_t nbuckets = map->nbuckets;
+    for (int i = 0; i < N; i++) {
+        while (true) {
+            assert(!hashmap_set(map, &vals[i]));
+            if (!hashmap_oom(map)) {
+                break;
+            }
+        }
+    }
+    assert(map->nbuckets == nbuckets);
+    hashmap_free(map);
+
     xfree(vals);
 
 
-    while (!(map = hashmap_new(sizeof(char*), 0, seed, seed,
+    while (!(map = test_new(sizeof(char*), 0, seed, seed,
                                hash_str, compare_strs, free_str, NULL)));
 
     for (int i = 0; i < N; i++) {
@@ -864,6 +2443,104 @@ static void all() {
     }
 }
 
+struct sharded_worker {
+    struct hashmap_sharded *map;
+    int *vals;
+    int n;
+    int stride;
+    int offset;
+};
+
+// each worker owns the vals where i%stride == offset but reads everything
+static void *sharded_work(void *arg) {
+    struct sharded_worker *w = arg;
+    unsigned seed = w->offset;
+    int v;
+    for (int i = w->offset; i < w->n; i += w->stride) {
+        assert(hashmap_sharded_set(w->map, &w->vals[i], NULL) == 0);
+        assert(hashmap_sharded_get(w->map, &w->vals[i], &v) && v == w->vals[i]);
+        int j = rand_r(&seed) % w->n;
+        if (hashmap_sharded_get(w->map, &w->vals[j], &v)) {
+            assert(v == w->vals[j]);
+        }
+    }
+    for (int i = w->offset; i < w->n; i += 2*w->stride) {
+        assert(hashmap_sharded_delete(w->map, &w->vals[i], &v));
+        assert(v == w->vals[i]);
+    }
+    return NULL;
+}
+
+static bool count_ints(const void *item, void *udata) {
+    (*(size_t*)udata)++;
+    return true;
+}
+
+static void sharded() {
+    int N = getenv("N")?atoi(getenv("N")):2000;
+    int seed = time(NULL);
+    rand_alloc_fail = false;
+
+    int *vals = xmalloc(N * sizeof(int));
+    for (int i = 0; i < N; i++) {
+        vals[i] = i;
+    }
+    shuffle(vals, N, sizeof(int));
+
+    struct hashmap_sharded *map;
+    map = hashmap_sharded_new(sizeof(int), 0, 5, seed, seed, hash_int,
+                              compare_ints_udata, NULL, NULL);
+    assert(map && map->nshards == 8);
+    int v = -1;
+    for (int i = 0; i < N; i++) {
+        assert(!hashmap_sharded_get(map, &vals[i], &v));
+        assert(hashmap_sharded_set(map, &vals[i], &v) == 0);
+        assert(hashmap_sharded_set(map, &vals[i], &v) == 1 && v == vals[i]);
+        assert(hashmap_sharded_count(map) == (size_t)i+1);
+    }
+    size_t count = 0;
+    assert(hashmap_sharded_scan(map, count_ints, &count) && count == N);
+    for (int i = 0; i < N; i++) {
+        assert(hashmap_sharded_get(map, &vals[i], &v) && v == vals[i]);
+        assert(hashmap_sharded_delete(map, &vals[i], &v) && v == vals[i]);
+        assert(!hashmap_sharded_delete(map, &vals[i], NULL));
+    }
+    assert(hashmap_sharded_count(map) == 0);
+    hashmap_sharded_free(map);
+
+    // the xmalloc counters are not atomic, use the system allocator here
+    hashmap_set_allocator(NULL, NULL);
+    enum { NTHREADS = 4 };
+    pthread_t threads[NTHREADS];
+    struct sharded_worker workers[NTHREADS];
+    map = hashmap_sharded_new(sizeof(int), 0, 0, seed, seed, hash_int,
+                              compare_ints_udata, NULL, NULL);
+    assert(map);
+    for (int i = 0; i < NTHREADS; i++) {
+        workers[i] = (struct sharded_worker){ map, vals, N, NTHREADS, i };
+        assert(pthread_create(&threads[i], NULL, sharded_work, &workers[i]) == 0);
+    }
+    for (int i = 0; i < NTHREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    // every worker deleted every other one of its own vals
+    size_t expect = 0;
+    for (int i = 0; i < N; i++) {
+        bool deleted = (i % NTHREADS == i % (2*NTHREADS));
+        assert(hashmap_sharded_get(map, &vals[i], NULL) == !deleted);
+        expect += !deleted;
+    }
+    assert(hashmap_sharded_count(map) == expect);
+    hashmap_sharded_free(map);
+    hashmap_set_allocator(xmalloc, xfree);
+
+    xfree(vals);
+    if (total_allocs != 0) {
+        fprintf(stderr, "total_allocs: expected 0, got %lu\n", total_allocs);
+        exit(1);
+    }
+}
+
 #define bench(name, N, code) {{ \
     if (strlen(name) > 0) { \
         printf("%-14s ", name); \
@@ -897,10 +2574,95 @@ static void all() {
     printf("\n"); \
 }}
 
+static void bench_hashes() {
+    static const struct {
+        const char *name;
+        uint64_t (*hash)(const void *, size_t, uint64_t, uint64_t);
+    } hashes[] = {
+        { "sip", hashmap_sip },
+        { "murmur", hashmap_murmur },
+        { "wy", hashmap_wy },
+        { "aes", hashmap_aes },
+    };
+    char *data = xmalloc(4096);
+    for (int i = 0; i < 4096; i++) {
+        data[i] = rand();
+    }
+    volatile uint64_t sink = 0;
+    for (size_t len = 4; len <= 4096; len *= 4) {
+        for (size_t h = 0; h < sizeof(hashes)/sizeof(hashes[0]); h++) {
+            char name[32];
+            snprintf(name, sizeof(name), "%s %zuB", hashes[h].name, len);
+            int N = (64<<20)/len;
+            bench(name, N, {
+                sink ^= hashes[h].hash(data, len, i, 0);
+                bytes += len;
+            })
+        }
+    }
+    (void)sink;
+    xfree(data);
+}
+
+// slab_alloc against the system allocator, for raw churn and as the allocator
+// behind a map
+static void bench_alloc() {
+    static const struct {
+        const char *name;
+        void *(*malloc)(size_t);
+        void *(*realloc)(void *, size_t);
+        void (*free)(void *);
+    } allocs[] = {
+        { "malloc", malloc, realloc, free },
+        { "slab", slab_alloc, slab_realloc, slab_free },
+    };
+    int N = getenv("N")?atoi(getenv("N")):5000000;
+    void **ptrs = xmalloc(64 * sizeof(void*));
+    int *vals = xmalloc(N * sizeof(int));
+    for (int i = 0; i < N; i++) {
+        vals[i] = i;
+    }
+    shuffle(vals, N, sizeof(int));
+    for (size_t a = 0; a < sizeof(allocs)/sizeof(allocs[0]); a++) {
+        char name[32];
+        for (size_t sz = 16; sz <= 4096; sz *= 16) {
+            // keep 64 blocks live so the free lists are not a single slot
+            for (int i = 0; i < 64; i++) {
+                ptrs[i] = allocs[a].malloc(sz);
+            }
+            snprintf(name, sizeof(name), "%s %zuB", allocs[a].name, sz);
+            bench(name, N, {
+                allocs[a].free(ptrs[i&63]);
+                ptrs[i&63] = allocs[a].malloc(sz);
+                assert(ptrs[i&63]);
+            })
+            for (int i = 0; i < 64; i++) {
+                allocs[a].free(ptrs[i]);
+            }
+        }
+
+        struct hashmap *map = hashmap_new_with_allocator(allocs[a].malloc,
+            allocs[a].realloc, allocs[a].free, sizeof(int), 0, 0, 0, hash_int,
+            compare_ints_udata, NULL, NULL);
+        snprintf(name, sizeof(name), "%s set", allocs[a].name);
+        bench(name, N, {
+            assert(!hashmap_set(map, &vals[i]));
+        })
+        snprintf(name, sizeof(name), "%s delete", allocs[a].name);
+        bench(name, N, {
+            assert(hashmap_delete(map, &vals[i]));
+        })
+        hashmap_free(map);
+    }
+    xfree(vals);
+    xfree(ptrs);
+}
+
 static void benchmarks() {
     int seed = getenv("SEED")?atoi(getenv("SEED")):time(NULL);
     int N = getenv("N")?atoi(getenv("N")):5000000;
-    printf("seed=%d, count=%d, item_size=%zu\n", seed, N, sizeof(int));
+    printf("seed=%d, count=%d, item_size=%zu, layout=%s\n", seed, N, sizeof(int),
+           layout_names[layout]);
     srand(seed);
 
 
@@ -914,8 +2676,8 @@ static void benchmarks() {
     struct hashmap *map;
     shuffle(vals, N, sizeof(int));
 
-    map = hashmap_new(sizeof(int), 0, seed, seed, hash_int, compare_ints_udata, 
-                      NULL, NULL);
+    map = test_new(sizeof(int), 0, seed, seed, hash_int, compare_ints_udata, 
+                   NULL, NULL);
     bench("set", N, {
         int *v = hashmap_set(map, &vals[i]);
         assert(!v);
@@ -925,6 +2687,38 @@ static void benchmarks() {
         int *v = hashmap_get(map, &vals[i]);
         assert(v && *v == vals[i]);
     })
+    void **items = xmalloc(N * sizeof(void*));
+    bench("get_many", N, {
+        if (i % GET_MANY_BATCH == 0) {
+            size_t n = N-i < GET_MANY_BATCH ? N-i : GET_MANY_BATCH;
+            hashmap_get_many(map, &vals[i], n, &items[i]);
+        }
+    })
+    for (int i = 0; i < N; i++) {
+        assert(items[i] && *(int*)items[i] == vals[i]);
+    }
+    xfree(items);
+    bench("get (miss)", N, {
+        int key = N+vals[i];
+        assert(!hashmap_get(map, &key));
+    })
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/hashmap-bench-%d.snap", (int)getpid());
+    struct hashmap *snap = NULL;
+    bench("snapshot", 1, {
+        assert(hashmap_snapshot(map, path));
+    })
+    bench("open snapshot", 1, {
+        snap = hashmap_open_snapshot(path, sizeof(int), hash_int,
+                                     compare_ints_udata, NULL);
+        assert(snap);
+    })
+    bench("get (snapshot)", N, {
+        int *v = hashmap_get(snap, &vals[i]);
+        assert(v && *v == vals[i]);
+    })
+    hashmap_free(snap);
+    unlink(path);
     shuffle(vals, N, sizeof(int));
     bench("delete", N, {
         int *v = hashmap_delete(map, &vals[i]);
@@ -932,8 +2726,25 @@ static void benchmarks() {
     })
     hashmap_free(map);
 
-    map = hashmap_new(sizeof(int), N, seed, seed, hash_int, compare_ints_udata, 
-                      NULL, NULL);
+    // the slowest single set is the one that triggers a resize
+    map = test_new(sizeof(int), 0, seed, seed, hash_int, compare_ints_udata,
+                   NULL, NULL);
+    double worst = 0;
+    for (int i = 0; i < N; i++) {
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        hashmap_set(map, &vals[i]);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double ns = (t1.tv_sec-t0.tv_sec)*1e9 + (t1.tv_nsec-t0.tv_nsec);
+        if (ns > worst) {
+            worst = ns;
+        }
+    }
+    printf("%-14s %.3f ms\n", "set (worst)", worst/1e6);
+    hashmap_free(map);
+
+    map = test_new(sizeof(int), N, seed, seed, hash_int, compare_ints_udata, 
+                   NULL, NULL);
     bench("set (cap)", N, {
         int *v = hashmap_set(map, &vals[i]);
         assert(!v);
@@ -951,6 +2762,20 @@ static void benchmarks() {
 
     hashmap_free(map);
 
+    map = test_new(sizeof(int), 0, seed, seed, hash_int, compare_ints_udata,
+                   NULL, NULL);
+    bench("bulk_load", N, {
+        if (i == 0) {
+            assert(hashmap_bulk_load(map, vals, N));
+        }
+    })
+    shuffle(vals, N, sizeof(int));
+    bench("get (bulk)", N, {
+        int *v = hashmap_get(map, &vals[i]);
+        assert(v && *v == vals[i]);
+    })
+    hashmap_free(map);
+
     
     xfree(vals);
 
@@ -965,10 +2790,17 @@ int main() {
 
     if (getenv("BENCH")) {
         printf("Running hashmap.c benchmarks...\n");
-        benchmarks();
+        for (layout = 0; layout < NLAYOUTS; layout++) {
+            benchmarks();
+        }
+        bench_hashes();
+        bench_alloc();
     } else {
         printf("Running hashmap.c tests...\n");
-        all();
+        for (layout = 0; layout < NLAYOUTS; layout++) {
+            all();
+        }
+        sharded();
         printf("PASSED\n");
     }
 }
@@ -0,0 +1,133 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <algorithms.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algo_utils.h>
+#include <hashmap.h>
+
+/* reads one key per line from stdin and loads them into a hashmap the way a
+ * dedup pass would, a get for every line and a set for the new ones, then
+ * prints what the map looks like inside. the hash, layout and initial
+ * capacity come from the environment so they can be compared on the same
+ * data. */
+
+struct key {
+    char *s;
+    size_t len;
+};
+
+static const struct {
+    const char *name;
+    uint64_t (*fn)(const void *data, size_t len, uint64_t seed0, uint64_t seed1);
+} hashes[] = {
+    { "sip", hashmap_sip },
+    { "murmur", hashmap_murmur },
+    { "wy", hashmap_wy },
+    { "aes", hashmap_aes },
+};
+
+static uint64_t (*key_hash_fn)(const void *, size_t, uint64_t, uint64_t);
+
+static uint64_t key_hash(const void *item, uint64_t seed0, uint64_t seed1) {
+    const struct key *k = item;
+    return key_hash_fn(k->s, k->len, seed0, seed1);
+}
+
+static int key_compare(const void *a, const void *b, void *udata) {
+    const struct key *ka = a, *kb = b;
+    (void)udata;
+    if(ka->len != kb->len) return ka->len < kb->len ? -1 : 1;
+    return memcmp(ka->s, kb->s, ka->len);
+}
+
+static void key_free(void *item) {
+    free(((struct key *)item)->s);
+}
+
+void algo_hashstats(void) {
+    const char *hash_name = getenv("ENCRO_HASH");
+    const char *layout = getenv("ENCRO_HASHMAP");
+    const char *cap = getenv("ENCRO_HASHCAP");
+    struct hashmap *map;
+    struct hashmap_stats st;
+    uint64_t seeds[2];
+    char *line = NULL;
+    size_t linecap = 0, lines = 0;
+    ssize_t n;
+    double secs;
+    size_t i;
+
+    if(!hash_name) hash_name = "sip";
+    if(!layout) layout = "robinhood";
+    for(i = 0; i < sizeof(hashes)/sizeof(hashes[0]); i++)
+        if(strcmp(hashes[i].name, hash_name) == 0) break;
+    if(i == sizeof(hashes)/sizeof(hashes[0])) {
+        fprintf(stderr, "unknown hash %s, expected sip, murmur, wy or aes\n", hash_name);
+        return;
+    }
+    key_hash_fn = hashes[i].fn;
+
+    keygen((uint8_t *)seeds, sizeof(seeds));
+    if(strcmp(layout, "swiss") == 0)
+        map = hashmap_new_swiss(sizeof(struct key), cap ? strtoull(cap, NULL, 0) : 0,
+                                seeds[0], seeds[1], key_hash, key_compare, key_free, NULL);
+    else if(strcmp(layout, "robinhood") == 0 || strcmp(layout, "incremental") == 0)
+        map = hashmap_new(sizeof(struct key), cap ? strtoull(cap, NULL, 0) : 0,
+                          seeds[0], seeds[1], key_hash, key_compare, key_free, NULL);
+    else {
+        fprintf(stderr, "unknown layout %s, expected robinhood, swiss or incremental\n", layout);
+        return;
+    }
+    if(!map) {
+        fprintf(stderr, "out of memory\n");
+        return;
+    }
+    if(strcmp(layout, "incremental") == 0) hashmap_set_incremental(map, 1);
+
+    secs = time_now();
+    while((n = getline(&line, &linecap, stdin)) > 0) {
+        struct key k = { line, n };
+
+        lines++;
+        if(line[n-1] == '\n') k.len--;
+        if(hashmap_get(map, &k)) continue;
+        if(!(k.s = malloc(k.len ? k.len : 1))) break;
+        memcpy(k.s, line, k.len);
+        if(!hashmap_set(map, &k) && hashmap_oom(map)) {
+            free(k.s);
+            break;
+        }
+    }
+    secs = time_now() - secs;
+    free(line);
+    if(!feof(stdin)) fprintf(stderr, "out of memory, stats cover the first %zu lines\n", lines);
+
+    hashmap_stats(map, &st);
+    printf("lines: %zu, keys: %zu, %.3f s\n", lines, st.count, secs);
+    printf("hash: %s, layout: %s\n", hash_name, layout);
+    printf("buckets: %zu, load: %.3f\n", st.nbuckets, st.load);
+    printf("dib: avg %.3f, max %zu\n", st.avg_dib, st.max_dib);
+    for(i = 0; i < HASHMAP_STATS_DIBS; i++) {
+        if(!st.dibs[i]) continue;
+        printf("  %2zu%s %12zu %6.2f%%\n", i+1, i == HASHMAP_STATS_DIBS-1 ? "+" : " ",
+               st.dibs[i], st.count ? 100.0 * st.dibs[i] / st.count : 0);
+    }
+    if(st.counted) {
+        printf("resizes: %llu, %.3f ms\n", (unsigned long long)st.resizes,
+               st.resize_ns / 1e6);
+        printf("get: %llu hits, %llu misses, %.2f%% hits\n",
+               (unsigned long long)st.hits, (unsigned long long)st.misses,
+               st.hits + st.misses ? 100.0 * st.hits / (st.hits + st.misses) : 0);
+    } else {
+        printf("resizes and gets not counted, build with STATS=1\n");
+    }
+
+    hashmap_free(map);
+}
+
+REGISTER_ALGORITHM("hashstats", algo_hashstats, NULL, NULL);
@@ -2,30 +2,56 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
-#include <time.h>
 
-#include <hashmap.h>
 #include <algorithms.h>
+#include <algo_utils.h>
 
 const char *usage =
-"Usage: %s algorithm\n"
+"Usage: %s algorithm [-d] [--encoding=enc] [--verify[=size]]\n"
 "\n"
 "Algorithms:\n"
-"  caesar, vigenere, fakersa, rsa, aes, atbash\n";
-
-struct algorithm {
-  char *name;
-  void (*fn)();
-};
-
-int algo_compar(const void *a, const void *b, void *udata __attribute__((unused))) {
-  const struct algorithm *aa = a, *ab = b;
-  return strcmp(aa->name, ab->name);
-}
+"  caesar, vigenere, fakersa, rsa, aes, aes-ctr, chacha20,\n  atbash\n"
+"\n"
+"Cryptanalysis:\n"
+"  vigenere-crack\n"
+"\n"
+"Tools:\n"
+"  hashstats        load one key per line from stdin into a hashmap and\n"
+"                   print its probe lengths, resizes and hit rate\n"
+"  bench            throughput and latency of every cipher from 16B to 1G,\n"
+"                   see encro bench --help\n"
+"  serve            encryption daemon on a unix socket, see encro serve --help\n"
+"  client           encrypt stdin with a running encro serve\n"
+"  loadgen          keep encro serve busy and report requests/s and latency\n"
+"  batch            one cipher and key over every line or length-prefixed\n"
+"                   record of stdin, see encro batch --help\n"
+"  files            aes-ctr or chacha20 over whole files with io_uring,\n"
+"                   see encro files --help\n"
+"  pipe             caesar, vigenere, atbash, aes-ctr or chacha20 from stdin to\n"
+"                   stdout as raw bytes, zero-copy into a pipe with vmsplice\n"
+"\n"
+"Options:\n"
+"  -d               decrypt instead of encrypt\n"
+"  --encoding=enc   ciphertext of aes, aes-ctr, chacha20 and fakersa as hex\n"
+"                   (default), base64 or raw bytes. -d takes hex or base64\n"
+"                   whatever this says\n"
+"  --verify[=size]  round-trip size bytes (default 16M) in memory and\n"
+"                   report throughput for both directions\n"
+"\n"
+"Environment:\n"
+"  ENCRO_AES        AES engine, bitslice (constant-time, default) or ref\n"
+"  ENCRO_CHACHA     ChaCha20 kernel, avx2, sse2 or portable (default is the\n"
+"                   fastest one the cpu supports)\n"
+"  ENCRO_CODEC      hex and base64 kernel, avx2, ssse3 or portable (default\n"
+"                   is the fastest one the cpu supports)\n"
+"  ENCRO_HASH       hashstats hash, sip (default), murmur, wy or aes\n"
+"  ENCRO_HASHMAP    hashstats layout, robinhood (default), swiss or\n"
+"                   incremental\n"
+"  ENCRO_HASHCAP    hashstats initial capacity\n";
 
-uint64_t algo_hash(const void *item, uint64_t seed0, uint64_t seed1) {
-  const struct algorithm *algo = item;
-  return hashmap_sip(algo->name, strlen(algo->name), seed0, seed1);
+int algo_compar(const void *key, const void *elem) {
+  const struct algorithm *algo = elem;
+  return strcmp(key, algo->name);
 }
 
 void die_usage(char *name) {
@@ -34,38 +60,52 @@ void die_usage(char *name) {
 }
 
 int main(int argc, char *argv[]) {
-  struct hashmap *algo_map;
-  struct algorithm *algo;
+  const struct algorithm *algo;
+  int decrypt = 0, encoding;
+  size_t verify = 0;
 
   if(argc < 2) die_usage(argv[0]);
 
-  srand(time(NULL));
-
-  algo_map = hashmap_new(sizeof(struct algorithm), 0, 0, 0,
-                         algo_hash, algo_compar, NULL, NULL);
+  algo = bsearch(argv[1], algo_table, algo_count, sizeof *algo_table, algo_compar);
+  if(!algo) die_usage(argv[0]);
+  if(algo->command) exit(algo->command(argc - 1, argv + 1));
 
-  hashmap_set(algo_map, &(struct algorithm){
-    .name = "caesar", .fn = algo_caesar,
-  });
-  hashmap_set(algo_map, &(struct algorithm){
-    .name = "vigenere", .fn = algo_vigenere,
-  });
-  hashmap_set(algo_map, &(struct algorithm){
-    .name = "fakersa", .fn = algo_fake_rsa,
-  });
-  hashmap_set(algo_map, &(struct algorithm){
-    .name = "rsa", .fn = algo_rsa,
-  });
-  hashmap_set(algo_map, &(struct algorithm){
-    .name = "aes", .fn = algo_aes,
-  });
-  hashmap_set(algo_map, &(struct algorithm){
-    .name = "atbash", .fn = algo_atbash,
-  });
+  for(int i = 2; i < argc; i++) {
+    if(strcmp(argv[i], "-d") == 0)
+      decrypt = 1;
+    else if(strcmp(argv[i], "--verify") == 0)
+      verify = VERIFY_SIZE;
+    else if(strncmp(argv[i], "--verify=", 9) == 0) {
+      if(!(verify = parse_size(argv[i] + 9))) die_usage(argv[0]);
+    }
+    else if(strncmp(argv[i], "--encoding=", 11) == 0 &&
+            (encoding = parse_encoding(argv[i] + 11)) >= 0)
+      ciphertext_encoding = encoding;
+    else
+      die_usage(argv[0]);
+  }
 
-  algo = hashmap_get(algo_map, &(struct algorithm){ .name = argv[1] });
-  if(algo) algo->fn();
-  else die_usage(argv[0]);
+  if(verify) {
+    if(!algo->verify) {
+      fprintf(stderr, "%s: --verify not supported\n", algo->name);
+      exit(EXIT_FAILURE);
+    }
+    exit(algo->verify(verify) ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+  if(decrypt) {
+    /* raw ciphertext can hold newlines, so there is no line to read it from */
+    if(ciphertext_encoding == ENCODING_RAW) {
+      fprintf(stderr, "%s: -d takes hex or base64, not raw\n", algo->name);
+      exit(EXIT_FAILURE);
+    }
+    if(!algo->decrypt) {
+      fprintf(stderr, "%s: -d not supported\n", algo->name);
+      exit(EXIT_FAILURE);
+    }
+    algo->decrypt();
+  } else {
+    algo->encrypt();
+  }
 
   exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,166 @@
+#define _GNU_SOURCE                     /* syscall */
+
+#include <perf.h>
+
+#ifdef ENCRO_PERF
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static const char *region_names[PERF_REGIONS] = {
+    [PERF_KEY_EXPANSION] = "key expansion",
+    [PERF_BLOCK] = "block",
+    [PERF_PADDING] = "padding",
+    [PERF_CLASSICAL] = "classical",
+    [PERF_POWMOD] = "powmod",
+    [PERF_IO] = "i/o",
+    [PERF_FORMAT] = "formatting",
+};
+
+enum { CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES };
+
+static const uint64_t events[PERF_COUNTERS] = {
+    [CYCLES] = PERF_COUNT_HW_CPU_CYCLES,
+    [INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+    [CACHE_MISSES] = PERF_COUNT_HW_CACHE_MISSES,
+    [BRANCH_MISSES] = PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+struct totals {
+    uint64_t calls, ns;
+    uint64_t counters[PERF_COUNTERS];
+};
+
+/* added to with atomics by every thread */
+static struct totals totals[PERF_REGIONS];
+static unsigned available;              /* bit per counter some thread has */
+
+struct perf_thread {
+    int init;
+    int fds[PERF_COUNTERS];             /* fds[0] leads the group */
+    unsigned n, which[PERF_COUNTERS];   /* the counters that opened, in group order */
+};
+
+static __thread struct perf_thread self;
+static pthread_key_t thread_key;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static void report_at_exit(void) {
+    perf_report(stderr, "encro");
+}
+
+static void thread_exit(void *arg) {
+    struct perf_thread *t = arg;
+    for(unsigned i = 0; i < t->n; i++) close(t->fds[i]);
+    t->n = 0;
+}
+
+static void global_init(void) {
+    pthread_key_create(&thread_key, thread_exit);
+    atexit(report_at_exit);
+}
+
+static void thread_init(struct perf_thread *t) {
+    struct perf_event_attr attr;
+
+    pthread_once(&once, global_init);
+    t->init = 1;
+    for(unsigned i = 0; i < PERF_COUNTERS; i++) {
+        int fd;
+
+        memset(&attr, 0, sizeof attr);
+        attr.size = sizeof attr;
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = events[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+        /* this thread on any cpu, the first that opens leads */
+        fd = syscall(__NR_perf_event_open, &attr, 0, -1, t->n ? t->fds[0] : -1, 0);
+        if(fd < 0) continue;
+        t->fds[t->n] = fd;
+        t->which[t->n++] = i;
+        __atomic_fetch_or(&available, 1u << i, __ATOMIC_RELAXED);
+    }
+    pthread_setspecific(thread_key, t);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void read_counters(const struct perf_thread *t, uint64_t *counters) {
+    struct { uint64_t nr, values[PERF_COUNTERS]; } group;
+
+    memset(counters, 0, PERF_COUNTERS * sizeof *counters);
+    if(!t->n || read(t->fds[0], &group, sizeof group) < (ssize_t)sizeof group.nr) return;
+    for(unsigned i = 0; i < group.nr && i < t->n; i++)
+        counters[t->which[i]] = group.values[i];
+}
+
+void perf_begin(struct perf_sample *s) {
+    if(!self.init) thread_init(&self);
+    s->ns = now_ns();
+    read_counters(&self, s->counters);
+}
+
+void perf_end(enum perf_region region, const struct perf_sample *s) {
+    uint64_t counters[PERF_COUNTERS], ns;
+    struct totals *t = &totals[region];
+
+    read_counters(&self, counters);
+    ns = now_ns();
+    __atomic_fetch_add(&t->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&t->ns, ns - s->ns, __ATOMIC_RELAXED);
+    for(unsigned i = 0; i < PERF_COUNTERS; i++)
+        __atomic_fetch_add(&t->counters[i], counters[i] - s->counters[i], __ATOMIC_RELAXED);
+}
+
+static void print_per_call(FILE *f, unsigned counter, uint64_t total, uint64_t calls) {
+    if(available & 1u << counter) fprintf(f, " %16.1f", (double)total / calls);
+    else fprintf(f, " %16s", "-");
+}
+
+void perf_report(FILE *f, const char *title) {
+    int header = 0;
+
+    for(unsigned r = 0; r < PERF_REGIONS; r++) {
+        struct totals t;
+
+        t.calls = __atomic_exchange_n(&totals[r].calls, 0, __ATOMIC_RELAXED);
+        t.ns = __atomic_exchange_n(&totals[r].ns, 0, __ATOMIC_RELAXED);
+        for(unsigned i = 0; i < PERF_COUNTERS; i++)
+            t.counters[i] = __atomic_exchange_n(&totals[r].counters[i], 0, __ATOMIC_RELAXED);
+        if(!t.calls) continue;
+
+        if(!header) {
+            fprintf(f, "%s:\n", title);
+            fprintf(f, "%-14s %10s %12s %12s %16s %6s %16s %16s\n", "region", "calls", "ms",
+                    "ns/call", "cycles/call", "IPC", "cache-miss/call", "branch-miss/call");
+            header = 1;
+        }
+        fprintf(f, "%-14s %10"PRIu64" %12.3f %12.1f", region_names[r], t.calls,
+                t.ns / 1e6, (double)t.ns / t.calls);
+        print_per_call(f, CYCLES, t.counters[CYCLES], t.calls);
+        if((available & 1u << CYCLES) && (available & 1u << INSTRUCTIONS) && t.counters[CYCLES])
+            fprintf(f, " %6.2f", (double)t.counters[INSTRUCTIONS] / t.counters[CYCLES]);
+        else
+            fprintf(f, " %6s", "-");
+        print_per_call(f, CACHE_MISSES, t.counters[CACHE_MISSES], t.calls);
+        print_per_call(f, BRANCH_MISSES, t.counters[BRANCH_MISSES], t.calls);
+        fprintf(f, "\n");
+    }
+    if(header && !available)
+        fprintf(f, "no hardware counters, perf_event_open needs a PMU and "
+                   "kernel.perf_event_paranoid <= 2\n");
+}
+
+#endif
@@ -0,0 +1,279 @@
+#define _GNU_SOURCE                     /* splice, vmsplice, copy_file_range, F_SETPIPE_SZ */
+
+#include <algorithms.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <cipher.h>
+#include <perf.h>
+#include <rng.h>
+#include <stream.h>
+
+/* encro pipe runs a stream cipher from stdin to stdout with no prompts, for
+ * shell pipelines. aes-ctr and chacha20 output starts with a random iv or
+ * nonce, like a file of encro files, and -d reads it back first. the input is read in chunks as large as the input pipe can
+ * be made and encrypted in place, a read from a pipe or terminal goes out
+ * with what it got rather than wait for more. when stdout is a pipe too the
+ * pages are handed to it with vmsplice(2) instead of being copied by
+ * write(2): there are two buffers the size of the output pipe and only a read
+ * that fills one up is vmspliced, so once a whole buffer has gone into the
+ * pipe nothing of the one before can still be in it and that one can be read
+ * into again. shorter reads are copied by write(2) and leave the buffer free
+ * to be read into right away. if the reader grows the pipe that no longer
+ * holds and the rest goes through write(2).
+ * a key that changes nothing is passed straight through with
+ * copy_file_range(2) between regular files and splice(2) from or to a pipe,
+ * every other byte has to come through here to be encrypted anyway. */
+
+#define PIPE_CHUNK (1<<20)              /* size asked of both pipes, pipe-max-size by default */
+
+/* read(2) until sz bytes or end of file, returns how many or -1 */
+static ssize_t read_full(int fd, uint8_t *buf, size_t sz) {
+    size_t done = 0;
+
+    PERF_BEGIN(PERF_IO);
+    while(done < sz) {
+        ssize_t n = read(fd, buf + done, sz - done);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            done = (size_t)-1;
+            break;
+        }
+        if(n == 0) break;
+        done += n;
+    }
+    PERF_END(PERF_IO);
+    return done;
+}
+
+static int vmsplice_all(int fd, uint8_t *buf, size_t sz) {
+    struct iovec iov = { buf, sz };
+    int ret = 0;
+
+    PERF_BEGIN(PERF_IO);
+    while(iov.iov_len > 0) {
+        ssize_t n = vmsplice(fd, &iov, 1, 0);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            ret = -1;
+            break;
+        }
+        iov.iov_base = (uint8_t *)iov.iov_base + n;
+        iov.iov_len -= n;
+    }
+    PERF_END(PERF_IO);
+    return ret;
+}
+
+static int is_pipe(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+static int is_file(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+static int is_identity(const struct cipher_key *k) {
+    const struct encro_vigenere *v = &k->u.vigenere[0];
+
+    switch(k->algo) {
+    case CIPHER_CAESAR:
+        return k->u.shift == 0;
+    case CIPHER_VIGENERE:
+        for(size_t i = 0; i < v->len; i++)
+            if(v->shift[i]) return 0;
+        return 1;
+    }
+    return 0;
+}
+
+/* read, encrypt and write(2) in chunk sized pieces */
+static int run_copy(int in, int out, struct cipher_key *k, int decrypt) {
+    /* pipes and terminals give what they have, files fill the buffer */
+    int whole = is_file(in), ret = 0;
+    uint8_t *buf;
+    ssize_t n;
+
+    if(posix_memalign((void **)&buf, sysconf(_SC_PAGESIZE), PIPE_CHUNK) != 0) {
+        fprintf(stderr, "pipe: out of memory\n");
+        return -1;
+    }
+    while((n = whole ? read_full(in, buf, PIPE_CHUNK) : read(in, buf, PIPE_CHUNK)) != 0) {
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            ret = -1;
+            break;
+        }
+        cipher_message(k, decrypt, buf, n);
+        if(stream_write(out, buf, n) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+    free(buf);
+    return ret;
+}
+
+static int run_vmsplice(int in, int out, struct cipher_key *k, int decrypt) {
+    long size = fcntl(out, F_SETPIPE_SZ, PIPE_CHUNK);
+    uint8_t *buf[2];
+    unsigned i = 0;
+    int whole = is_file(in), ret = 0;
+
+    if(size < 0) size = fcntl(out, F_GETPIPE_SZ);
+    if(size <= 0) return run_copy(in, out, k, decrypt);
+    /* mapped rather than malloced, pages still in the pipe stay valid after
+     * munmap but malloc could hand them out again */
+    buf[0] = mmap(NULL, 2*size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(buf[0] == MAP_FAILED) return run_copy(in, out, k, decrypt);
+    buf[1] = buf[0] + size;
+
+    for(;;) {
+        ssize_t n;
+
+        if(fcntl(out, F_GETPIPE_SZ) > size) {
+            ret = run_copy(in, out, k, decrypt);
+            break;
+        }
+        if((n = whole ? read_full(in, buf[i], size) : read(in, buf[i], size)) <= 0) {
+            if(n < 0 && errno == EINTR) continue;
+            ret = n < 0 ? -1 : 0;
+            break;
+        }
+        cipher_message(k, decrypt, buf[i], n);
+        if(n < size) {
+            if(stream_write(out, buf[i], n) < 0) {
+                ret = -1;
+                break;
+            }
+            continue;
+        }
+        if(vmsplice_all(out, buf[i], n) < 0) {
+            ret = -1;
+            break;
+        }
+        i ^= 1;
+    }
+    munmap(buf[0], 2*size);
+    return ret;
+}
+
+/* returns 1 if it copied everything, 0 if the kernel can't do it for these
+ * two and nothing was copied yet, or -1 */
+static int pass_through(int in, int out) {
+    int ret = 1, file = is_file(in) && is_file(out);
+    size_t total = 0;
+
+    if(!file && !is_pipe(in) && !is_pipe(out)) return 0;
+    PERF_BEGIN(PERF_IO);
+    for(;;) {
+        ssize_t n = file ? copy_file_range(in, NULL, out, NULL, SSIZE_MAX, 0)
+                         : splice(in, NULL, out, NULL, PIPE_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            /* EXDEV, EINVAL for O_APPEND or a file system without it and so on */
+            ret = total ? -1 : 0;
+            break;
+        }
+        if(n == 0) break;
+        total += n;
+    }
+    PERF_END(PERF_IO);
+    return ret;
+}
+
+static int pipe_usage(void) {
+    fprintf(stderr,
+        "Usage: encro pipe [options] algorithm [-d]\n"
+        "\n"
+        "  --key=key        the shift for caesar, the key for vigenere and the key in\n"
+        "                   hex for aes-ctr and chacha20. their output starts with a\n"
+        "                   random iv or nonce\n"
+        "  --copy           write(2) to a pipe, not vmsplice(2). for when what reads\n"
+        "                   stdout splices the data on (pv does), the pages stay\n"
+        "                   shared with encro until they are read\n"
+        "  -d               decrypt instead of encrypt\n"
+        "\n"
+        "stdin to stdout as raw bytes, a pipe buffer at a time\n"
+        "Algorithms: caesar, vigenere, atbash, aes-ctr, chacha20\n");
+    return EXIT_FAILURE;
+}
+
+int cmd_pipe(int argc, char *argv[]) {
+    const char *keystr = NULL, *name = NULL;
+    uint8_t material[CIPHER_KEYSZ], nonce[CIPHER_NONCESZ];
+    struct cipher_key key;
+    unsigned algo = 0;
+    int decrypt = 0, copy = 0, ret;
+    ssize_t n;
+    size_t ns;
+
+    for(int i = 1; i < argc; i++) {
+        if(strncmp(argv[i], "--key=", 6) == 0)
+            keystr = argv[i] + 6;
+        else if(strcmp(argv[i], "--copy") == 0)
+            copy = 1;
+        else if(strcmp(argv[i], "-d") == 0)
+            decrypt = 1;
+        else if(!algo && argv[i][0] != '-')
+            algo = cipher_algo(name = argv[i]);
+        else
+            return pipe_usage();
+    }
+    /* a missing key would be shift 0 and copy the plaintext out as it is */
+    if(!algo || (!keystr && algo != CIPHER_ATBASH)) return pipe_usage();
+    if(algo == CIPHER_AES) {
+        fprintf(stderr, "pipe: aes pads whole messages, use aes-ctr\n");
+        return pipe_usage();
+    }
+    if((n = cipher_parse_key(algo, keystr ? keystr : "", material, sizeof material)) < 0 ||
+       cipher_key_init(&key, algo, material, n) < 0) {
+        fprintf(stderr, "pipe: bad key for %s\n", name);
+        return pipe_usage();
+    }
+    if((ns = cipher_nonce_size(algo))) {
+        if(!decrypt) {
+            encro_rng_bytes(nonce, ns);
+            if(stream_write(STDOUT_FILENO, nonce, ns) < 0) {
+                perror("pipe");
+                return EXIT_FAILURE;
+            }
+        } else if((n = read_full(STDIN_FILENO, nonce, ns)) != (ssize_t)ns) {
+            if(n < 0) perror("pipe");
+            else fprintf(stderr, "pipe: input too short for the %s nonce\n", name);
+            return EXIT_FAILURE;
+        }
+        cipher_set_nonce(&key, nonce);
+    }
+
+    /* bigger reads from a pipe, it's fine if we may not */
+    if(is_pipe(STDIN_FILENO)) fcntl(STDIN_FILENO, F_SETPIPE_SZ, PIPE_CHUNK);
+    if(is_file(STDIN_FILENO)) posix_fadvise(STDIN_FILENO, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    if(is_identity(&key) && (ret = pass_through(STDIN_FILENO, STDOUT_FILENO)) != 0)
+        ret = ret < 0 ? -1 : 0;
+    else if(!copy && is_pipe(STDOUT_FILENO))
+        ret = run_vmsplice(STDIN_FILENO, STDOUT_FILENO, &key, decrypt);
+    else
+        ret = run_copy(STDIN_FILENO, STDOUT_FILENO, &key, decrypt);
+
+    if(ret < 0) {
+        perror("pipe");
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+REGISTER_COMMAND("pipe", cmd_pipe);
@@ -0,0 +1,149 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <rng.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/random.h>
+
+#include <chacha20.h>
+
+/* the buffer is 16 blocks of keystream under a key of its own, the first 32
+ * bytes become the key for the next refill and every byte is wiped as it is
+ * handed out, so nothing in memory can be used to recover earlier output.
+ * requests of RNG_DIRECT bytes or more take a key and nonce from the buffer
+ * and get the keystream written straight into them. */
+
+#define RNG_BUF    (16*ENCRO_CHACHA20_BLOCKLEN)
+#define RNG_DIRECT RNG_BUF
+
+struct rng {
+    uint8_t key[ENCRO_CHACHA20_KEYLEN];
+    uint8_t buf[RNG_BUF];
+    size_t pos;                         /* bytes of buf used up */
+    unsigned long generation;           /* 0 until seeded */
+    const struct encro_chacha20_kernel *kernel;
+};
+
+static __thread struct rng rng;
+
+/* bumped in the child after fork so every thread state there reseeds */
+static unsigned long generation = 1;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+/* a memset the compiler can't drop because the memory is never read again */
+static void *(*volatile wipe)(void *, int, size_t) = memset;
+
+static void forked(void) {
+    generation++;
+}
+
+static void atfork_init(void) {
+    pthread_atfork(NULL, NULL, forked);
+}
+
+static void seed(struct rng *r) {
+    size_t done = 0;
+    ssize_t n;
+    int fd;
+
+    pthread_once(&atfork_once, atfork_init);
+    while(done < sizeof r->key) {
+        if((n = getrandom(r->key + done, sizeof r->key - done, 0)) < 0) {
+            if(errno == EINTR) continue;
+            break;
+        }
+        done += n;
+    }
+    /* kernels older than 3.17 */
+    if(done < sizeof r->key && (fd = open("/dev/urandom", O_RDONLY)) >= 0) {
+        while(done < sizeof r->key && (n = read(fd, r->key + done, sizeof r->key - done)) > 0)
+            done += n;
+        close(fd);
+    }
+    if(done < sizeof r->key) {
+        fprintf(stderr, "rng: no entropy source, refusing to make up keys\n");
+        abort();
+    }
+    r->kernel = encro_chacha20_default_kernel();
+    r->pos = RNG_BUF;
+    r->generation = generation;
+}
+
+static void refill(struct rng *r) {
+    static const uint8_t nonce[ENCRO_CHACHA20_NONCELEN];
+    struct encro_chacha20_ctx ctx;
+
+    encro_chacha20_init_kernel(&ctx, r->kernel, r->key, nonce, 0);
+    memset(r->buf, 0, RNG_BUF);
+    encro_chacha20_xcrypt_buf(&ctx, r->buf, RNG_BUF);
+    memcpy(r->key, r->buf, sizeof r->key);
+    wipe(r->buf, 0, sizeof r->key);
+    wipe(&ctx, 0, sizeof ctx);
+    r->pos = sizeof r->key;
+}
+
+static void take(struct rng *r, uint8_t *p, size_t sz) {
+    size_t n;
+
+    while(sz) {
+        if(r->pos == RNG_BUF) refill(r);
+        n = RNG_BUF - r->pos < sz ? RNG_BUF - r->pos : sz;
+        memcpy(p, r->buf + r->pos, n);
+        wipe(r->buf + r->pos, 0, n);
+        r->pos += n;
+        p += n;
+        sz -= n;
+    }
+}
+
+void encro_rng_bytes(void *buf, size_t sz) {
+    struct rng *r = &rng;
+    uint8_t kn[ENCRO_CHACHA20_KEYLEN + ENCRO_CHACHA20_NONCELEN];
+    struct encro_chacha20_ctx ctx;
+
+    if(r->generation != generation) seed(r);
+    if(sz < RNG_DIRECT) {
+        take(r, buf, sz);
+        return;
+    }
+    take(r, kn, sizeof kn);
+    encro_chacha20_init_kernel(&ctx, r->kernel, kn, kn + ENCRO_CHACHA20_KEYLEN, 0);
+    memset(buf, 0, sz);
+    encro_chacha20_xcrypt_buf(&ctx, buf, sz);
+    wipe(kn, 0, sizeof kn);
+    wipe(&ctx, 0, sizeof ctx);
+}
+
+uint32_t encro_rng_u32(void) {
+    uint32_t x;
+    encro_rng_bytes(&x, sizeof x);
+    return x;
+}
+
+uint64_t encro_rng_u64(void) {
+    uint64_t x;
+    encro_rng_bytes(&x, sizeof x);
+    return x;
+}
+
+/* Lemire's multiply and reject, no modulo bias and usually no division */
+uint32_t encro_rng_uniform(uint32_t bound) {
+    uint64_t m = (uint64_t)encro_rng_u32() * bound;
+    uint32_t low = m, threshold;
+
+    if(low < bound) {
+        threshold = -bound % bound;
+        while(low < threshold) {
+            m = (uint64_t)encro_rng_u32() * bound;
+            low = m;
+        }
+    }
+    return m >> 32;
+}
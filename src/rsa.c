@@ -1,17 +1,28 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <algorithms.h>
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <inttypes.h>
 
+#include <algo_utils.h>
+#include <encro.h>
+#include <perf.h>
+
 #define RABIN_MILLER_ITER 5
 
+/* square-and-multiply, m is at most 32 bits so c*b never overflows */
 static uintmax_t powmod(uintmax_t b, uintmax_t e, uintmax_t m) {
     if(m == 1) return 0;
     uintmax_t c = 1;
 
-    for(uintmax_t i = 0; i < e; i++)
-        c = (c*b) % m;
+    b %= m;
+    for(; e; e >>= 1) {
+        if(e & 1) c = (c*b) % m;
+        b = (b*b) % m;
+    }
     return c;
 }
 
@@ -42,7 +53,7 @@ static int rabin_miller(uint32_t candidate) {
     while(even % 2 == 0) even >>= 1, max_div_2++;
 
     for(unsigned i = 0; i < RABIN_MILLER_ITER; i++) {
-        uint32_t round_tester = rand()*(candidate - 2) + 2;
+        uint32_t round_tester = 2 + encro_rng_uniform(candidate - 3);
 
         if(powmod(round_tester, even, candidate) == 1)
             continue;
@@ -73,7 +84,7 @@ static uintmax_t generate_prime(uint8_t bit) {
 
 redo:
     /* generate an odd number with bit-length "bit" */
-    candidate = (1<<(bit-1)) | (1<<0) | ((rand() % (1<<(bit-2)))<<1);
+    candidate = (1<<(bit-1)) | (1<<0) | (encro_rng_uniform(1<<(bit-2))<<1);
 
     for(uint8_t i = 0; i < sizeof(primes)/sizeof(primes[0]); i++)
         if(candidate % primes[i] == 0)
@@ -84,41 +95,209 @@ redo:
     return candidate;
 }
 
-void algo_fake_rsa(void) {
+void encro_rsa_keygen(struct encro_rsa_key *key) {
     uint16_t p, q;
-    uint32_t e, d, n, totient;
-    char buf[256];
+    uint32_t totient;
 
+    PERF_BEGIN(PERF_KEY_EXPANSION);
     do
         p = generate_prime(16), q = generate_prime(16);
     while(p == q);
-    n = p*q; totient = (p-1)*(q-1);
-    e = 65537;
-    d = modinv(e, totient);
+    key->n = (uint32_t)p*q; totient = (uint32_t)(p-1)*(q-1);
+    key->e = 65537;
+    key->d = modinv(key->e, totient);
+    PERF_END(PERF_KEY_EXPANSION);
+}
+
+uint32_t encro_rsa_encrypt(const struct encro_rsa_key *key, uint32_t m) {
+    return powmod(m, key->e, key->n);
+}
+
+uint32_t encro_rsa_decrypt(const struct encro_rsa_key *key, uint32_t c) {
+    return powmod(c, key->d, key->n);
+}
+
+/* each byte becomes one word, see algo_fake_rsa */
+void encro_fake_rsa_encrypt(uint32_t *out, const uint8_t *in, size_t sz,
+                      const struct encro_rsa_key *key) {
+    /* a region per word would be mostly the counter reads */
+    PERF_BEGIN(PERF_POWMOD);
+    for(size_t i = 0; i < sz; i++)
+        out[i] = encro_rsa_encrypt(key, in[i]);
+    PERF_END(PERF_POWMOD);
+}
+
+void encro_fake_rsa_decrypt(uint8_t *out, const uint32_t *in, size_t sz,
+                      const struct encro_rsa_key *key) {
+    PERF_BEGIN(PERF_POWMOD);
+    for(size_t i = 0; i < sz; i++)
+        out[i] = encro_rsa_decrypt(key, in[i]);
+    PERF_END(PERF_POWMOD);
+}
+
+void algo_fake_rsa(void) {
+    struct encro_rsa_key key;
+    char *buf = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    uint32_t *c;
+
+    encro_rsa_keygen(&key);
 
     /* this is horribly space-inefficient especially for large values of n
      * (which is at most 4 bytes here) */
     printf("plaintext: ");
-    fgets(buf, sizeof buf, stdin);
-    printf("ciphertext (hex): ");
-    for(char *c = buf; *c; c++)
-        printf("%08"PRIX32, (uint32_t)powmod(*c, e, n));
-    printf("\n(d, n) = (%"PRIu32", %"PRIu32")\n", d, n);
+    if((len = getline(&buf, &cap, stdin)) < 0) len = 0;
+    if(!(c = malloc(len * sizeof *c + 1))) {
+        fprintf(stderr, "out of memory\n");
+        free(buf);
+        return;
+    }
+    encro_fake_rsa_encrypt(c, (uint8_t *)buf, len, &key);
+
+    /* big endian bytes, so hex is still 8 digits a word */
+    for(ssize_t i = 0; i < len; i++) {
+        uint32_t w = c[i];
+        ((uint8_t *)c)[4*i] = w >> 24;
+        ((uint8_t *)c)[4*i+1] = w >> 16;
+        ((uint8_t *)c)[4*i+2] = w >> 8;
+        ((uint8_t *)c)[4*i+3] = w;
+    }
+    printf("ciphertext: "); print_ciphertext((uint8_t *)c, len * sizeof *c);
+    printf("(d, n) = (%"PRIu32", %"PRIu32")\n", key.d, key.n);
+    free(c);
+    free(buf);
+}
+
+void algo_fake_rsa_decrypt(void) {
+    struct encro_rsa_key key = { 0 };
+    char *buf = NULL;
+    size_t cap = 0, n = 0;
+    ssize_t len;
+    uint32_t *c;
+    uint8_t *m;
+
+    printf("ciphertext: ");
+    if((len = getline(&buf, &cap, stdin)) < 0) len = 0;
+    printf("d: ");
+    scanf("%"SCNu32, &key.d);
+    printf("n: ");
+    scanf("%"SCNu32, &key.n);
+
+    if(key.n == 0) {
+        fprintf(stderr, "n must be nonzero\n");
+        free(buf);
+        return;
+    }
+
+    c = malloc(len + sizeof *c);
+    m = malloc(len/4 + 1);
+    if(!c || !m) {
+        fprintf(stderr, "out of memory\n");
+        goto out;
+    }
+    if((n = parse_ciphertext((uint8_t *)c, buf ? buf : "", len)) == (size_t)-1) {
+        fprintf(stderr, "ciphertext must be hex or base64\n");
+        goto out;
+    }
+    n /= sizeof *c;
+    for(size_t i = 0; i < n; i++) {
+        uint8_t *word = (uint8_t *)&c[i];
+        c[i] = (uint32_t)word[0]<<24 | word[1]<<16 | word[2]<<8 | word[3];
+    }
+    encro_fake_rsa_decrypt(m, c, n, &key);
+    m[n] = '\0';
+    printf("plaintext: %s", m);
+    if(n == 0 || m[n-1] != '\n') printf("\n");
+
+out:
+    free(m);
+    free(c);
+    free(buf);
 }
 
 void algo_rsa(void) {
-    uint16_t p, q;
-    uint32_t e, d, n, totient, m;
+    struct encro_rsa_key key;
+    uint32_t m = 0;
 
-    do
-        p = generate_prime(16), q = generate_prime(16);
-    while(p == q);
-    n = p*q; totient = (p-1)*(q-1);
-    e = 65537;
-    d = modinv(e, totient);
+    encro_rsa_keygen(&key);
 
     printf("m: ");
     scanf("%"SCNu32, &m);
-    printf("c: %"PRIu32"\n", (uint32_t)powmod(m, e, n));
-    printf("\n(d, n) = (%"PRIu32", %"PRIu32")\n", d, n);
+    printf("c: %"PRIu32"\n", encro_rsa_encrypt(&key, m));
+    printf("\n(d, n) = (%"PRIu32", %"PRIu32")\n", key.d, key.n);
+}
+
+void algo_rsa_decrypt(void) {
+    struct encro_rsa_key key = { 0 };
+    uint32_t c = 0;
+
+    printf("c: ");
+    scanf("%"SCNu32, &c);
+    printf("d: ");
+    scanf("%"SCNu32, &key.d);
+    printf("n: ");
+    scanf("%"SCNu32, &key.n);
+    if(key.n == 0) {
+        fprintf(stderr, "n must be nonzero\n");
+        return;
+    }
+    printf("m: %"PRIu32"\n", encro_rsa_decrypt(&key, c));
 }
+
+int verify_fake_rsa(size_t sz) {
+    struct encro_rsa_key key;
+    uint8_t *orig = malloc(sz), *buf = malloc(sz);
+    uint32_t *c = malloc(sz * sizeof *c);
+    double t0, t1, t2;
+    int ok = 0;
+
+    if(!orig || !buf || !c) goto out;
+    encro_rsa_keygen(&key);
+    random_text((char *)orig, sz);
+
+    t0 = time_now();
+    encro_fake_rsa_encrypt(c, orig, sz, &key);
+    t1 = time_now();
+    encro_fake_rsa_decrypt(buf, c, sz, &key);
+    t2 = time_now();
+
+    ok = verify_report("fakersa", sz, t1 - t0, t2 - t1, memcmp(orig, buf, sz) == 0);
+out:
+    free(orig); free(buf); free(c);
+    return ok;
+}
+
+/* sz bytes worth of 32-bit messages below n */
+int verify_rsa(size_t sz) {
+    struct encro_rsa_key key;
+    size_t n = sz / sizeof(uint32_t);
+    uint32_t *orig = malloc(n * sizeof *orig), *c = malloc(n * sizeof *c);
+    double t0, t1, t2;
+    int ok = 1;
+
+    if(!orig || !c) {
+        free(orig); free(c);
+        return 0;
+    }
+    encro_rsa_keygen(&key);
+    for(size_t i = 0; i < n; i++)
+        orig[i] = encro_rng_uniform(key.n);
+
+    t0 = time_now();
+    for(size_t i = 0; i < n; i++)
+        c[i] = encro_rsa_encrypt(&key, orig[i]);
+    t1 = time_now();
+    for(size_t i = 0; i < n; i++)
+        c[i] = encro_rsa_decrypt(&key, c[i]);
+    t2 = time_now();
+
+    for(size_t i = 0; i < n; i++)
+        ok &= c[i] == orig[i];
+    ok = verify_report("rsa", n * sizeof *c, t1 - t0, t2 - t1, ok);
+    free(orig); free(c);
+    return ok;
+}
+
+REGISTER_ALGORITHM("fakersa", algo_fake_rsa, algo_fake_rsa_decrypt, verify_fake_rsa);
+REGISTER_ALGORITHM("rsa", algo_rsa, algo_rsa_decrypt, verify_rsa);
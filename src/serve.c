@@ -0,0 +1,387 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <algorithms.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <algo_utils.h>
+#include <alloc.h>
+#include <cipher.h>
+#include <hashmap.h>
+#include <rng.h>
+#include <serve.h>
+
+/* every worker waits on the same epoll set, connections are registered
+ * oneshot so only one worker at a time reads a connection and its requests
+ * are answered in order. a worker answers one request and rearms the
+ * connection, so a client that keeps its connection open only holds a worker
+ * while its request is being worked on. connections are nonblocking and a
+ * request has SERVE_TIMEOUT from when the worker picks it up until the last
+ * byte of the reply is out, so a client trickling in a byte at a time can't
+ * hold on to a worker either. key schedules are expanded once on
+ * SERVE_ADD_KEY and kept in a sharded map, each request copies its key into
+ * the worker's own context and only sets the iv or nonce, see cipher.h. */
+
+#define SERVE_TIMEOUT 5                 /* seconds a whole request and its reply may take */
+
+struct serve_key {
+    uint64_t handle;
+    struct cipher_key cipher;
+};
+
+struct worker {
+    pthread_t tid;
+    struct serve_key key;
+    uint8_t *buf;
+    size_t cap;
+};
+
+static const char *errors[] = {
+    [SERVE_OK] = "ok",
+    [SERVE_EBADREQ] = "bad request",
+    [SERVE_ENOKEY] = "no such key",
+    [SERVE_ETOOBIG] = "payload too big",
+    [SERVE_EDECRYPT] = "bad ciphertext",
+    [SERVE_ENOMEM] = "out of memory",
+};
+
+static int epfd, lfd;
+static struct hashmap_sharded *keys;
+
+const char *serve_strerror(uint32_t status) {
+    if(status >= sizeof errors / sizeof errors[0]) return "unknown error";
+    return errors[status];
+}
+
+int serve_connect(const char *path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    int fd;
+
+    if(strlen(path) >= sizeof addr.sun_path) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) return -1;
+    if(connect(fd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+/* waits for a nonblocking fd until deadline, a time_now() or 0 for none
+ * returns 0 when it is ready or interrupted, -1 with errno ETIMEDOUT after */
+static int wait_fd(int fd, short events, double deadline) {
+    struct pollfd pfd = { fd, events, 0 };
+    double left = deadline - time_now();
+    int n;
+
+    if(deadline && left <= 0) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    if((n = poll(&pfd, 1, deadline ? (int)(left * 1000) + 1 : -1)) < 0)
+        return errno == EINTR ? 0 : -1;
+    return 0;
+}
+
+static int read_by(int fd, void *buf, size_t sz, double deadline) {
+    uint8_t *p = buf;
+    size_t done = 0;
+    ssize_t n;
+
+    while(done < sz) {
+        if((n = read(fd, p + done, sz - done)) < 0) {
+            if(errno == EINTR) continue;
+            if((errno == EAGAIN || errno == EWOULDBLOCK) && wait_fd(fd, POLLIN, deadline) == 0)
+                continue;
+            return -1;
+        }
+        if(n == 0) return done ? -1 : 0;
+        done += n;
+    }
+    return 1;
+}
+
+static int write_by(int fd, struct iovec *iov, int n, double deadline) {
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = n };
+    ssize_t sent;
+
+    while(msg.msg_iovlen) {
+        /* a client that went away must not kill the server with SIGPIPE */
+        if((sent = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0) {
+            if(errno == EINTR) continue;
+            if((errno == EAGAIN || errno == EWOULDBLOCK) && wait_fd(fd, POLLOUT, deadline) == 0)
+                continue;
+            return -1;
+        }
+        while(msg.msg_iovlen && (size_t)sent >= msg.msg_iov->iov_len) {
+            sent -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if(msg.msg_iovlen) {
+            msg.msg_iov->iov_base = (uint8_t *)msg.msg_iov->iov_base + sent;
+            msg.msg_iov->iov_len -= sent;
+        }
+    }
+    return 0;
+}
+
+int serve_read(int fd, void *buf, size_t sz) {
+    return read_by(fd, buf, sz, 0);
+}
+
+int serve_write(int fd, struct iovec *iov, int n) {
+    return write_by(fd, iov, n, 0);
+}
+
+static uint64_t key_hash(const void *item, uint64_t seed0, uint64_t seed1) {
+    const struct serve_key *k = item;
+    return hashmap_sip(&k->handle, sizeof k->handle, seed0, seed1);
+}
+
+static int key_compare(const void *a, const void *b, void *udata) {
+    const struct serve_key *ka = a, *kb = b;
+    (void)udata;
+    return ka->handle < kb->handle ? -1 : ka->handle > kb->handle;
+}
+
+static int add_key(struct worker *w, const struct serve_request *req, size_t *len) {
+    struct serve_key *k = &w->key;
+
+    if(req->algo == CIPHER_ATBASH || cipher_key_init(&k->cipher, req->algo, w->buf, req->len) < 0)
+        return SERVE_EBADREQ;
+    do keygen((uint8_t *)&k->handle, sizeof k->handle);
+    while(k->handle == 0 || hashmap_sharded_get(keys, k, NULL));
+    if(hashmap_sharded_set(keys, k, NULL) < 0) return SERVE_ENOMEM;
+    memcpy(w->buf, &k->handle, sizeof k->handle);
+    *len = sizeof k->handle;
+    return SERVE_OK;
+}
+
+/* runs the cipher on the payload in place, *len is updated for padding and
+ * the iv or nonce. the payload to encrypt was read in after room for it */
+static int run_cipher(struct worker *w, const struct serve_request *req, size_t *len) {
+    struct serve_key *k = &w->key;
+    size_t ns = cipher_nonce_size(req->algo);
+
+    if(req->algo == CIPHER_ATBASH && req->key == 0) {
+        cipher_key_init(&k->cipher, CIPHER_ATBASH, NULL, 0);
+    } else {
+        k->handle = req->key;
+        if(!hashmap_sharded_get(keys, k, k) || k->cipher.algo != req->algo)
+            return SERVE_ENOKEY;
+    }
+    if(req->op == SERVE_ENCRYPT) {
+        encro_rng_bytes(w->buf, ns);
+        cipher_set_nonce(&k->cipher, w->buf);
+        *len = ns + cipher_message(&k->cipher, 0, w->buf + ns, req->len);
+        return SERVE_OK;
+    }
+    if(req->len < ns) return SERVE_EDECRYPT;
+    cipher_set_nonce(&k->cipher, w->buf);
+    if((*len = cipher_message(&k->cipher, 1, w->buf + ns, req->len - ns)) == (size_t)-1)
+        return SERVE_EDECRYPT;
+    memmove(w->buf, w->buf + ns, *len);
+    return SERVE_OK;
+}
+
+/* answers one request, returns -1 if the connection should be closed */
+static int serve_one(struct worker *w, int fd) {
+    struct serve_request req;
+    struct serve_reply rep = { 0, SERVE_OK };
+    struct iovec iov[2];
+    size_t len = 0, off;
+    double deadline = time_now() + SERVE_TIMEOUT;
+    int close_after = 0;
+
+    if(read_by(fd, &req, sizeof req, deadline) <= 0) return -1;
+
+    /* room for the iv or nonce in front and the padding block of aes */
+    off = req.op == SERVE_ENCRYPT ? cipher_nonce_size(req.algo) : 0;
+    if(req.len > SERVE_MAX_PAYLOAD) {
+        rep.status = SERVE_ETOOBIG;
+        close_after = 1;
+    } else if(w->cap < req.len + CIPHER_NONCESZ + ENCRO_AES_BLOCKLEN) {
+        uint8_t *buf = slab_realloc(w->buf, req.len + CIPHER_NONCESZ + ENCRO_AES_BLOCKLEN);
+        if(buf) {
+            w->buf = buf;
+            w->cap = req.len + CIPHER_NONCESZ + ENCRO_AES_BLOCKLEN;
+        } else {
+            rep.status = SERVE_ENOMEM;
+            close_after = 1;
+        }
+    }
+    if(!close_after) {
+        if(read_by(fd, w->buf + off, req.len, deadline) < 0) return -1;
+        switch(req.op) {
+        case SERVE_ADD_KEY:
+            rep.status = add_key(w, &req, &len);
+            break;
+        case SERVE_DEL_KEY:
+            w->key.handle = req.key;
+            if(!hashmap_sharded_delete(keys, &w->key, NULL)) rep.status = SERVE_ENOKEY;
+            break;
+        case SERVE_ENCRYPT:
+        case SERVE_DECRYPT:
+            rep.status = run_cipher(w, &req, &len);
+            break;
+        default:
+            rep.status = SERVE_EBADREQ;
+        }
+    }
+
+    rep.len = rep.status == SERVE_OK ? len : 0;
+    iov[0].iov_base = &rep;
+    iov[0].iov_len = sizeof rep;
+    iov[1].iov_base = w->buf;
+    iov[1].iov_len = rep.len;
+    if(write_by(fd, iov, rep.len ? 2 : 1, deadline) < 0) return -1;
+    return close_after ? -1 : 0;
+}
+
+static void rearm(int fd) {
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLONESHOT, .data.fd = fd };
+    if(epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) < 0) close(fd);
+}
+
+static void accept_all(void) {
+    int fd;
+
+    while((fd = accept(lfd, NULL, NULL)) >= 0) {
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLONESHOT, .data.fd = fd };
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) close(fd);
+    }
+    if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        perror("serve: accept");
+}
+
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+    struct epoll_event ev;
+
+    for(;;) {
+        if(epoll_wait(epfd, &ev, 1, -1) < 1) continue;
+        if(ev.data.fd == lfd) {
+            accept_all();
+            rearm(lfd);
+        } else if(serve_one(w, ev.data.fd) < 0) {
+            close(ev.data.fd);
+        } else {
+            rearm(ev.data.fd);
+        }
+    }
+    return NULL;
+}
+
+static int serve_usage(void) {
+    fprintf(stderr,
+        "Usage: encro serve [options]\n"
+        "\n"
+        "  --socket=path    where to listen (default " SERVE_SOCKET ")\n"
+        "  --workers=n      worker threads (default all cpus)\n");
+    return EXIT_FAILURE;
+}
+
+int cmd_serve(int argc, char *argv[]) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    unsigned nworkers = ncpu > 0 ? ncpu : 1;
+    const char *path = SERVE_SOCKET;
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLONESHOT };
+    struct worker *workers;
+    uint64_t seeds[2];
+    sigset_t sigs;
+    mode_t mask;
+    int fd, sig;
+
+    for(int i = 1; i < argc; i++) {
+        if(strncmp(argv[i], "--socket=", 9) == 0)
+            path = argv[i] + 9;
+        else if(strncmp(argv[i], "--workers=", 10) == 0)
+            nworkers = strtoul(argv[i] + 10, NULL, 10);
+        else
+            return serve_usage();
+    }
+    if(nworkers == 0) return serve_usage();
+    if(strlen(path) >= sizeof addr.sun_path) {
+        fprintf(stderr, "serve: socket path too long\n");
+        return EXIT_FAILURE;
+    }
+    strcpy(addr.sun_path, path);
+
+    /* a socket file nobody answers on is left over from a server that died */
+    if((fd = serve_connect(path)) >= 0) {
+        fprintf(stderr, "serve: a server is already listening on %s\n", path);
+        close(fd);
+        return EXIT_FAILURE;
+    }
+    unlink(path);
+
+    if((lfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        perror("serve: socket");
+        return EXIT_FAILURE;
+    }
+    fcntl(lfd, F_SETFL, O_NONBLOCK);
+    mask = umask(077);
+    if(bind(lfd, (struct sockaddr *)&addr, sizeof addr) < 0 || listen(lfd, SOMAXCONN) < 0) {
+        perror("serve: bind");
+        return EXIT_FAILURE;
+    }
+    umask(mask);
+
+    keygen((uint8_t *)seeds, sizeof seeds);
+    keys = hashmap_sharded_new(sizeof(struct serve_key), 0, nworkers * 4, seeds[0], seeds[1],
+                               key_hash, key_compare, NULL, NULL);
+    workers = calloc(nworkers, sizeof *workers);
+    if(!keys || !workers) {
+        fprintf(stderr, "serve: out of memory\n");
+        unlink(path);
+        return EXIT_FAILURE;
+    }
+    ev.data.fd = lfd;
+    if((epfd = epoll_create1(0)) < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev) < 0) {
+        perror("serve: epoll");
+        unlink(path);
+        return EXIT_FAILURE;
+    }
+
+    /* the workers inherit the mask, the signals only ever reach sigwait */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+    for(unsigned i = 0; i < nworkers; i++)
+        if(pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]) != 0) {
+            fprintf(stderr, "serve: could not start worker %u\n", i);
+            unlink(path);
+            return EXIT_FAILURE;
+        }
+    fprintf(stderr, "serve: listening on %s with %u workers\n", path, nworkers);
+
+    sigwait(&sigs, &sig);
+    fprintf(stderr, "serve: %s, %zu keys dropped\n", strsignal(sig), hashmap_sharded_count(keys));
+    unlink(path);
+    return EXIT_SUCCESS;
+}
+
+REGISTER_COMMAND("serve", cmd_serve);
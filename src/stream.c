@@ -0,0 +1,196 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stream.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <alloc.h>
+#include <perf.h>
+
+#define SLOT_EMPTY (-2)
+
+/* the two buffers are handed back and forth between reader and writer */
+struct pipeline {
+    struct stream *s;
+    ssize_t len[2];                   /* SLOT_EMPTY, -1 error, 0 EOF or size */
+    unsigned first;                   /* first slot the reader fills */
+    int done;                         /* writer gave up, reader should stop */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static ssize_t read_retry(int fd, void *buf, size_t sz) {
+    ssize_t n;
+    PERF_BEGIN(PERF_IO);
+    do
+        n = read(fd, buf, sz);
+    while(n < 0 && errno == EINTR);
+    PERF_END(PERF_IO);
+    return n;
+}
+
+int stream_write(int fd, const void *buf, size_t sz) {
+    const char *p = buf;
+    int ret = 0;
+    PERF_BEGIN(PERF_IO);
+    while(sz > 0) {
+        ssize_t n = write(fd, p, sz);
+        if(n < 0) {
+            if(errno == EINTR) continue;
+            ret = -1;
+            break;
+        }
+        p += n, sz -= n;
+    }
+    PERF_END(PERF_IO);
+    return ret;
+}
+
+int stream_init(struct stream *s, int fd_in, int fd_out) {
+    s->fd_in = fd_in;
+    s->fd_out = fd_out;
+    s->len = 0;
+    s->buf[0] = slab_alloc(STREAM_CHUNK);
+    s->buf[1] = slab_alloc(STREAM_CHUNK);
+    if(!s->buf[0] || !s->buf[1]) {
+        stream_free(s);
+        return -1;
+    }
+    return 0;
+}
+
+void stream_free(struct stream *s) {
+    slab_free(s->buf[0]);
+    slab_free(s->buf[1]);
+    s->buf[0] = s->buf[1] = NULL;
+}
+
+ssize_t stream_getline(struct stream *s, char *line, size_t sz) {
+    char *nl;
+    size_t n, linelen;
+
+    /* prompts go through stdio, make sure they show up before we block */
+    fflush(stdout);
+    while(!(nl = memchr(s->buf[0], '\n', s->len))) {
+        ssize_t r;
+        if(s->len == STREAM_CHUNK) break;
+        r = read_retry(s->fd_in, s->buf[0] + s->len, STREAM_CHUNK - s->len);
+        if(r <= 0) {
+            if(s->len == 0) return -1;
+            break;
+        }
+        s->len += r;
+    }
+
+    linelen = nl ? (size_t)(nl - s->buf[0]) : s->len;
+    if(sz > 0) {
+        n = linelen < sz-1 ? linelen : sz-1;
+        memcpy(line, s->buf[0], n);
+        line[n] = '\0';
+    }
+    n = linelen + (nl != NULL);
+    memmove(s->buf[0], s->buf[0] + n, s->len - n);
+    s->len -= n;
+    return linelen;
+}
+
+static void *reader(void *arg) {
+    struct pipeline *p = arg;
+    unsigned i = p->first;
+
+    for(;;) {
+        ssize_t n;
+
+        pthread_mutex_lock(&p->lock);
+        while(p->len[i] != SLOT_EMPTY && !p->done)
+            pthread_cond_wait(&p->cond, &p->lock);
+        if(p->done) {
+            pthread_mutex_unlock(&p->lock);
+            return NULL;
+        }
+        pthread_mutex_unlock(&p->lock);
+
+        n = read_retry(p->s->fd_in, p->s->buf[i], STREAM_CHUNK);
+
+        pthread_mutex_lock(&p->lock);
+        p->len[i] = n < 0 ? -1 : n;
+        pthread_cond_broadcast(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+
+        if(n <= 0) return NULL;
+        i ^= 1;
+    }
+}
+
+int stream_transform(struct stream *s, const char *prefix, stream_fn fn, void *udata) {
+    struct pipeline p = {
+        .s = s,
+        .len = { SLOT_EMPTY, SLOT_EMPTY },
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+    };
+    pthread_t thread;
+    unsigned i = 0;
+    int ret = 0;
+
+    fflush(stdout);
+
+    /* whatever stream_getline read past the last line goes first */
+    if(s->len > 0) {
+        p.len[0] = s->len;
+        p.first = 1;
+        s->len = 0;
+    }
+
+    if(pthread_create(&thread, NULL, reader, &p) != 0)
+        return -1;
+
+    for(;;) {
+        ssize_t n;
+
+        pthread_mutex_lock(&p.lock);
+        while(p.len[i] == SLOT_EMPTY)
+            pthread_cond_wait(&p.cond, &p.lock);
+        n = p.len[i];
+        pthread_mutex_unlock(&p.lock);
+
+        if(n <= 0) {
+            ret = n < 0 ? -1 : 0;
+            break;
+        }
+
+        fn(s->buf[i], n, udata);
+        if(prefix) {
+            if(stream_write(s->fd_out, prefix, strlen(prefix)) < 0) {
+                ret = -1;
+                break;
+            }
+            prefix = NULL;
+        }
+        if(stream_write(s->fd_out, s->buf[i], n) < 0) {
+            ret = -1;
+            break;
+        }
+
+        pthread_mutex_lock(&p.lock);
+        p.len[i] = SLOT_EMPTY;
+        pthread_cond_broadcast(&p.cond);
+        pthread_mutex_unlock(&p.lock);
+        i ^= 1;
+    }
+
+    pthread_mutex_lock(&p.lock);
+    p.done = 1;
+    pthread_cond_broadcast(&p.cond);
+    pthread_mutex_unlock(&p.lock);
+    /* the reader might be stuck in read(2) if we bailed out early */
+    if(ret < 0) pthread_cancel(thread);
+    pthread_join(thread, NULL);
+
+    return ret;
+}
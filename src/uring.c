@@ -0,0 +1,119 @@
+#define _GNU_SOURCE                     /* syscall, MAP_POPULATE */
+
+#include <uring.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* the kernel reads the submission tail and writes the completion tail, so
+ * those need acquire and release ordering, see io_uring_setup(2) */
+#define load_acquire(p)     __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+int uring_init(struct uring *r, unsigned entries) {
+    struct io_uring_params p;
+    char *sq, *cq;
+    int fd;
+
+    memset(r, 0, sizeof *r);
+    memset(&p, 0, sizeof p);
+    if((fd = syscall(__NR_io_uring_setup, entries, &p)) < 0) return -1;
+    r->fd = fd;
+
+    r->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    /* since 5.4 both rings are one mapping */
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        if(r->cq_ring_sz > r->sq_ring_sz) r->sq_ring_sz = r->cq_ring_sz;
+        r->cq_ring_sz = r->sq_ring_sz;
+    }
+    r->sq_ring = mmap(NULL, r->sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_SQ_RING);
+    if(r->sq_ring == MAP_FAILED) goto fail;
+    if(p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ring = r->sq_ring;
+    } else {
+        r->cq_ring = mmap(NULL, r->cq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          fd, IORING_OFF_CQ_RING);
+        if(r->cq_ring == MAP_FAILED) goto fail;
+    }
+    r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   fd, IORING_OFF_SQES);
+    if(r->sqes == MAP_FAILED) goto fail;
+
+    sq = r->sq_ring;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    cq = r->cq_ring;
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->sq_local_tail = *r->sq_tail;
+    return 0;
+
+fail:
+    uring_free(r);
+    return -1;
+}
+
+void uring_free(struct uring *r) {
+    int err = errno;
+
+    if(r->sqes && r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_sz);
+    if(r->cq_ring && r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring)
+        munmap(r->cq_ring, r->cq_ring_sz);
+    if(r->sq_ring && r->sq_ring != MAP_FAILED) munmap(r->sq_ring, r->sq_ring_sz);
+    close(r->fd);
+    memset(r, 0, sizeof *r);
+    r->fd = -1;
+    errno = err;
+}
+
+int uring_register_buffers(struct uring *r, const struct iovec *iov, unsigned n) {
+    return syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS, iov, n) < 0 ? -1 : 0;
+}
+
+struct io_uring_sqe *uring_sqe(struct uring *r) {
+    unsigned tail = r->sq_local_tail, mask = *r->sq_mask;
+    struct io_uring_sqe *sqe;
+
+    if(tail - load_acquire(r->sq_head) > mask) return NULL;
+    sqe = &r->sqes[tail & mask];
+    memset(sqe, 0, sizeof *sqe);
+    /* entries are used in order, so the index array is the identity */
+    r->sq_array[tail & mask] = tail & mask;
+    r->sq_local_tail = tail + 1;
+    return sqe;
+}
+
+int uring_enter(struct uring *r, unsigned wait) {
+    long n;
+
+    store_release(r->sq_tail, r->sq_local_tail);
+    do {
+        /* anything the kernel didn't take last time is still there too */
+        unsigned submit = r->sq_local_tail - load_acquire(r->sq_head);
+        n = syscall(__NR_io_uring_enter, r->fd, submit, wait,
+                    wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while(n < 0 && errno == EINTR);
+    return n < 0 ? -1 : 0;
+}
+
+struct io_uring_cqe *uring_cqe(struct uring *r) {
+    unsigned head = *r->cq_head;
+
+    if(head == load_acquire(r->cq_tail)) return NULL;
+    return &r->cqes[head & *r->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *r) {
+    store_release(r->cq_head, *r->cq_head + 1);
+}
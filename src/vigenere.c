@@ -1,33 +1,109 @@
 #include <algorithms.h>
 
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <algo_utils.h>
+#include <encro.h>
+#include <perf.h>
+#include <stream.h>
 
-void algo_vigenere(void) {
-    char buf[256], key[256];
+/* decryption is encryption with every shift negated */
+int encro_vigenere_init(struct encro_vigenere *v, const char *key, int decrypt) {
+    v->len = strlen(key);
+    v->pos = 0;
+    if(v->len >= ENCRO_VIGENERE_KEYSZ) return -1;
+    for(size_t i = 0; i < v->len; i++) {
+        v->shift[i] = IS_UPPERCASE(key[i])
+            ? key[i] - 'A'
+            : IS_LOWERCASE(key[i])
+            ? key[i] - 'a'
+            : 0;
+        if(decrypt) v->shift[i] = (26 - v->shift[i]) % 26;
+    }
+    return 0;
+}
+
+void encro_vigenere_buf(struct encro_vigenere *v, char *buf, size_t sz) {
+    size_t pos = v->pos;
+
+    if(v->len == 0) return;
+    PERF_BEGIN(PERF_CLASSICAL);
+    for(size_t i = 0; i < sz; i++) {
+        unsigned char c = buf[i], idx = (c | 0x20) - 'a';
+        if(idx < 26) {
+            unsigned char s = v->shift[pos];
+            buf[i] = c + (idx + s >= 26 ? s - 26 : s);
+            if(++pos == v->len) pos = 0;
+        }
+    }
+    v->pos = pos;
+    PERF_END(PERF_CLASSICAL);
+}
+
+static void vigenere_stream(char *buf, size_t sz, void *udata) {
+    encro_vigenere_buf(udata, buf, sz);
+}
+
+static void vigenere(int decrypt) {
+    struct stream s;
+    struct encro_vigenere v;
+    char key[ENCRO_VIGENERE_KEYSZ];
+
+    if(stream_init(&s, STDIN_FILENO, STDOUT_FILENO) < 0) {
+        fprintf(stderr, "out of memory\n");
+        return;
+    }
 
-    printf("plaintext: ");
-    fgets(buf, sizeof buf, stdin);
-    buf[strcspn(buf, "\n")] = '\0';
     printf("key: ");
-    fgets(key, sizeof key, stdin);
-    key[strcspn(key, "\n")] = '\0';
-
-    for(char *c = buf, *k = key; *c; c++) {
-        unsigned char shift;
-        if(*k == '\0') k = key;
-        shift = IS_UPPERCASE(*k)
-            ? *k - 'A'
-            : IS_LOWERCASE(*k)
-            ? *k - 'a'
-            : 0;
+    if(stream_getline(&s, key, sizeof key) < 0) goto out;
+    encro_vigenere_init(&v, key, decrypt);
 
-        if(IS_UPPERCASE(*c))
-            *c = 'A' + (*c - 'A' + shift) % 26, k++;
-        else if(IS_LOWERCASE(*c))
-            *c = 'a' + (*c - 'a' + shift) % 26, k++;
+    printf(decrypt ? "ciphertext: " : "plaintext: ");
+    stream_transform(&s, decrypt ? "plaintext: " : "ciphertext: ", vigenere_stream, &v);
+
+out:
+    stream_free(&s);
+}
+
+void algo_vigenere(void) {
+    vigenere(0);
+}
+
+void algo_vigenere_decrypt(void) {
+    vigenere(1);
+}
+
+int verify_vigenere(size_t sz) {
+    char *orig = malloc(sz), *buf = malloc(sz), key[17];
+    struct encro_vigenere enc, dec;
+    double t0, t1, t2;
+    int ok;
+
+    if(!orig || !buf) {
+        free(orig); free(buf);
+        return 0;
     }
-    printf("ciphertext: %s\n", buf);
+    for(size_t i = 0; i < sizeof key - 1; i++)
+        key[i] = 'A' + encro_rng_uniform(26);
+    key[sizeof key - 1] = '\0';
+    encro_vigenere_init(&enc, key, 0);
+    encro_vigenere_init(&dec, key, 1);
+
+    random_text(orig, sz);
+    memcpy(buf, orig, sz);
+
+    t0 = time_now();
+    encro_vigenere_buf(&enc, buf, sz);
+    t1 = time_now();
+    encro_vigenere_buf(&dec, buf, sz);
+    t2 = time_now();
+
+    ok = verify_report("vigenere", sz, t1 - t0, t2 - t1, memcmp(orig, buf, sz) == 0);
+    free(orig); free(buf);
+    return ok;
 }
+
+REGISTER_ALGORITHM("vigenere", algo_vigenere, algo_vigenere_decrypt, verify_vigenere);
@@ -0,0 +1,234 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <algorithms.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <encro.h>
+
+#define CRACK_READSZ     (1<<20)
+
+/* relative letter frequencies of english text, in percent */
+static const double english_freq[26] = {
+    8.167, 1.492, 2.782, 4.253, 12.702, 2.228, 2.015, 6.094, 6.966, 0.153,
+    0.772, 4.025, 2.406, 6.749,  7.507, 1.929, 0.095, 5.987, 6.327, 9.056,
+    2.758, 0.978, 2.360, 0.150,  1.974, 0.074,
+};
+
+struct period_job {
+    const uint8_t *text;
+    size_t len;
+    unsigned period;
+    /* one histogram per column, points into the shared table */
+    uint64_t (*hist)[26];
+    double ic;
+};
+
+/* strips everything but letters and maps them to 0-25 in place
+ * returns the number of letters kept */
+size_t encro_compact_letters(uint8_t *buf, size_t sz) {
+    size_t n = 0;
+    for(size_t i = 0; i < sz; i++) {
+        /* folds uppercase onto lowercase, nothing else lands in a-z */
+        uint8_t c = (buf[i] | 0x20) - 'a';
+        if(c < 26) buf[n++] = c;
+    }
+    return n;
+}
+
+static void *count_period(void *arg) {
+    struct period_job *job = arg;
+    const uint8_t *t = job->text;
+    const unsigned period = job->period;
+    size_t i = 0;
+
+    memset(job->hist, 0, period * sizeof *job->hist);
+    for(; i + period <= job->len; i += period)
+        for(unsigned c = 0; c < period; c++)
+            job->hist[c][t[i + c]]++;
+    for(unsigned c = 0; i < job->len; i++, c++)
+        job->hist[c][t[i]]++;
+
+    /* average index of coincidence over all columns */
+    job->ic = 0;
+    for(unsigned c = 0; c < period; c++) {
+        uint64_t n = 0, sum = 0;
+        for(unsigned l = 0; l < 26; l++) {
+            n += job->hist[c][l];
+            sum += job->hist[c][l] * (job->hist[c][l] - (job->hist[c][l] > 0));
+        }
+        if(n > 1) job->ic += (double)sum / ((double)n * (n-1));
+    }
+    job->ic /= period;
+
+    return NULL;
+}
+
+/* chi-squared frequency scoring of every shift for one column */
+static unsigned solve_column(const uint64_t *hist) {
+    uint64_t n = 0;
+    unsigned best = 0;
+    double best_score = -1;
+
+    for(unsigned l = 0; l < 26; l++) n += hist[l];
+    if(n == 0) return 0;
+
+    for(unsigned shift = 0; shift < 26; shift++) {
+        double score = 0;
+        for(unsigned l = 0; l < 26; l++) {
+            double expected = english_freq[l] / 100 * n;
+            double d = hist[(l + shift) % 26] - expected;
+            score += d*d / expected;
+        }
+        if(best_score < 0 || score < best_score)
+            best_score = score, best = shift;
+    }
+    return best;
+}
+
+/* estimates the key length of a vigenere ciphertext of len letters (0-25) and
+ * recovers the key, writes period+1 bytes (nul-terminated) to key
+ * max_period must be at most ENCRO_CRACK_MAX_PERIOD
+ * returns the key length or 0 on error */
+unsigned encro_vigenere_crack(const uint8_t *text, size_t len, unsigned max_period, char *key) {
+    struct period_job jobs[ENCRO_CRACK_MAX_PERIOD];
+    pthread_t threads[ENCRO_CRACK_MAX_PERIOD];
+    uint64_t (*hist)[26];
+    unsigned p, period;
+    double max_ic = 0;
+
+    if(max_period > ENCRO_CRACK_MAX_PERIOD) max_period = ENCRO_CRACK_MAX_PERIOD;
+    if(max_period > len) max_period = len;
+    if(max_period == 0) return 0;
+
+    /* the histograms for every candidate period live in one table so the
+     * column solver can reuse the ones counted for the winning period */
+    hist = malloc(max_period*(max_period+1)/2 * sizeof *hist);
+    if(!hist) return 0;
+
+    /* one candidate period per thread */
+    for(p = 0; p < max_period; p++) {
+        jobs[p] = (struct period_job){
+            .text = text, .len = len, .period = p+1,
+            .hist = hist + p*(p+1)/2,
+        };
+        if(pthread_create(&threads[p], NULL, count_period, &jobs[p]) != 0)
+            count_period(&jobs[p]), threads[p] = pthread_self();
+    }
+    for(p = 0; p < max_period; p++)
+        if(!pthread_equal(threads[p], pthread_self()))
+            pthread_join(threads[p], NULL);
+
+    for(p = 0; p < max_period; p++)
+        if(jobs[p].ic > max_ic) max_ic = jobs[p].ic;
+
+    /* multiples of the real period score about as well as the period itself,
+     * so take the shortest one that is close to the best */
+    for(p = 0; p < max_period - 1; p++)
+        if(jobs[p].ic >= max_ic * 0.9) break;
+    period = p+1;
+
+    for(unsigned c = 0; c < period; c++)
+        key[c] = 'A' + solve_column(jobs[p].hist[c]);
+    key[period] = '\0';
+
+    free(hist);
+    return period;
+}
+
+void algo_vigenere_crack(void) {
+    uint8_t *buf = NULL;
+    size_t len = 0, cap = 0, n;
+    char key[ENCRO_CRACK_MAX_PERIOD+1];
+    unsigned period;
+
+    printf("ciphertext: ");
+    fflush(stdout);
+    do {
+        if(cap - len < CRACK_READSZ) {
+            uint8_t *tmp = realloc(buf, cap = cap*2 + CRACK_READSZ);
+            if(!tmp) {
+                fprintf(stderr, "out of memory\n");
+                free(buf);
+                return;
+            }
+            buf = tmp;
+        }
+        n = fread(buf + len, 1, cap - len, stdin);
+        len += n;
+    } while(n > 0);
+
+    len = encro_compact_letters(buf, len);
+    period = encro_vigenere_crack(buf, len, ENCRO_CRACK_MAX_PERIOD, key);
+    free(buf);
+
+    if(period == 0) {
+        fprintf(stderr, "no letters in ciphertext or out of memory\n");
+        return;
+    }
+    printf("\nkey length: %u\n", period);
+    printf("key: %s\n", key);
+}
+
+REGISTER_ALGORITHM("vigenere-crack", algo_vigenere_crack, NULL, NULL);
+
+//==============================================================================
+// BENCHMARKS
+// $ cc -DVIGENERE_CRACK_BENCH -O3 -Iinclude src/vigenere_crack.c -lpthread
+// $ MAX=1073741824 ./a.out
+//==============================================================================
+#ifdef VIGENERE_CRACK_BENCH
+
+#include <time.h>
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* english-looking letters already shifted by key */
+static void gen_ciphertext(uint8_t *buf, size_t len, const char *key) {
+    double cdf[26], acc = 0;
+    size_t keylen = strlen(key);
+
+    for(unsigned l = 0; l < 26; l++) cdf[l] = acc += english_freq[l];
+    for(size_t i = 0; i < len; i++) {
+        double r = (double)rand() / RAND_MAX * acc;
+        unsigned l = 0;
+        while(l < 25 && cdf[l] < r) l++;
+        buf[i] = (l + key[i % keylen] - 'A') % 26;
+    }
+}
+
+int main(void) {
+    const char *key = getenv("KEY") ? getenv("KEY") : "LEMONADESTAND";
+    size_t max = getenv("MAX") ? strtoull(getenv("MAX"), NULL, 0) : (size_t)1<<30;
+    uint8_t *buf = malloc(max);
+    char found[ENCRO_CRACK_MAX_PERIOD+1];
+
+    if(!buf) {
+        fprintf(stderr, "cannot allocate %zu bytes\n", max);
+        return 1;
+    }
+    srand(1);
+    gen_ciphertext(buf, max, key);
+
+    printf("Running vigenere_crack benchmarks...\n");
+    for(size_t len = 1<<20; len <= max; len *= 4) {
+        double begin = now();
+        unsigned period = encro_vigenere_crack(buf, len, ENCRO_CRACK_MAX_PERIOD, found);
+        double elapsed = now() - begin;
+        printf("%-6zu MB  %.3f secs, %.1f MB/sec, period %u, key %s%s\n",
+               len>>20, elapsed, (double)len / elapsed / 1024 / 1024,
+               period, found, strcmp(found, key) ? " (MISMATCH)" : "");
+    }
+    free(buf);
+    return 0;
+}
+
+#endif